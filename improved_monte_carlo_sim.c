@@ -1,10 +1,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <math.h>
 #include <time.h>
 #include <ctype.h>
 #include <getopt.h>
+#include <fnmatch.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #ifdef _OPENMP
 #include <omp.h>
 #endif
@@ -17,12 +24,83 @@
 #define DEFAULT_GRAPH_WIDTH 60
 #define DEFAULT_GRAPH_HEIGHT 20
 #define DEFAULT_VOLATILITY_FACTOR 1.5
+#define STOCK_ALLOC_CHUNK 64
+#define SCRATCH_MAGIC "LISPATH1"
+#define SCRATCH_VERSION 1
+#define SCRATCH_HEADER_SIZE 64
+#define SORT_INSERTION_THRESHOLD 24
+#define SORT_SERIAL_THRESHOLD 4096
+#define RADIX_SORT_MIN_ELEMENTS (1 << 16)
+#define RADIX_BITS 11
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+#define RADIX_PASSES ((64 + RADIX_BITS - 1) / RADIX_BITS)
+#define SAMPLESORT_BUCKETS_PER_THREAD 4
+#define SAMPLESORT_OVERSAMPLE 32
+#define QUANTILE_SELECT_MAX 4
+#define SKETCH_RELATIVE_ACCURACY 0.002
+#define SKETCH_LOG_GAMMA 0.004000005333346137   // ln((1 + a) / (1 - a)) for the accuracy above
+#define SKETCH_BUCKETS 6144
+#define SKETCH_KEY_OFFSET 2304
+#define SKETCH_MIN_MAGNITUDE 1e-4
+#define TAIL_BUFFER_SIZE 256
+#define GPD_MIN_EXCEEDANCES 30
+#define GPD_GRID_BASE 30
+#define STREAM_CHUNK_PATHS 16384
+#define PARTIAL_MAGIC "LISPART1"
+#define PARTIAL_VERSION 6
+#define CHECKPOINT_MAGIC "LISCKPT1"
+#define CHECKPOINT_VERSION 6
+#define DEFAULT_CHECKPOINT_INTERVAL 300
+#define BUDGET_PILOT_PATHS STREAM_CHUNK_PATHS
+#define BUDGET_SAFETY_FRACTION 0.9
+#define BUDGET_PASS_FRACTION 0.5
+#define BUDGET_MIN_PASS_SECONDS 0.1
+#define DEFAULT_ANALYTIC_TOLERANCE 0.5
+#define ANALYTIC_MAX_NEGATIVE_PROB 1e-6
+#define DEFAULT_IMPORTANCE_LEVEL 0.001
+#define SENSITIVITY_LEVELS 3
+#define MAX_FACTORS 8
+#define FACTOR_STREAM_NAME "@factors"
+#define MAX_REGIMES 8
+#define REGIME_STREAM_NAME "@regimes"
+#define REGIME_STATIONARY_ITERATIONS 1000
+#define JUMP_STREAM_SUFFIX "@jumps"
+#define JUMP_MAX_COUNT 128
+#define JUMP_MAX_INTENSITY 2.0
+#define DEFAULT_BLOCK_LENGTH 3.0
+#define HISTORY_MIN_OBSERVATIONS 8
+#define MAX_SCENARIOS 8
+#define SCENARIO_STREAM_NAME "@scenarios"
+#define MAX_BARRIERS 8
+#define DEFAULT_BARRIERS "-10,-25,-50"
+#define PATH_RISK_CHUNKS 64
+#define MAX_STRESS_SCENARIOS 16
+#define MAX_STRESS_RULES 256
+#define DEFAULT_ERROR_BATCHES 32
+#define REVERSE_INITIAL_SHIFT 1.0
+#define REVERSE_MAX_SHIFT 100.0
+#define REVERSE_TOLERANCE 0.005
+#define REVERSE_MAX_ITERATIONS 60
+#define FAN_BANDS 5
+#define FAN_SVG_WIDTH 720
+#define FAN_SVG_HEIGHT 420
+#define COPULA_TABLE_SIZE 8192
+#define SHOCK_TABLE_SIZE 4096
+#define SHOCK_TABLE_MAX_SCORE 8.5
+#define SHOCK_GRID_POINTS 16384
+#define SHOCK_GRID_MAX_ASINH 19.0
+#define SHOCK_TABLE_CACHE 32
 
 typedef struct {
     char ticker[MAX_TICKER_LENGTH];
     int num_years;
-    double growth_rates[MAX_YEARS];
+    double growth_rates[MAX_YEARS];   // the weighted blend under a scenario mixture
     int years[MAX_YEARS];
+    int num_scenarios;                // 0 for a single forecast
+    char scenario_names[MAX_SCENARIOS][MAX_TICKER_LENGTH];
+    double scenario_weights[MAX_SCENARIOS];
+    double scenario_cumulative[MAX_SCENARIOS];
+    double scenario_growth[MAX_SCENARIOS][MAX_YEARS];
 } StockData;
 
 typedef struct {
@@ -39,6 +117,192 @@ typedef struct {
     double var_99;
 } Statistics;
 
+// Statistics summarised per batch for batch-means standard errors
+enum {
+    BATCH_MEAN,
+    BATCH_STD_DEV,
+    BATCH_P1,
+    BATCH_P5,
+    BATCH_P25,
+    BATCH_P50,
+    BATCH_P75,
+    BATCH_P95,
+    BATCH_STATS
+};
+
+// Report metrics selectable with --metrics
+enum {
+    METRIC_MEAN          = 1 << 0,
+    METRIC_STD_DEV       = 1 << 1,
+    METRIC_MIN           = 1 << 2,
+    METRIC_MAX           = 1 << 3,
+    METRIC_P5            = 1 << 4,
+    METRIC_P25           = 1 << 5,
+    METRIC_P50           = 1 << 6,
+    METRIC_P75           = 1 << 7,
+    METRIC_P95           = 1 << 8,
+    METRIC_VAR_95        = 1 << 9,
+    METRIC_VAR_99        = 1 << 10,
+    METRIC_PROBABILITIES = 1 << 11,
+    METRIC_HISTOGRAM     = 1 << 12,
+    METRIC_YEARS         = 1 << 13,
+    METRIC_TAIL          = 1 << 14,
+    METRIC_PATH          = 1 << 15,
+    METRIC_FAN           = 1 << 16
+};
+
+#define METRIC_SUMMARY (METRIC_MEAN | METRIC_STD_DEV | METRIC_MIN | METRIC_MAX)
+#define METRIC_PERCENTILES (METRIC_P5 | METRIC_P25 | METRIC_P50 | METRIC_P75 | METRIC_P95)
+#define METRIC_RISK (METRIC_VAR_95 | METRIC_VAR_99)
+#define METRIC_ALL ((1u << 17) - 1)
+
+// What calculate_statistics and run_monte_carlo actually have to compute
+typedef struct {
+    unsigned metrics;
+    int full_sort;       // an exporter needs the values in order
+    int retain_paths;    // per-year metrics need the annual return matrix
+} MetricPlan;
+
+typedef enum {
+    SORT_AUTO,
+    SORT_RADIX,
+    SORT_SAMPLE,
+    SORT_QSORT
+} SortAlgorithm;
+
+// Loadings of one ticker on the shared factors (--factors)
+typedef struct {
+    char ticker[MAX_TICKER_LENGTH];
+    double loadings[MAX_FACTORS];
+} FactorTicker;
+
+typedef struct {
+    int num_factors;
+    char names[MAX_FACTORS][MAX_TICKER_LENGTH];
+    int num_tickers;
+    FactorTicker *tickers;
+} FactorLoadings;
+
+// Markov regime chain shared by all tickers (--regimes)
+typedef struct {
+    int num_regimes;
+    char names[MAX_REGIMES][MAX_TICKER_LENGTH];
+    double shift[MAX_REGIMES];         // added to the year's growth, in points
+    double scale[MAX_REGIMES];         // multiplies the year's deviation
+    double transition[MAX_REGIMES][MAX_REGIMES];
+    double cumulative[MAX_REGIMES][MAX_REGIMES];   // row prefix sums, for sampling
+    double initial[MAX_REGIMES];       // first-year distribution
+    double initial_cumulative[MAX_REGIMES];
+} RegimeModel;
+
+// One ticker's residuals inside HistoryFile.residuals
+typedef struct {
+    char ticker[MAX_TICKER_LENGTH];
+    int offset;
+    int count;
+} HistorySeries;
+
+// Historical residuals for the block bootstrap (--history), packed ticker by ticker
+typedef struct {
+    int num_series;
+    HistorySeries *series;
+    double *residuals;   // each series demeaned and scaled to unit variance
+} HistoryFile;
+
+// One --stress rule: a growth shock on years [first_year, last_year] of the matching tickers
+typedef struct {
+    int scenario;
+    char target[MAX_TICKER_LENGTH];   // ticker pattern, or @SECTOR
+    int first_year;                   // 0-based, inclusive; calendar years when calendar is set
+    int last_year;
+    int calendar;
+    int multiplicative;               // value scales the forecast instead of adding points
+    double value;
+} StressRule;
+
+typedef struct {
+    char sector[MAX_TICKER_LENGTH];
+    char ticker[MAX_TICKER_LENGTH];
+} SectorMember;
+
+// Reverse stress limit (--reverse-stress): VaR in percent loss, or a loss probability
+typedef enum {
+    REVERSE_NONE,
+    REVERSE_VAR_95,
+    REVERSE_VAR_99,
+    REVERSE_LOSS_PROBABILITY
+} ReverseTarget;
+
+typedef struct {
+    ReverseTarget kind;
+    double limit;        // VaR limit, or probability in percent
+    double loss_level;   // loss in percent whose probability is limited
+} ReverseStress;
+
+// Stress scenarios from --stress; a scenario's rules apply in file order
+typedef struct {
+    int num_scenarios;
+    char names[MAX_STRESS_SCENARIOS][MAX_TICKER_LENGTH];
+    int num_rules;
+    StressRule rules[MAX_STRESS_RULES];
+    int num_members;
+    SectorMember *members;
+} StressFile;
+
+// Per-year shock distribution (--distribution, dist= in --model-file)
+typedef enum {
+    DIST_NORMAL,
+    DIST_STUDENT_T,
+    DIST_SKEW_NORMAL,
+    DIST_NIG
+} DistributionKind;
+
+typedef struct {
+    DistributionKind kind;
+    double shape;   // t: degrees of freedom; skew-normal: alpha; NIG: alpha (tail heaviness)
+    double skew;    // NIG: beta, with |beta| < alpha
+} ShockDistribution;
+
+// GARCH(1,1) volatility (--garch, garch= in --model-file); alpha 0 keeps it constant
+typedef struct {
+    double alpha;   // weight of last year's squared deviation
+    double beta;    // persistence of last year's variance
+} GarchParams;
+
+// Merton jumps (--jumps, jumps= in --model-file); intensity 0 disables them
+typedef struct {
+    double intensity;   // expected jumps per year
+    double mean;        // mean jump size, in growth points
+    double std_dev;     // jump size dispersion, in growth points
+} JumpParams;
+
+// First-passage barriers (--barriers): cumulative change in percent, sorted descending
+typedef struct {
+    int count;
+    double levels[MAX_BARRIERS];
+} BarrierSet;
+
+// One ticker's line of the --model-file (persistence: AR(1) phi of the deviations)
+typedef struct {
+    char ticker[MAX_TICKER_LENGTH];
+    int has_distribution;
+    ShockDistribution distribution;
+    int has_garch;
+    GarchParams garch;
+    int has_jumps;
+    JumpParams jumps;
+    int has_persistence;
+    double persistence;
+} TickerModel;
+
+typedef struct {
+    int num_tickers;
+    TickerModel *tickers;
+} ModelFile;
+
+// Sort keys are reinterpreted in place over double arrays
+typedef uint64_t __attribute__((may_alias)) sort_key_t;
+
 typedef struct {
     int num_simulations;
     double volatility_factor;
@@ -49,13 +313,232 @@ typedef struct {
     int export_csv;
     int verbose;
     int num_threads;
+    char scratch_file[MAX_LINE_LENGTH];
+    int out_of_core;
+    SortAlgorithm sort_algorithm;
+    unsigned metrics;
+    uint64_t seed;
+    int seed_set;
+    int shard_index;
+    int shard_count;
+    char partial_file[MAX_LINE_LENGTH];
+    char checkpoint_file[MAX_LINE_LENGTH];
+    int checkpoint_interval;
+    int resume;
+    char state_file[MAX_LINE_LENGTH];
+    int extend_to;
+    double time_budget;
+    int analytic;
+    double analytic_tolerance;
+    double importance_level;
+    int sensitivities;
+    char factor_file[MAX_LINE_LENGTH];
+    const FactorLoadings *factors;   // loaded from factor_file, NULL without --factors
+    double copula_dof;
+    const struct CopulaTable *copula;   // built from copula_dof, NULL without --t-copula
+    char regime_file[MAX_LINE_LENGTH];
+    char regime_start[MAX_TICKER_LENGTH];
+    const RegimeModel *regimes;      // loaded from regime_file, NULL without --regimes
+    char history_file[MAX_LINE_LENGTH];
+    double block_length;
+    const HistoryFile *history;      // loaded from history_file, NULL without --history
+    ShockDistribution distribution;
+    GarchParams garch;
+    JumpParams jumps;
+    double persistence;              // AR(1) phi of the standardized deviations
+    BarrierSet barriers;
+    char model_file[MAX_LINE_LENGTH];
+    const ModelFile *models;         // loaded from model_file, NULL without --model-file
+    char stress_file[MAX_LINE_LENGTH];
+    const StressFile *stress;        // loaded from stress_file, NULL without --stress
+    ReverseStress reverse;
+    int error_batches;               // batches for standard errors, 0 without --std-errors
+    int fan_svg;                     // also draw the fan chart as <TICKER>_fan_chart.svg
 } SimulationConfig;
 
+/*
+ * Out-of-core scratch file layout (fixed-width integers and IEEE doubles in
+ * the host's native byte order, so the export is not portable between
+ * machines of different endianness):
+ *
+ *   [ScratchFileHeader, 64 bytes]
+ *   [block 0][block 1]...              each block starts on a page boundary
+ *
+ * A block holds one ticker's full path set:
+ *
+ *   [ScratchBlockHeader, 64 bytes]
+ *   double final_values[num_simulations]
+ *   float  annual_returns[num_years][num_simulations]   (year-major)
+ *
+ * Year-major float storage halves the footprint of the path matrix and lets
+ * the year-by-year statistics stream through one contiguous row at a time.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_blocks;
+    uint64_t total_bytes;
+    char reserved[SCRATCH_HEADER_SIZE - 24];
+} ScratchFileHeader;
+
+typedef struct {
+    char ticker[MAX_TICKER_LENGTH];
+    int32_t num_years;
+    int32_t first_year;
+    uint64_t num_simulations;
+    uint64_t block_bytes;
+    char reserved[SCRATCH_HEADER_SIZE - MAX_TICKER_LENGTH - 24];
+} ScratchBlockHeader;
+
+typedef struct {
+    int fd;
+    size_t page_size;
+    uint64_t next_offset;
+    uint32_t num_blocks;
+    void *map;
+    size_t map_length;
+    double *final_values;
+    float *annual_returns;
+} ScratchFile;
+
+// Streaming mean/variance/extremes (Welford, merged with Chan's formula)
+typedef struct {
+    uint64_t count;
+    double mean;
+    double m2;
+    double min;
+    double max;
+} RunningMoments;
+
+/*
+ * Mergeable quantile sketch: log-spaced buckets with relative accuracy
+ * SKETCH_RELATIVE_ACCURACY for |v| >= SKETCH_MIN_MAGNITUDE, one bucket array
+ * per sign. Only the touched [lo, hi] range is reset, merged or written.
+ */
+typedef struct {
+    int lo;
+    int hi;
+    uint64_t counts[SKETCH_BUCKETS];
+} SketchSide;
+
+typedef struct {
+    uint64_t zero_count;
+    SketchSide negative;
+    SketchSide positive;
+} QuantileSketch;
+
+// The TAIL_BUFFER_SIZE smallest values seen, kept as a max-heap
+typedef struct {
+    int size;
+    double values[TAIL_BUFFER_SIZE];
+} TailBuffer;
+
+/*
+ * Path-dependent risk of the cumulative level, updated as each path is
+ * compounded: maximum drawdown from the running peak (the start counts as
+ * a peak), years ending below the starting level, and per barrier the
+ * number of paths that first end a year at or below it, by year.
+ */
+typedef struct {
+    BarrierSet barriers;
+    RunningMoments drawdown;            // percent of the peak
+    QuantileSketch drawdown_sketch;
+    RunningMoments years_below;
+    uint64_t ever_below;
+    uint64_t first_passage[MAX_BARRIERS][MAX_YEARS];
+} PathRisk;
+
+// Everything a report needs, in a form that can be merged across path ranges
+typedef struct {
+    RunningMoments moments;
+    uint64_t prob_positive;
+    uint64_t prob_above_10;
+    uint64_t prob_above_20;
+    uint64_t prob_below_neg10;
+    TailBuffer low_tail;
+    TailBuffer high_tail;    // negated values, so the heap keeps the largest
+    QuantileSketch sketch;
+    int num_years;
+    RunningMoments year_moments[MAX_YEARS];
+    double year_comoments[MAX_YEARS];   // co-moment of years y-1 and y (entry 0 unused)
+    QuantileSketch *year_sketches;   // NULL unless per-year metrics are kept
+    PathRisk *path_risk;             // NULL unless path metrics are kept
+    QuantileSketch *fan_sketches;    // cumulative growth at each year end, NULL without the fan chart
+    RunningMoments batches[BATCH_STATS];   // statistics of every full chunk, for standard errors
+} PathAccumulator;
+
+// Probability analysis counts shared by the exact and streaming engines
+typedef struct {
+    uint64_t count;
+    uint64_t positive;
+    uint64_t above_10;
+    uint64_t above_20;
+    uint64_t below_neg10;
+} ProbabilityCounts;
+
+/*
+ * Partial-result file: mergeable state only, never raw paths.
+ *
+ *   [PartialFileHeader]
+ *   per ticker: [PartialTickerHeader][serialized PathAccumulator]
+ *
+ * Sketches are written as their touched bucket range only.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_tickers;
+    uint64_t seed;
+    uint64_t total_simulations;
+    uint32_t shard_index;
+    uint32_t shard_count;
+    double volatility_factor;
+    uint32_t with_years;
+    uint32_t with_path_risk;
+    uint32_t with_fan;
+    uint32_t reserved;
+    BarrierSet barriers;
+    uint64_t model_fingerprint;   // model_fingerprint() of the run
+} PartialFileHeader;
+
+typedef struct {
+    StockData stock;
+    double forecast_mean;
+    double forecast_std;
+    uint64_t path_begin;
+    uint64_t path_end;
+} PartialTickerHeader;
+
+/*
+ * Checkpoint file: tickers before ticker_index are already in the report
+ * (which is output_offset bytes long); the current ticker's accumulator
+ * covers paths [0, next_path) and follows the header when next_path > 0.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t ticker_index;
+    uint64_t seed;
+    uint64_t total_simulations;
+    double volatility_factor;
+    uint32_t metrics;
+    uint32_t with_years;
+    uint64_t output_offset;
+    uint64_t next_path;
+    char ticker[MAX_TICKER_LENGTH];
+    char reserved[4];
+    BarrierSet barriers;
+    uint64_t model_fingerprint;       // model_fingerprint() of the run
+    uint64_t forecasts_fingerprint;   // every ticker's stock_fingerprint(), in input order
+} CheckpointHeader;
+
 void print_usage(const char* program_name) {
     printf("Usage: %s [OPTIONS]\n", program_name);
     printf("Monte Carlo stock metrics simulation tool\n\n");
     printf("Options:\n");
-    printf("  -i, --input FILE        Input file with stock forecasts (default: Forecasts.txt)\n");
+    printf("  -i, --input FILE        Input file with stock forecasts (default: Forecasts.txt); a\n");
+    printf("                          \"SCENARIO: NAME WEIGHT\" line makes a section one weighted\n");
+    printf("                          scenario of its ticker, blended in a single run\n");
     printf("  -o, --output FILE       Output file for results (default: Monte_Carlo_Results.txt)\n");
     printf("  -s, --simulations NUM   Number of simulations to run (default: 10000)\n");
     printf("  -v, --volatility FACTOR Volatility factor (default: 1.5)\n");
@@ -64,7 +547,87 @@ void print_usage(const char* program_name) {
     printf("  -c, --csv               Export results to CSV for external plotting\n");
     printf("  -t, --threads NUM       Number of threads to use (default: available cores)\n");
     printf("  -V, --verbose           Display detailed progress information\n");
+    printf("  -S, --scratch FILE      Out-of-core mode: spill simulated paths to a memory-mapped\n");
+    printf("                          scratch file (kept afterwards as a binary path export)\n");
+    printf("      --sort ALGORITHM    Sort engine: auto, radix, sample or qsort (default: auto)\n");
+    printf("      --metrics LIST      Comma-separated outputs to compute (default: all). Names:\n");
+    printf("                          mean, std, min, max, p5, p25, p50, p75, p95, var95, var99,\n");
+    printf("                          probabilities, histogram, years, tail, path, fan; groups:\n");
+    printf("                          summary, percentiles, risk, all\n");
+    printf("      --barriers LIST     Cumulative losses in percent for the path metrics' first-passage\n");
+    printf("                          table (default: %s)\n", DEFAULT_BARRIERS);
+    printf("      --fan-svg           Also draw the fan chart of cumulative growth percentiles by year\n");
+    printf("                          to TICKER_fan_chart.svg (implies the fan metric)\n");
+    printf("      --seed NUM          Random seed; runs with the same seed reproduce the same paths\n");
+    printf("      --shard I/N         Simulate only the I-th of N disjoint path ranges (0-based) and\n");
+    printf("                          write a partial-result file instead of a report\n");
+    printf("      --partial FILE      Partial-result file for --shard (default: shard_I_of_N.part)\n");
+    printf("      --checkpoint FILE   Stream statistics and checkpoint progress to FILE periodically\n");
+    printf("      --checkpoint-interval SECONDS\n");
+    printf("                          Minimum time between checkpoints (default: 300, 0 = every chunk round)\n");
+    printf("      --resume            Continue an interrupted --checkpoint run from its checkpoint\n");
+    printf("      --state FILE        Stream statistics and save the mergeable run state to FILE\n");
+    printf("      --extend-to NUM     Grow the run saved in --state to NUM paths, simulating only the\n");
+    printf("                          new paths; estimates are printed at every doubling\n");
+    printf("      --time-budget SECONDS\n");
+    printf("                          Spend about SECONDS in total: pilot every ticker, then allocate\n");
+    printf("                          paths to minimise the worst relative error of mean/VaR\n");
+    printf("      --analytic          Closed-form lognormal approximation instead of simulation;\n");
+    printf("                          tickers it cannot answer accurately are still simulated\n");
+    printf("      --analytic-tolerance PP\n");
+    printf("                          Largest estimated quantile error, in percentage points, accepted\n");
+    printf("                          from --analytic before simulating (default: 0.5)\n");
+    printf("      --importance[=LEVEL]\n");
+    printf("                          Importance-sample the loss tail around probability LEVEL\n");
+    printf("                          (default: 0.001) and report weighted deep-tail VaR and loss\n");
+    printf("                          probabilities with confidence intervals\n");
+    printf("      --sensitivities     Add the sensitivity of mean, median and VaR to each year's\n");
+    printf("                          growth rate and to the standard deviation (one extra pass)\n");
+    printf("      --std-errors[=B]    Add batch-means standard errors to every estimated statistic,\n");
+    printf("                          from B batches of paths (default: %d); streamed runs use\n", DEFAULT_ERROR_BATCHES);
+    printf("                          their full %d-path chunks as batches and need at least two\n", STREAM_CHUNK_PATHS);
+    printf("      --factors FILE      Factor model: correlate tickers through shared factor draws\n");
+    printf("                          with per-ticker loadings from FILE (lines: TICKER b1 b2 ...,\n");
+    printf("                          optional FACTORS name1 name2 ...) and add an equal-weight\n");
+    printf("                          portfolio report\n");
+    printf("      --t-copula DOF      Student-t copula with DOF degrees of freedom across tickers:\n");
+    printf("                          marginals stay Gaussian but joint crashes become more likely;\n");
+    printf("                          combines with --factors for the correlation structure\n");
+    printf("      --distribution SPEC Per-year shock distribution, rescaled to the forecast mean and\n");
+    printf("                          deviation: normal (default), t:DF, skew-normal:ALPHA or\n");
+    printf("                          nig:ALPHA,BETA\n");
+    printf("      --garch ALPHA,BETA  GARCH(1,1) volatility: each path's variance reacts to its last\n");
+    printf("                          deviation (ALPHA) and persists (BETA) around the adjusted\n");
+    printf("                          standard deviation; alpha + beta < 1\n");
+    printf("      --history FILE      Stationary block bootstrap of historical residuals instead of\n");
+    printf("                          random shocks for tickers in FILE (CSV: TICKER,[YEAR,]VALUE\n");
+    printf("                          in time order), scaled to the adjusted standard deviation\n");
+    printf("      --block-length L    Mean bootstrap block length in years (default: %.0f)\n", DEFAULT_BLOCK_LENGTH);
+    printf("      --ar PHI            AR(1) persistence of each path's yearly deviations (-1 < PHI\n");
+    printf("                          < 1); every year keeps the adjusted standard deviation\n");
+    printf("      --jumps L,MEAN,STD  Merton jumps: Poisson(L) jumps per year of MEAN +/- STD growth\n");
+    printf("                          points, compensated so the mean forecast is unchanged\n");
+    printf("      --regimes FILE      Markov regime switching shared by all tickers (lines: NAME\n");
+    printf("                          SHIFT SCALE P1 P2 ...: growth shift in points, deviation\n");
+    printf("                          multiplier, transition probabilities); adds regime occupancy\n");
+    printf("      --regime-start NAME First-year regime (default: the chain's stationary distribution)\n");
+    printf("      --model-file FILE   Per-ticker model settings (lines: TICKER dist=SPEC\n");
+    printf("                          garch=ALPHA,BETA jumps=L,MEAN,STD ar=PHI; ticker * sets\n");
+    printf("                          the default for unlisted tickers)\n");
+    printf("      --stress FILE       Stress table instead of full reports: every scenario in FILE\n");
+    printf("                          runs on common random numbers (lines: NAME TARGET YEARS SHOCK\n");
+    printf("                          with TARGET a ticker pattern or @SECTOR, YEARS all, N or N-M\n");
+    printf("                          (forecast years from 1, or calendar years),\n");
+    printf("                          SHOCK +/-POINTS or xFACTOR; SECTOR NAME TICKER... lines)\n");
+    printf("      --reverse-stress LIMIT\n");
+    printf("                          Solve per ticker for the smallest uniform and single-year\n");
+    printf("                          growth downgrades that breach LIMIT: var95:L or var99:L (VaR\n");
+    printf("                          of L%% loss) or loss:X,P (P%% chance of losing more than X%%)\n");
     printf("  -?, --help              Display this help message\n");
+    printf("\n");
+    printf("Merging shards:\n");
+    printf("  %s merge [-o FILE] [--metrics LIST] [-w NUM] [-h NUM] PARTIAL...\n", program_name);
+    printf("  Combines partial-result files from --shard runs into the final report.\n");
 }
 
 int compare_doubles(const void *a, const void *b) {
@@ -73,395 +636,6343 @@ int compare_doubles(const void *a, const void *b) {
     return (da > db) - (da < db);
 }
 
-double generate_normal(double mean, double std_dev) {
-    static int has_spare = 0;
-    static double spare;
-    
-    if (has_spare) {
-        has_spare = 0;
-        return spare * std_dev + mean;
+static inline int thread_index(void) {
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+static inline int thread_count(void) {
+#ifdef _OPENMP
+    return omp_get_num_threads();
+#else
+    return 1;
+#endif
+}
+
+/*
+ * Map IEEE-754 doubles onto unsigned integers with the same ordering:
+ * negative values have every bit flipped, non-negative values only the sign.
+ */
+static inline uint64_t double_to_sort_key(uint64_t bits) {
+    uint64_t mask = (uint64_t)(-(int64_t)(bits >> 63)) | 0x8000000000000000ULL;
+    return bits ^ mask;
+}
+
+static inline uint64_t sort_key_to_double(uint64_t key) {
+    uint64_t mask = ((key >> 63) - 1) | 0x8000000000000000ULL;
+    return key ^ mask;
+}
+
+static void sort_keys_insertion(sort_key_t *keys, size_t n) {
+    for (size_t i = 1; i < n; i++) {
+        uint64_t key = keys[i];
+        size_t j = i;
+        while (j > 0 && keys[j - 1] > key) {
+            keys[j] = keys[j - 1];
+            j--;
+        }
+        keys[j] = key;
     }
-    
-    has_spare = 1;
-    double u, v, mag;
-    do {
-        u = 2.0 * ((double)rand() / RAND_MAX) - 1.0;
-        v = 2.0 * ((double)rand() / RAND_MAX) - 1.0;
-        mag = u * u + v * v;
-    } while (mag >= 1.0 || mag == 0.0);
-    
-    mag = sqrt(-2.0 * log(mag) / mag);
-    spare = v * mag;
-    return mean + std_dev * u * mag;
 }
 
-Statistics calculate_statistics(double *values, int n) {
-    Statistics stats = {0};
-    
-    if (n <= 0) {
-        fprintf(stderr, "Error: Cannot calculate statistics on empty dataset\n");
-        return stats;
+// Quicksort for small key ranges; only used below SORT_SERIAL_THRESHOLD
+static void sort_keys_quick(sort_key_t *keys, size_t n) {
+    while (n > SORT_INSERTION_THRESHOLD) {
+        uint64_t a = keys[0], b = keys[n / 2], c = keys[n - 1];
+        uint64_t pivot = a < b ? (b < c ? b : (a < c ? c : a)) : (a < c ? a : (b < c ? c : b));
+        
+        size_t i = 0, j = n - 1;
+        for (;;) {
+            while (keys[i] < pivot) i++;
+            while (keys[j] > pivot) j--;
+            if (i >= j) break;
+            uint64_t tmp = keys[i];
+            keys[i] = keys[j];
+            keys[j] = tmp;
+            i++;
+            j--;
+        }
+        
+        // Recurse into the smaller half to bound stack depth
+        size_t left = j + 1;
+        if (left < n - left) {
+            sort_keys_quick(keys, left);
+            keys += left;
+            n -= left;
+        } else {
+            sort_keys_quick(keys + left, n - left);
+            n = left;
+        }
     }
-    
-    // Sort values for percentile calculations
-    qsort(values, n, sizeof(double), compare_doubles);
-    
-    // Calculate mean
-    double sum = 0.0;
-    for (int i = 0; i < n; i++) {
-        sum += values[i];
+    sort_keys_insertion(keys, n);
+}
+
+/*
+ * Parallel LSD radix sort over RADIX_BITS-wide digits. Digit histograms are
+ * permutation invariant, so they are computed once up front and any pass in
+ * which every key shares the same digit is skipped. Returns the buffer that
+ * holds the sorted keys (keys or aux).
+ */
+static sort_key_t *radix_sort_keys(sort_key_t *keys, sort_key_t *aux, size_t n, int num_threads) {
+    size_t *global_counts = calloc((size_t)RADIX_PASSES * RADIX_BUCKETS, sizeof(size_t));
+    size_t *thread_counts = malloc((size_t)num_threads * RADIX_BUCKETS * sizeof(size_t));
+    if (!global_counts || !thread_counts) {
+        free(global_counts);
+        free(thread_counts);
+        return NULL;
     }
-    stats.mean = sum / n;
     
-    // Calculate standard deviation
-    double variance = 0.0;
-    for (int i = 0; i < n; i++) {
-        double diff = values[i] - stats.mean;
-        variance += diff * diff;  // Avoid pow() for better performance
+    #pragma omp parallel num_threads(num_threads) if(num_threads > 1)
+    {
+        size_t *local = calloc((size_t)RADIX_PASSES * RADIX_BUCKETS, sizeof(size_t));
+        if (local) {
+            #pragma omp for schedule(static)
+            for (size_t i = 0; i < n; i++) {
+                uint64_t key = keys[i];
+                for (int pass = 0; pass < RADIX_PASSES; pass++) {
+                    local[pass * RADIX_BUCKETS + ((key >> (pass * RADIX_BITS)) & (RADIX_BUCKETS - 1))]++;
+                }
+            }
+            #pragma omp critical
+            for (int i = 0; i < RADIX_PASSES * RADIX_BUCKETS; i++) {
+                global_counts[i] += local[i];
+            }
+            free(local);
+        } else {
+            // Out of memory for the local table: count under the lock instead
+            #pragma omp for schedule(static)
+            for (size_t i = 0; i < n; i++) {
+                uint64_t key = keys[i];
+                for (int pass = 0; pass < RADIX_PASSES; pass++) {
+                    #pragma omp atomic
+                    global_counts[pass * RADIX_BUCKETS + ((key >> (pass * RADIX_BITS)) & (RADIX_BUCKETS - 1))]++;
+                }
+            }
+        }
     }
-    stats.std_dev = sqrt(variance / (n - 1));
-    
-    // Min and Max
-    stats.min = values[0];
-    stats.max = values[n - 1];
-    
-    // Percentiles
-    stats.percentile_5 = values[(int)(0.05 * n)];
-    stats.percentile_25 = values[(int)(0.25 * n)];
-    stats.percentile_50 = values[(int)(0.50 * n)];
-    stats.percentile_75 = values[(int)(0.75 * n)];
-    stats.percentile_95 = values[(int)(0.95 * n)];
     
-    // Value at Risk (VaR) - loss percentiles
-    stats.var_95 = -values[(int)(0.05 * n)];
-    stats.var_99 = -values[(int)(0.01 * n)];
+    sort_key_t *src = keys, *dst = aux;
+    for (int pass = 0; pass < RADIX_PASSES; pass++) {
+        int shift = pass * RADIX_BITS;
+        const size_t *counts = global_counts + (size_t)pass * RADIX_BUCKETS;
+        if (counts[(src[0] >> shift) & (RADIX_BUCKETS - 1)] == n) {
+            continue;
+        }
+        
+        #pragma omp parallel num_threads(num_threads) if(num_threads > 1)
+        {
+            int t = thread_index();
+            int nt = thread_count();
+            size_t lo = n * t / nt, hi = n * (t + 1) / nt;
+            size_t *offsets = thread_counts + (size_t)t * RADIX_BUCKETS;
+            
+            memset(offsets, 0, RADIX_BUCKETS * sizeof(size_t));
+            for (size_t i = lo; i < hi; i++) {
+                offsets[(src[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+            }
+            
+            #pragma omp barrier
+            #pragma omp single
+            {
+                // Bucket-major, thread-minor prefix sum keeps the scatter stable
+                size_t running = 0;
+                for (int b = 0; b < RADIX_BUCKETS; b++) {
+                    for (int u = 0; u < nt; u++) {
+                        size_t count = thread_counts[(size_t)u * RADIX_BUCKETS + b];
+                        thread_counts[(size_t)u * RADIX_BUCKETS + b] = running;
+                        running += count;
+                    }
+                }
+            }
+            
+            for (size_t i = lo; i < hi; i++) {
+                uint64_t key = src[i];
+                dst[offsets[(key >> shift) & (RADIX_BUCKETS - 1)]++] = key;
+            }
+        }
+        
+        sort_key_t *tmp = src;
+        src = dst;
+        dst = tmp;
+    }
     
-    return stats;
+    free(global_counts);
+    free(thread_counts);
+    return src;
 }
 
-void create_histogram(double *values, int n, FILE *output, int width, int height) {
-    if (n <= 0) {
-        fprintf(stderr, "Error: Cannot create histogram from empty dataset\n");
+static void sort_keys_serial(sort_key_t *keys, sort_key_t *aux, size_t n) {
+    if (n < SORT_SERIAL_THRESHOLD) {
+        sort_keys_quick(keys, n);
         return;
     }
     
-    double min_val = values[0];
-    double max_val = values[n - 1];
-    double range = max_val - min_val;
+    sort_key_t *sorted = radix_sort_keys(keys, aux, n, 1);
+    if (!sorted) {
+        sort_keys_quick(keys, n);
+    } else if (sorted != keys) {
+        memcpy(keys, sorted, n * sizeof(uint64_t));
+    }
+}
+
+// Number of splitters <= key, i.e. the destination bucket
+static inline int sample_bucket(const uint64_t *splitters, int num_splitters, uint64_t key) {
+    const uint64_t *base = splitters;
+    int len = num_splitters;
+    while (len > 0) {
+        int half = len / 2;
+        if (base[half] <= key) {
+            base += half + 1;
+            len -= half + 1;
+        } else {
+            len = half;
+        }
+    }
+    return (int)(base - splitters);
+}
+
+/*
+ * Parallel samplesort: oversampled splitters partition the keys into
+ * SAMPLESORT_BUCKETS_PER_THREAD buckets per thread, which are scattered into
+ * aux and then sorted independently. Sorted output ends up back in keys.
+ */
+static int sample_sort_keys(sort_key_t *keys, sort_key_t *aux, size_t n, int num_threads) {
+    int num_buckets = num_threads * SAMPLESORT_BUCKETS_PER_THREAD;
+    int sample_size = num_buckets * SAMPLESORT_OVERSAMPLE;
+    uint64_t *splitters = malloc((size_t)sample_size * sizeof(uint64_t));
+    size_t *thread_counts = calloc((size_t)num_threads * num_buckets, sizeof(size_t));
+    size_t *bucket_start = malloc(((size_t)num_buckets + 1) * sizeof(size_t));
+    if (!splitters || !thread_counts || !bucket_start) {
+        free(splitters);
+        free(thread_counts);
+        free(bucket_start);
+        return 0;
+    }
     
-    if (range <= 0) {
-        fprintf(stderr, "Warning: Zero range in histogram data, using default range\n");
-        range = 1.0;  // Default to prevent division by zero
+    for (int i = 0; i < sample_size; i++) {
+        splitters[i] = keys[(size_t)((double)(i + 0.5) * n / sample_size)];
+    }
+    sort_keys_quick((sort_key_t *)splitters, sample_size);
+    for (int b = 0; b < num_buckets - 1; b++) {
+        splitters[b] = splitters[(b + 1) * SAMPLESORT_OVERSAMPLE - 1];
     }
     
-    int *bins = calloc(width, sizeof(int));
-    if (!bins) {
-        fprintf(stderr, "Error: Memory allocation failed for histogram bins\n");
+    #pragma omp parallel num_threads(num_threads) if(num_threads > 1)
+    {
+        int t = thread_index();
+        int nt = thread_count();
+        size_t lo = n * t / nt, hi = n * (t + 1) / nt;
+        size_t *offsets = thread_counts + (size_t)t * num_buckets;
+        
+        for (size_t i = lo; i < hi; i++) {
+            uint64_t key = keys[i];
+            int bucket = sample_bucket(splitters, num_buckets - 1, key);
+            offsets[bucket]++;
+        }
+        
+        #pragma omp barrier
+        #pragma omp single
+        {
+            size_t running = 0;
+            for (int b = 0; b < num_buckets; b++) {
+                bucket_start[b] = running;
+                for (int u = 0; u < nt; u++) {
+                    size_t count = thread_counts[(size_t)u * num_buckets + b];
+                    thread_counts[(size_t)u * num_buckets + b] = running;
+                    running += count;
+                }
+            }
+            bucket_start[num_buckets] = running;
+        }
+        
+        for (size_t i = lo; i < hi; i++) {
+            uint64_t key = keys[i];
+            int bucket = sample_bucket(splitters, num_buckets - 1, key);
+            aux[offsets[bucket]++] = key;
+        }
+        
+        #pragma omp barrier
+        
+        // Buckets vary in size; hand them out dynamically. The matching
+        // region of keys is free and serves as the scratch buffer.
+        #pragma omp for schedule(dynamic, 1)
+        for (int b = 0; b < num_buckets; b++) {
+            size_t start = bucket_start[b];
+            size_t count = bucket_start[b + 1] - start;
+            sort_keys_serial(aux + start, keys + start, count);
+            memcpy(keys + start, aux + start, count * sizeof(uint64_t));
+        }
+    }
+    
+    free(splitters);
+    free(thread_counts);
+    free(bucket_start);
+    return 1;
+}
+
+/*
+ * Sort doubles ascending. SORT_AUTO uses a serial key quicksort for small
+ * arrays, samplesort for mid-sized arrays when threads are available and the
+ * parallel radix sort beyond RADIX_SORT_MIN_ELEMENTS. Falls back to qsort if
+ * the auxiliary buffer cannot be allocated.
+ */
+void sort_doubles(double *values, size_t n, SortAlgorithm algorithm, int num_threads) {
+    if (n < 2) {
         return;
     }
     
-    // Fill bins
-    for (int i = 0; i < n; i++) {
-        int bin = (int)((values[i] - min_val) / range * (width - 1));
-        if (bin >= 0 && bin < width) {
-            bins[bin]++;
-        }
+    if (num_threads < 1) {
+        num_threads = 1;
     }
     
-    // Find max frequency for scaling
-    int max_freq = 0;
-    for (int i = 0; i < width; i++) {
-        if (bins[i] > max_freq) {
-            max_freq = bins[i];
+    if (algorithm == SORT_AUTO) {
+        if (n < SORT_SERIAL_THRESHOLD) {
+            algorithm = SORT_QSORT;
+        } else if (n < RADIX_SORT_MIN_ELEMENTS) {
+            algorithm = num_threads > 1 ? SORT_SAMPLE : SORT_RADIX;
+        } else {
+            algorithm = SORT_RADIX;
         }
     }
     
-    fprintf(output, "\nDISTRIBUTION HISTOGRAM:\n");
-    fprintf(output, "========================\n");
+    sort_key_t *keys = (sort_key_t *)values;
     
-    // Print histogram
-    for (int row = height - 1; row >= 0; row--) {
-        fprintf(output, "%3d%% |", (row * 100) / height);
-        for (int col = 0; col < width; col++) {
-            int bar_height = max_freq > 0 ? (bins[col] * height) / max_freq : 0;
-            if (bar_height > row) {
-                fprintf(output, "*");
+    if (algorithm == SORT_QSORT && n >= SORT_SERIAL_THRESHOLD) {
+        qsort(values, n, sizeof(double), compare_doubles);
+        return;
+    }
+    
+    #pragma omp parallel for num_threads(num_threads) if(num_threads > 1 && n >= RADIX_SORT_MIN_ELEMENTS)
+    for (size_t i = 0; i < n; i++) {
+        keys[i] = double_to_sort_key(keys[i]);
+    }
+    
+    if (algorithm == SORT_QSORT) {
+        sort_keys_quick(keys, n);
+    } else {
+        sort_key_t *aux = malloc(n * sizeof(uint64_t));
+        int sorted = 0;
+        if (aux) {
+            if (algorithm == SORT_SAMPLE) {
+                sorted = sample_sort_keys(keys, aux, n, num_threads);
             } else {
-                fprintf(output, " ");
+                sort_key_t *result = radix_sort_keys(keys, aux, n, num_threads);
+                if (result && result != keys) {
+                    memcpy(keys, result, n * sizeof(uint64_t));
+                }
+                sorted = result != NULL;
             }
+            free(aux);
+        }
+        
+        if (!sorted) {
+            for (size_t i = 0; i < n; i++) {
+                keys[i] = sort_key_to_double(keys[i]);
+            }
+            qsort(values, n, sizeof(double), compare_doubles);
+            return;
         }
-        fprintf(output, "|\n");
     }
     
-    // Print x-axis
-    fprintf(output, "     +");
-    for (int i = 0; i < width; i++) {
-        fprintf(output, "-");
+    #pragma omp parallel for num_threads(num_threads) if(num_threads > 1 && n >= RADIX_SORT_MIN_ELEMENTS)
+    for (size_t i = 0; i < n; i++) {
+        keys[i] = sort_key_to_double(keys[i]);
     }
-    fprintf(output, "+\n");
-    fprintf(output, "    %.1f%%", min_val);
-    for (int i = 0; i < width - 10; i++) {
-        fprintf(output, " ");
+}
+
+/*
+ * Counter-based random numbers (Philox4x32-10). A path's draws are a pure
+ * function of (seed, ticker, path index, draw index), so any range of paths
+ * can be simulated independently -- on another thread, shard or resume --
+ * and still reproduce exactly the paths of a single uninterrupted run.
+ */
+static inline uint32_t mulhilo32(uint32_t a, uint32_t b, uint32_t *hi) {
+    uint64_t product = (uint64_t)a * b;
+    *hi = (uint32_t)(product >> 32);
+    return (uint32_t)product;
+}
+
+static inline void philox4x32(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4]) {
+    uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+    uint32_t k0 = key[0], k1 = key[1];
+    for (int round = 0; round < 10; round++) {
+        uint32_t hi0, hi1;
+        uint32_t lo0 = mulhilo32(0xD2511F53u, c0, &hi0);
+        uint32_t lo1 = mulhilo32(0xCD9E8D57u, c2, &hi1);
+        c0 = hi1 ^ c1 ^ k0;
+        c1 = lo1;
+        c2 = hi0 ^ c3 ^ k1;
+        c3 = lo0;
+        k0 += 0x9E3779B9u;
+        k1 += 0xBB67AE85u;
     }
-    fprintf(output, "%.1f%%\n\n", max_val);
-    
-    free(bins);
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
 }
 
-void export_csv(const char *ticker, double *values, int n, const SimulationConfig *config) {
-    char csv_filename[MAX_LINE_LENGTH + 50];
-    snprintf(csv_filename, sizeof(csv_filename), "%s_%s.csv", ticker, "simulation_results");
-    
-    FILE *csv_file = fopen(csv_filename, "w");
-    if (!csv_file) {
-        fprintf(stderr, "Error: Could not create CSV file %s\n", csv_filename);
-        return;
+// Per-ticker stream key derived from the run seed and the ticker symbol (FNV-1a)
+void rng_stream_key(uint64_t seed, const char *ticker, uint32_t key[2]) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (const char *c = ticker; *c; c++) {
+        hash ^= (unsigned char)*c;
+        hash *= 0x100000001B3ULL;
     }
-    
-    fprintf(csv_file, "Simulation,FinalValue\n");
-    for (int i = 0; i < n; i++) {
-        fprintf(csv_file, "%d,%.4f\n", i + 1, values[i]);
+    hash ^= seed + 0x9E3779B97F4A7C15ULL + (hash << 6) + (hash >> 2);
+    key[0] = (uint32_t)hash;
+    key[1] = (uint32_t)(hash >> 32);
+}
+
+/*
+ * Fingerprints (FNV-1a) that saved runs record so paths from different
+ * inputs are never combined. Values are hashed field by field, never as
+ * whole structs, so padding bytes do not leak in.
+ */
+static void fingerprint_bytes(uint64_t *hash, const void *data, size_t size) {
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        *hash ^= bytes[i];
+        *hash *= 0x100000001B3ULL;
     }
-    
-    fclose(csv_file);
-    printf("CSV data exported to %s\n", csv_filename);
 }
 
-int parse_stock_data(const char *filename, StockData **stocks_ptr, int max_stocks) {
-    FILE *file = fopen(filename, "r");
-    if (!file) {
-        fprintf(stderr, "Error: Could not open file %s\n", filename);
-        return 0;
+static void fingerprint_double(uint64_t *hash, double value) {
+    fingerprint_bytes(hash, &value, sizeof(value));
+}
+
+static void fingerprint_int(uint64_t *hash, int value) {
+    fingerprint_bytes(hash, &value, sizeof(value));
+}
+
+static void fingerprint_string(uint64_t *hash, const char *text) {
+    fingerprint_bytes(hash, text, strlen(text) + 1);
+}
+
+// One ticker's forecasts: years, growth rates and any scenario mixture
+uint64_t stock_fingerprint(const StockData *stock) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    fingerprint_string(&hash, stock->ticker);
+    fingerprint_int(&hash, stock->num_years);
+    for (int y = 0; y < stock->num_years; y++) {
+        fingerprint_int(&hash, stock->years[y]);
+        fingerprint_double(&hash, stock->growth_rates[y]);
+    }
+    fingerprint_int(&hash, stock->num_scenarios);
+    for (int k = 0; k < stock->num_scenarios; k++) {
+        fingerprint_string(&hash, stock->scenario_names[k]);
+        fingerprint_double(&hash, stock->scenario_weights[k]);
+        for (int y = 0; y < stock->num_years; y++) {
+            fingerprint_double(&hash, stock->scenario_growth[k][y]);
+        }
     }
+    return hash;
+}
+
+static void fingerprint_distribution(uint64_t *hash, const ShockDistribution *distribution) {
+    fingerprint_int(hash, distribution->kind);
+    fingerprint_double(hash, distribution->shape);
+    fingerprint_double(hash, distribution->skew);
+}
+
+/*
+ * Every path-model setting besides the seed and volatility factor: shock
+ * distribution, GARCH, AR(1), jumps, the model file, regimes, factor
+ * loadings, copula and bootstrap history, hashed by content.
+ */
+uint64_t model_fingerprint(const SimulationConfig *config) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    fingerprint_distribution(&hash, &config->distribution);
+    fingerprint_double(&hash, config->garch.alpha);
+    fingerprint_double(&hash, config->garch.beta);
+    fingerprint_double(&hash, config->persistence);
+    fingerprint_double(&hash, config->jumps.intensity);
+    fingerprint_double(&hash, config->jumps.mean);
+    fingerprint_double(&hash, config->jumps.std_dev);
+    fingerprint_double(&hash, config->copula_dof);
+    fingerprint_double(&hash, config->block_length);
     
-    StockData *stocks = calloc(max_stocks, sizeof(StockData));
-    if (!stocks) {
-        fprintf(stderr, "Error: Memory allocation failed for stock data\n");
-        fclose(file);
-        return 0;
+    const ModelFile *models = config->models;
+    fingerprint_int(&hash, models ? models->num_tickers : -1);
+    for (int i = 0; models && i < models->num_tickers; i++) {
+        const TickerModel *model = &models->tickers[i];
+        fingerprint_string(&hash, model->ticker);
+        fingerprint_int(&hash, model->has_distribution);
+        fingerprint_distribution(&hash, &model->distribution);
+        fingerprint_int(&hash, model->has_garch);
+        fingerprint_double(&hash, model->garch.alpha);
+        fingerprint_double(&hash, model->garch.beta);
+        fingerprint_int(&hash, model->has_jumps);
+        fingerprint_double(&hash, model->jumps.intensity);
+        fingerprint_double(&hash, model->jumps.mean);
+        fingerprint_double(&hash, model->jumps.std_dev);
+        fingerprint_int(&hash, model->has_persistence);
+        fingerprint_double(&hash, model->persistence);
     }
     
+    const RegimeModel *regimes = config->regimes;
+    fingerprint_int(&hash, regimes ? regimes->num_regimes : -1);
+    for (int r = 0; regimes && r < regimes->num_regimes; r++) {
+        fingerprint_double(&hash, regimes->shift[r]);
+        fingerprint_double(&hash, regimes->scale[r]);
+        fingerprint_double(&hash, regimes->initial[r]);
+        for (int q = 0; q < regimes->num_regimes; q++) {
+            fingerprint_double(&hash, regimes->transition[r][q]);
+        }
+    }
+    
+    const FactorLoadings *factors = config->factors;
+    fingerprint_int(&hash, factors ? factors->num_factors : -1);
+    for (int i = 0; factors && i < factors->num_tickers; i++) {
+        fingerprint_string(&hash, factors->tickers[i].ticker);
+        for (int f = 0; f < factors->num_factors; f++) {
+            fingerprint_double(&hash, factors->tickers[i].loadings[f]);
+        }
+    }
+    
+    const HistoryFile *history = config->history;
+    fingerprint_int(&hash, history ? history->num_series : -1);
+    for (int i = 0; history && i < history->num_series; i++) {
+        const HistorySeries *series = &history->series[i];
+        fingerprint_string(&hash, series->ticker);
+        fingerprint_int(&hash, series->count);
+        fingerprint_bytes(&hash, history->residuals + series->offset, (size_t)series->count * sizeof(double));
+    }
+    return hash;
+}
+
+typedef struct {
+    uint32_t key[2];
+    uint64_t path;
+    uint32_t block;
+    int available;
+    double uniforms[2];
+    int has_spare;
+    double spare;
+} PathRng;
+
+static inline void rng_init(PathRng *rng, const uint32_t key[2], uint64_t path) {
+    rng->key[0] = key[0];
+    rng->key[1] = key[1];
+    rng->path = path;
+    rng->block = 0;
+    rng->available = 0;
+    rng->has_spare = 0;
+}
+
+// Uniform on the open interval (0, 1) with 53 random bits
+static inline double rng_uniform(PathRng *rng) {
+    if (rng->available == 0) {
+        uint32_t counter[4] = { (uint32_t)rng->path, (uint32_t)(rng->path >> 32), rng->block++, 0 };
+        uint32_t out[4];
+        philox4x32(counter, rng->key, out);
+        for (int i = 0; i < 2; i++) {
+            uint64_t bits = ((uint64_t)out[2 * i] << 21) ^ (out[2 * i + 1] >> 11);
+            rng->uniforms[i] = ((double)bits + 0.5) * (1.0 / 9007199254740992.0);
+        }
+        rng->available = 2;
+    }
+    return rng->uniforms[2 - rng->available--];
+}
+
+double generate_normal(PathRng *rng, double mean, double std_dev) {
+    if (rng->has_spare) {
+        rng->has_spare = 0;
+        return rng->spare * std_dev + mean;
+    }
+    
+    // Box-Muller on counter-based uniforms: no rejection, so every path
+    // consumes the same number of draws per year
+    double radius = sqrt(-2.0 * log(rng_uniform(rng)));
+    double angle = 2.0 * M_PI * rng_uniform(rng);
+    rng->spare = radius * sin(angle);
+    rng->has_spare = 1;
+    return mean + std_dev * radius * cos(angle);
+}
+
+double normal_cdf(double x) {
+    return 0.5 * erfc(-x / M_SQRT2);
+}
+
+// Inverse standard normal CDF: Acklam's rational approximation plus one Halley step
+double normal_quantile(double p) {
+    static const double a[] = { -3.969683028665376e+01, 2.209460984245205e+02, -2.759285104469687e+02,
+                                1.383577518672690e+02, -3.066479806614716e+01, 2.506628277459239e+00 };
+    static const double b[] = { -5.447609879822406e+01, 1.615858368580409e+02, -1.556989798598866e+02,
+                                6.680131188771972e+01, -1.328068155288572e+01 };
+    static const double c[] = { -7.784894002430293e-03, -3.223964580411365e-01, -2.400758277161838e+00,
+                                -2.549671010114219e+00, 4.374664141464968e+00, 2.938163982698783e+00 };
+    static const double d[] = { 7.784695709041462e-03, 3.224671290700398e-01, 2.445134137142996e+00,
+                                3.754408661907416e+00 };
+    const double p_low = 0.02425;
+    
+    if (p <= 0.0) return -INFINITY;
+    if (p >= 1.0) return INFINITY;
+    
+    double x;
+    if (p < p_low || p > 1.0 - p_low) {
+        double q = sqrt(-2.0 * log(p < p_low ? p : 1.0 - p));
+        x = (((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5]) /
+            ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1.0);
+        if (p > p_low) x = -x;
+    } else {
+        double q = p - 0.5;
+        double r = q * q;
+        x = (((((a[0] * r + a[1]) * r + a[2]) * r + a[3]) * r + a[4]) * r + a[5]) * q /
+            (((((b[0] * r + b[1]) * r + b[2]) * r + b[3]) * r + b[4]) * r + 1.0);
+    }
+    
+    double e = normal_cdf(x) - p;
+    double u = e * sqrt(2.0 * M_PI) * exp(0.5 * x * x);
+    return x - u / (1.0 + 0.5 * x * u);
+}
+
+// Continued fraction for the regularized incomplete beta function (modified Lentz)
+static double beta_continued_fraction(double a, double b, double x) {
+    const double tiny = 1e-300;
+    double c = 1.0;
+    double d = 1.0 - (a + b) * x / (a + 1.0);
+    if (fabs(d) < tiny) d = tiny;
+    d = 1.0 / d;
+    double h = d;
+    
+    for (int m = 1; m <= 300; m++) {
+        double aa = m * (b - m) * x / ((a + 2 * m - 1.0) * (a + 2 * m));
+        d = 1.0 + aa * d;
+        if (fabs(d) < tiny) d = tiny;
+        c = 1.0 + aa / c;
+        if (fabs(c) < tiny) c = tiny;
+        d = 1.0 / d;
+        h *= d * c;
+        
+        aa = -(a + m) * (a + b + m) * x / ((a + 2 * m) * (a + 2 * m + 1.0));
+        d = 1.0 + aa * d;
+        if (fabs(d) < tiny) d = tiny;
+        c = 1.0 + aa / c;
+        if (fabs(c) < tiny) c = tiny;
+        d = 1.0 / d;
+        double delta = d * c;
+        h *= delta;
+        if (fabs(delta - 1.0) < 1e-15) break;
+    }
+    return h;
+}
+
+double incomplete_beta(double a, double b, double x) {
+    if (x <= 0.0) return 0.0;
+    if (x >= 1.0) return 1.0;
+    double front = exp(lgamma(a + b) - lgamma(a) - lgamma(b) + a * log(x) + b * log1p(-x));
+    if (x < (a + 1.0) / (a + b + 2.0)) {
+        return front * beta_continued_fraction(a, b, x) / a;
+    }
+    return 1.0 - front * beta_continued_fraction(b, a, 1.0 - x) / b;
+}
+
+// P(T > |t|) for Student's t with `dof` degrees of freedom, accurate far into the tail
+double student_t_tail(double t, double dof) {
+    return 0.5 * incomplete_beta(0.5 * dof, 0.5, dof / (dof + t * t));
+}
+
+double student_t_cdf(double t, double dof) {
+    double tail = student_t_tail(t, dof);
+    return t > 0 ? 1.0 - tail : tail;
+}
+
+// Gamma(shape, 1) by Marsaglia-Tsang; shapes below 1 use the U^(1/shape) boost
+double generate_gamma(PathRng *rng, double shape) {
+    double boost = 1.0;
+    if (shape < 1.0) {
+        boost = pow(rng_uniform(rng), 1.0 / shape);
+        shape += 1.0;
+    }
+    
+    double d = shape - 1.0 / 3.0;
+    double c = 1.0 / sqrt(9.0 * d);
+    for (;;) {
+        double x, v;
+        do {
+            x = generate_normal(rng, 0.0, 1.0);
+            v = 1.0 + c * x;
+        } while (v <= 0.0);
+        v = v * v * v;
+        double u = rng_uniform(rng);
+        if (u < 1.0 - 0.0331 * x * x * x * x || log(u) < 0.5 * x * x + d * (1.0 - v + log(v))) {
+            return d * v * boost;
+        }
+    }
+}
+
+/*
+ * t-copula normal scores: z = Phi^-1(T_dof(t)), tabulated once per run on
+ * a uniform grid in u = |t| / (1 + |t|) and interpolated linearly, so
+ * mapping a draw costs one division instead of an incomplete beta and a
+ * normal quantile. The map is odd, so only t >= 0 is stored.
+ */
+typedef struct CopulaTable {
+    double dof;
+    double scores[COPULA_TABLE_SIZE];
+} CopulaTable;
+
+void copula_table_init(CopulaTable *table, double dof) {
+    table->dof = dof;
+    table->scores[0] = 0.0;
+    for (int i = 1; i < COPULA_TABLE_SIZE; i++) {
+        double u = (double)i / COPULA_TABLE_SIZE;
+        double score = -normal_quantile(student_t_tail(u / (1.0 - u), dof));
+        // Past double range the tail probability underflows; hold the last score
+        table->scores[i] = isfinite(score) ? score : table->scores[i - 1];
+    }
+}
+
+static inline double copula_score(const CopulaTable *table, double t) {
+    double magnitude = fabs(t);
+    double position = magnitude / (1.0 + magnitude) * COPULA_TABLE_SIZE;
+    int i = (int)position;
+    double score;
+    if (i >= COPULA_TABLE_SIZE - 1) {
+        score = table->scores[COPULA_TABLE_SIZE - 1];
+    } else {
+        double frac = position - i;
+        score = table->scores[i] + frac * (table->scores[i + 1] - table->scores[i]);
+    }
+    return t < 0 ? -score : score;
+}
+
+/*
+ * Shock distributions. Every distribution is standardized to mean 0 and
+ * variance 1, so forecast_std keeps its meaning for every ticker. Shocks
+ * are drawn as normal scores z and mapped through x = F^-1(Phi(z)), which
+ * is tabulated once per distribution. A draw then costs the same single
+ * normal as the Gaussian path plus one interpolation. The same map turns
+ * the correlated scores of --factors and --t-copula into each ticker's own
+ * marginal.
+ */
+typedef struct {
+    ShockDistribution distribution;
+    double values[SHOCK_TABLE_SIZE];   // standardized shock at evenly spaced normal scores
+} ShockTable;
+
+// e^x K1(x), the scaled modified Bessel function of the second kind (Abramowitz & Stegun 9.8.3, 9.8.7-8)
+static double bessel_k1_scaled(double x) {
+    if (x <= 2.0) {
+        double t = x / 3.75;
+        t *= t;
+        double i1 = x * (0.5 + t * (0.87890594 + t * (0.51498869 + t * (0.15084934 +
+                    t * (0.02658733 + t * (0.00301532 + t * 0.00032411))))));
+        double y = x * x / 4.0;
+        double k1 = (log(x / 2.0) * i1) + (1.0 / x) * (1.0 + y * (0.15443144 + y * (-0.67278579 +
+                    y * (-0.18156897 + y * (-0.01919402 + y * (-0.00110404 + y * (-0.00004686)))))));
+        return k1 * exp(x);
+    }
+    double y = 2.0 / x;
+    return (1.25331414 + y * (0.23498619 + y * (-0.03655620 + y * (0.01504268 +
+            y * (-0.00780353 + y * (0.00325614 + y * (-0.00068245))))))) / sqrt(x);
+}
+
+// Density of the unstandardized distribution
+static double distribution_pdf(const ShockDistribution *dist, double x) {
+    switch (dist->kind) {
+        case DIST_STUDENT_T: {
+            double dof = dist->shape;
+            return exp(lgamma(0.5 * (dof + 1.0)) - lgamma(0.5 * dof) - 0.5 * (dof + 1.0) * log1p(x * x / dof))
+                   / sqrt(dof * M_PI);
+        }
+        case DIST_SKEW_NORMAL:
+            return 2.0 * exp(-0.5 * x * x) / sqrt(2.0 * M_PI) * normal_cdf(dist->shape * x);
+        case DIST_NIG: {
+            // delta = 1, mu = 0
+            double alpha = dist->shape, beta = dist->skew;
+            double gamma = sqrt(alpha * alpha - beta * beta);
+            double r = sqrt(1.0 + x * x);
+            return alpha * bessel_k1_scaled(alpha * r) / (M_PI * r) * exp(gamma + beta * x - alpha * r);
+        }
+        case DIST_NORMAL:
+        default:
+            return exp(-0.5 * x * x) / sqrt(2.0 * M_PI);
+    }
+}
+
+static void distribution_moments(const ShockDistribution *dist, double *mean, double *std_dev) {
+    switch (dist->kind) {
+        case DIST_STUDENT_T:
+            *mean = 0.0;
+            *std_dev = sqrt(dist->shape / (dist->shape - 2.0));
+            break;
+        case DIST_SKEW_NORMAL: {
+            double delta = dist->shape / sqrt(1.0 + dist->shape * dist->shape);
+            *mean = delta * sqrt(2.0 / M_PI);
+            *std_dev = sqrt(1.0 - 2.0 * delta * delta / M_PI);
+            break;
+        }
+        case DIST_NIG: {
+            double alpha = dist->shape, beta = dist->skew;
+            double gamma = sqrt(alpha * alpha - beta * beta);
+            *mean = beta / gamma;
+            *std_dev = sqrt(alpha * alpha / (gamma * gamma * gamma));
+            break;
+        }
+        case DIST_NORMAL:
+        default:
+            *mean = 0.0;
+            *std_dev = 1.0;
+            break;
+    }
+}
+
+/*
+ * Tabulate the standardized quantile at each normal score. The density is
+ * integrated on a grid uniform in w = asinh(x), which spans polynomial
+ * tails, from each end separately so both tails keep relative precision.
+ */
+int shock_table_build(ShockTable *table, const ShockDistribution *dist) {
+    int n = SHOCK_GRID_POINTS;
+    double step = 2.0 * SHOCK_GRID_MAX_ASINH / (n - 1);
+    double *density = malloc((size_t)n * sizeof(double));
+    double *left = malloc((size_t)n * sizeof(double));
+    double *right = malloc((size_t)n * sizeof(double));
+    if (!density || !left || !right) {
+        fprintf(stderr, "Error: Memory allocation failed for shock table\n");
+        free(density);
+        free(left);
+        free(right);
+        return 0;
+    }
+    
+    for (int i = 0; i < n; i++) {
+        double w = -SHOCK_GRID_MAX_ASINH + i * step;
+        double pdf = distribution_pdf(dist, sinh(w)) * cosh(w);
+        density[i] = isfinite(pdf) ? pdf : 0.0;
+    }
+    left[0] = 0.0;
+    right[n - 1] = 0.0;
+    for (int i = 1; i < n; i++) {
+        left[i] = left[i - 1] + 0.5 * (density[i - 1] + density[i]) * step;
+        right[n - 1 - i] = right[n - i] + 0.5 * (density[n - i] + density[n - 1 - i]) * step;
+    }
+    double total = left[n - 1];
+    
+    double mean, std_dev;
+    distribution_moments(dist, &mean, &std_dev);
+    table->distribution = *dist;
+    
+    double score_step = 2.0 * SHOCK_TABLE_MAX_SCORE / (SHOCK_TABLE_SIZE - 1);
+    for (int j = 0; j < SHOCK_TABLE_SIZE; j++) {
+        double z = -SHOCK_TABLE_MAX_SCORE + j * score_step;
+        double w;
+        if (z <= 0) {
+            // Left tail: first grid point whose cumulative mass reaches Phi(z)
+            double target = normal_cdf(z) * total;
+            int lo = 0, hi = n - 1;
+            while (hi - lo > 1) {
+                int mid = (lo + hi) / 2;
+                if (left[mid] < target) lo = mid; else hi = mid;
+            }
+            double span = left[hi] - left[lo];
+            w = -SHOCK_GRID_MAX_ASINH + (lo + (span > 0 ? (target - left[lo]) / span : 0.0)) * step;
+        } else {
+            double target = normal_cdf(-z) * total;
+            int lo = 0, hi = n - 1;
+            while (hi - lo > 1) {
+                int mid = (lo + hi) / 2;
+                if (right[mid] > target) lo = mid; else hi = mid;
+            }
+            double span = right[lo] - right[hi];
+            w = -SHOCK_GRID_MAX_ASINH + (lo + (span > 0 ? (right[lo] - target) / span : 0.0)) * step;
+        }
+        table->values[j] = (sinh(w) - mean) / std_dev;
+    }
+    
+    free(density);
+    free(left);
+    free(right);
+    return 1;
+}
+
+/*
+ * Tables are built on first use and kept for the run. Models are set up
+ * before any parallel region, so the cache needs no locking.
+ */
+const ShockTable *shock_table_for(const ShockDistribution *dist) {
+    static ShockTable *cache[SHOCK_TABLE_CACHE];
+    static int cached = 0;
+    
+    if (dist->kind == DIST_NORMAL) {
+        return NULL;
+    }
+    for (int i = 0; i < cached; i++) {
+        const ShockDistribution *c = &cache[i]->distribution;
+        if (c->kind == dist->kind && c->shape == dist->shape && c->skew == dist->skew) {
+            return cache[i];
+        }
+    }
+    
+    ShockTable *table = malloc(sizeof(ShockTable));
+    if (!table || !shock_table_build(table, dist)) {
+        free(table);
+        fprintf(stderr, "Warning: Falling back to Gaussian shocks\n");
+        return NULL;
+    }
+    if (cached < SHOCK_TABLE_CACHE) {
+        cache[cached++] = table;
+    }
+    return table;
+}
+
+// Standardized shock for normal score z
+static inline double shock_value(const ShockTable *table, double z) {
+    double position = (z + SHOCK_TABLE_MAX_SCORE) * ((SHOCK_TABLE_SIZE - 1) / (2.0 * SHOCK_TABLE_MAX_SCORE));
+    if (position <= 0.0) {
+        return table->values[0];
+    }
+    int i = (int)position;
+    if (i >= SHOCK_TABLE_SIZE - 1) {
+        return table->values[SHOCK_TABLE_SIZE - 1];
+    }
+    double frac = position - i;
+    return table->values[i] + frac * (table->values[i + 1] - table->values[i]);
+}
+
+// Batch sampler: `count` standardized shocks from one normal score each (Gaussian without a table)
+static inline void sample_shocks(const ShockTable *table, PathRng *rng, double *out, int count) {
+    for (int i = 0; i < count; i++) {
+        out[i] = generate_normal(rng, 0.0, 1.0);
+    }
+    for (int i = 0; table && i < count; i++) {
+        out[i] = shock_value(table, out[i]);
+    }
+}
+
+// Kurtosis of the tabulated shocks (3 for Gaussian), by quadrature over the normal score
+double shock_kurtosis(const ShockTable *table) {
+    if (!table) {
+        return 3.0;
+    }
+    double score_step = 2.0 * SHOCK_TABLE_MAX_SCORE / (SHOCK_TABLE_SIZE - 1);
+    double fourth = 0.0;
+    for (int j = 0; j < SHOCK_TABLE_SIZE; j++) {
+        double z = -SHOCK_TABLE_MAX_SCORE + j * score_step;
+        double v = table->values[j];
+        fourth += exp(-0.5 * z * z) * v * v * v * v;
+    }
+    return fourth * score_step / sqrt(2.0 * M_PI);
+}
+
+// Parse "normal", "t:DF", "skew-normal:ALPHA" or "nig:ALPHA,BETA"; returns 0 if invalid
+int parse_distribution(const char *spec, ShockDistribution *dist) {
+    const char *params = strchr(spec, ':');
+    size_t name_length = params ? (size_t)(params - spec) : strlen(spec);
+    memset(dist, 0, sizeof(*dist));
+    
+    if (strncasecmp(spec, "normal", name_length) == 0 && name_length == 6) {
+        dist->kind = DIST_NORMAL;
+        return params == NULL;
+    }
+    if (!params) {
+        return 0;
+    }
+    params++;
+    
+    if ((name_length == 1 && strncasecmp(spec, "t", 1) == 0) ||
+        (name_length == 9 && strncasecmp(spec, "student-t", 9) == 0)) {
+        dist->kind = DIST_STUDENT_T;
+        dist->shape = atof(params);
+        // Unit variance needs more than 2 degrees of freedom
+        return dist->shape > 2.0;
+    }
+    if (name_length == 11 && strncasecmp(spec, "skew-normal", 11) == 0) {
+        dist->kind = DIST_SKEW_NORMAL;
+        dist->shape = atof(params);
+        return 1;
+    }
+    if (name_length == 3 && strncasecmp(spec, "nig", 3) == 0) {
+        dist->kind = DIST_NIG;
+        if (sscanf(params, "%lf,%lf", &dist->shape, &dist->skew) < 1) {
+            return 0;
+        }
+        return dist->shape > 0 && fabs(dist->skew) < dist->shape;
+    }
+    return 0;
+}
+
+void describe_distribution(const ShockDistribution *dist, char *buffer, size_t size) {
+    switch (dist->kind) {
+        case DIST_STUDENT_T:
+            snprintf(buffer, size, "Student-t (%g degrees of freedom)", dist->shape);
+            break;
+        case DIST_SKEW_NORMAL:
+            snprintf(buffer, size, "Skew-normal (alpha %g)", dist->shape);
+            break;
+        case DIST_NIG:
+            snprintf(buffer, size, "Normal Inverse Gaussian (alpha %g, beta %g)", dist->shape, dist->skew);
+            break;
+        case DIST_NORMAL:
+        default:
+            snprintf(buffer, size, "Normal");
+            break;
+    }
+}
+
+// Parse "ALPHA,BETA" with alpha, beta >= 0 and alpha + beta < 1; returns 0 if invalid
+int parse_garch(const char *spec, GarchParams *garch) {
+    char *end;
+    garch->alpha = strtod(spec, &end);
+    if (end == spec || *end != ',') {
+        return 0;
+    }
+    const char *beta = end + 1;
+    garch->beta = strtod(beta, &end);
+    if (end == beta || *end != '\0') {
+        return 0;
+    }
+    return garch->alpha >= 0 && garch->beta >= 0 && garch->alpha + garch->beta < 1.0;
+}
+
+// Parse "LAMBDA,MEAN,STD" with 0 <= lambda <= JUMP_MAX_INTENSITY and std >= 0; returns 0 if invalid
+int parse_jumps(const char *spec, JumpParams *jumps) {
+    memset(jumps, 0, sizeof(*jumps));
+    if (sscanf(spec, "%lf,%lf,%lf", &jumps->intensity, &jumps->mean, &jumps->std_dev) != 3) {
+        return 0;
+    }
+    return jumps->intensity >= 0 && jumps->intensity <= JUMP_MAX_INTENSITY && jumps->std_dev >= 0;
+}
+
+// Parse an AR(1) coefficient with |phi| < 1; returns 0 if invalid
+int parse_persistence(const char *spec, double *persistence) {
+    char *end;
+    *persistence = strtod(spec, &end);
+    return end != spec && *end == '\0' && fabs(*persistence) < 1.0;
+}
+
+// Parse var95:LIMIT, var99:LIMIT or loss:X,P (P% chance of losing more than X%); returns 0 if invalid
+int parse_reverse_stress(const char *spec, ReverseStress *reverse) {
+    char tail;
+    memset(reverse, 0, sizeof(*reverse));
+    if (sscanf(spec, "var95:%lf%c", &reverse->limit, &tail) == 1) {
+        reverse->kind = REVERSE_VAR_95;
+        return 1;
+    }
+    if (sscanf(spec, "var99:%lf%c", &reverse->limit, &tail) == 1) {
+        reverse->kind = REVERSE_VAR_99;
+        return 1;
+    }
+    if (sscanf(spec, "loss:%lf,%lf%c", &reverse->loss_level, &reverse->limit, &tail) == 2) {
+        reverse->kind = REVERSE_LOSS_PROBABILITY;
+        return reverse->limit > 0 && reverse->limit < 100;
+    }
+    return 0;
+}
+
+// Parse up to MAX_BARRIERS levels in (-100, 0], sorted descending; returns 0 if invalid
+int parse_barriers(const char *spec, BarrierSet *barriers) {
+    char buffer[MAX_LINE_LENGTH];
+    snprintf(buffer, sizeof(buffer), "%s", spec);
+    
+    barriers->count = 0;
+    for (char *token = strtok(buffer, ","); token; token = strtok(NULL, ",")) {
+        char *end;
+        double level = strtod(token, &end);
+        while (isspace((unsigned char)*end)) end++;
+        if (end == token || *end != '\0' || level <= -100.0 || level > 0.0 || barriers->count == MAX_BARRIERS) {
+            return 0;
+        }
+        int i = barriers->count++;
+        for (; i > 0 && barriers->levels[i - 1] < level; i--) {
+            barriers->levels[i] = barriers->levels[i - 1];
+        }
+        barriers->levels[i] = level;
+    }
+    return barriers->count > 0;
+}
+
+/*
+ * Kurtosis of year `year`'s deviation under GARCH(1,1) started at its
+ * long-run variance, from the recursion for E[h^2] in units of s^4:
+ * E[h'^2] = w^2 + 2 w (alpha + beta) + (alpha^2 k + 2 alpha beta + beta^2) E[h^2]
+ * with w = 1 - alpha - beta and k the shock kurtosis. E[h] stays 1.
+ */
+double garch_year_kurtosis(const GarchParams *garch, double shock_kurtosis, int year) {
+    double a = garch->alpha, b = garch->beta, w = 1.0 - a - b;
+    double second = 1.0;
+    for (int t = 0; t < year; t++) {
+        second = w * w + 2.0 * w * (a + b) + (a * a * shock_kurtosis + 2.0 * a * b + b * b) * second;
+    }
+    return shock_kurtosis * second;
+}
+
+static const struct {
+    const char *name;
+    unsigned bits;
+} metric_names[] = {
+    {"mean",          METRIC_MEAN},
+    {"std",           METRIC_STD_DEV},
+    {"min",           METRIC_MIN},
+    {"max",           METRIC_MAX},
+    {"p5",            METRIC_P5},
+    {"p25",           METRIC_P25},
+    {"p50",           METRIC_P50},
+    {"median",        METRIC_P50},
+    {"p75",           METRIC_P75},
+    {"p95",           METRIC_P95},
+    {"var95",         METRIC_VAR_95},
+    {"var99",         METRIC_VAR_99},
+    {"probabilities", METRIC_PROBABILITIES},
+    {"histogram",     METRIC_HISTOGRAM},
+    {"years",         METRIC_YEARS},
+    {"tail",          METRIC_TAIL},
+    {"path",          METRIC_PATH},
+    {"fan",           METRIC_FAN},
+    {"summary",       METRIC_SUMMARY},
+    {"percentiles",   METRIC_PERCENTILES},
+    {"risk",          METRIC_RISK},
+    {"all",           METRIC_ALL}
+};
+
+// Parse a comma-separated metric list; returns 0 if nothing valid was named
+unsigned parse_metric_list(const char *list) {
+    char buffer[MAX_LINE_LENGTH];
+    snprintf(buffer, sizeof(buffer), "%s", list);
+    
+    unsigned metrics = 0;
+    for (char *token = strtok(buffer, ","); token; token = strtok(NULL, ",")) {
+        while (isspace((unsigned char)*token)) token++;
+        token[strcspn(token, " \t")] = '\0';
+        
+        size_t i;
+        for (i = 0; i < sizeof(metric_names) / sizeof(metric_names[0]); i++) {
+            if (strcmp(token, metric_names[i].name) == 0) {
+                metrics |= metric_names[i].bits;
+                break;
+            }
+        }
+        if (i == sizeof(metric_names) / sizeof(metric_names[0])) {
+            fprintf(stderr, "Warning: Unknown metric '%s' ignored\n", token);
+        }
+    }
+    return metrics;
+}
+
+/*
+ * Build the minimal computation for the requested metrics: a full sort only
+ * when an exporter needs ordered values, path retention only when per-year
+ * metrics are requested (or the paths are being spilled for export).
+ */
+MetricPlan plan_metrics(unsigned metrics, const SimulationConfig *config) {
+    MetricPlan plan;
+    plan.metrics = metrics;
+    plan.full_sort = config->export_csv;
+    plan.retain_paths = (metrics & METRIC_YEARS) || config->out_of_core;
+    return plan;
+}
+
+// Quickselect: place the k-th smallest value at values[k], smaller ones before it
+void select_kth(double *values, size_t n, size_t k) {
+    long lo = 0, hi = (long)n - 1, target = (long)k;
+    while (hi > lo) {
+        long mid = lo + (hi - lo) / 2;
+        if (values[mid] < values[lo]) { double t = values[mid]; values[mid] = values[lo]; values[lo] = t; }
+        if (values[hi] < values[lo]) { double t = values[hi]; values[hi] = values[lo]; values[lo] = t; }
+        if (values[hi] < values[mid]) { double t = values[hi]; values[hi] = values[mid]; values[mid] = t; }
+        double pivot = values[mid];
+        
+        long i = lo, j = hi;
+        while (i <= j) {
+            while (values[i] < pivot) i++;
+            while (values[j] > pivot) j--;
+            if (i <= j) {
+                double t = values[i];
+                values[i] = values[j];
+                values[j] = t;
+                i++;
+                j--;
+            }
+        }
+        
+        // [lo, j] <= pivot <= [i, hi]; anything strictly between equals the pivot
+        if (target <= j) {
+            hi = j;
+        } else if (target >= i) {
+            lo = i;
+        } else {
+            return;
+        }
+    }
+}
+
+// A simulated value and its likelihood-ratio weight (importance sampling)
+typedef struct {
+    double value;
+    double weight;
+} WeightedValue;
+
+/*
+ * Weighted quickselect: the smallest value v whose cumulative weight over
+ * items <= v reaches `target`. Items are reordered; expected O(n).
+ */
+double select_weighted(WeightedValue *items, size_t n, double target) {
+    size_t lo = 0, hi = n;
+    double best = n > 0 ? items[n - 1].value : 0.0;
+    while (hi > lo) {
+        double pivot = items[lo + (hi - lo) / 2].value;
+        
+        // Three-way partition: [lo, lt) < pivot, [lt, gt) == pivot, [gt, hi) > pivot
+        size_t lt = lo, i = lo, gt = hi;
+        double weight_less = 0.0, weight_equal = 0.0;
+        while (i < gt) {
+            if (items[i].value < pivot) {
+                WeightedValue t = items[i]; items[i] = items[lt]; items[lt] = t;
+                weight_less += items[lt].weight;
+                lt++;
+                i++;
+            } else if (items[i].value > pivot) {
+                gt--;
+                WeightedValue t = items[i]; items[i] = items[gt]; items[gt] = t;
+            } else {
+                weight_equal += items[i].weight;
+                i++;
+            }
+        }
+        
+        if (target <= weight_less && lt > lo) {
+            hi = lt;
+        } else if (target <= weight_less + weight_equal) {
+            return pivot;
+        } else {
+            target -= weight_less + weight_equal;
+            best = pivot;
+            lo = gt;
+        }
+    }
+    // Target beyond the total weight: the largest value examined
+    return best;
+}
+
+Statistics calculate_statistics(double *values, int n, const MetricPlan *plan, const SimulationConfig *config) {
+    Statistics stats = {0};
+    
+    if (n <= 0) {
+        fprintf(stderr, "Error: Cannot calculate statistics on empty dataset\n");
+        return stats;
+    }
+    
+    unsigned metrics = plan->metrics;
+    
+    // Order-statistic positions the plan asks for, ascending
+    size_t positions[6];
+    int num_positions = 0;
+    if (metrics & METRIC_VAR_99) positions[num_positions++] = (size_t)(0.01 * n);
+    if (metrics & (METRIC_P5 | METRIC_VAR_95)) positions[num_positions++] = (size_t)(0.05 * n);
+    if (metrics & METRIC_P25) positions[num_positions++] = (size_t)(0.25 * n);
+    if (metrics & METRIC_P50) positions[num_positions++] = (size_t)(0.50 * n);
+    if (metrics & METRIC_P75) positions[num_positions++] = (size_t)(0.75 * n);
+    if (metrics & METRIC_P95) positions[num_positions++] = (size_t)(0.95 * n);
+    
+    int sorted = plan->full_sort || num_positions > QUANTILE_SELECT_MAX;
+    if (sorted) {
+        // Sort values for percentile calculations
+        sort_doubles(values, n, config->sort_algorithm, config->num_threads);
+    } else {
+        // A few targeted selections; each one partitions the range the next
+        // selection has to search
+        size_t base = 0;
+        for (int i = 0; i < num_positions; i++) {
+            select_kth(values + base, n - base, positions[i] - base);
+            base = positions[i];
+        }
+    }
+    
+    if (metrics & (METRIC_MEAN | METRIC_STD_DEV)) {
+        // Calculate mean
+        double sum = 0.0;
+        for (int i = 0; i < n; i++) {
+            sum += values[i];
+        }
+        stats.mean = sum / n;
+    }
+    
+    if (metrics & METRIC_STD_DEV) {
+        // Calculate standard deviation
+        double variance = 0.0;
+        for (int i = 0; i < n; i++) {
+            double diff = values[i] - stats.mean;
+            variance += diff * diff;  // Avoid pow() for better performance
+        }
+        stats.std_dev = sqrt(variance / (n - 1));
+    }
+    
+    // Min and Max
+    if (sorted) {
+        stats.min = values[0];
+        stats.max = values[n - 1];
+    } else if (metrics & (METRIC_MIN | METRIC_MAX)) {
+        stats.min = stats.max = values[0];
+        for (int i = 1; i < n; i++) {
+            if (values[i] < stats.min) stats.min = values[i];
+            if (values[i] > stats.max) stats.max = values[i];
+        }
+    }
+    
+    // Percentiles
+    if (metrics & METRIC_P5) stats.percentile_5 = values[(int)(0.05 * n)];
+    if (metrics & METRIC_P25) stats.percentile_25 = values[(int)(0.25 * n)];
+    if (metrics & METRIC_P50) stats.percentile_50 = values[(int)(0.50 * n)];
+    if (metrics & METRIC_P75) stats.percentile_75 = values[(int)(0.75 * n)];
+    if (metrics & METRIC_P95) stats.percentile_95 = values[(int)(0.95 * n)];
+    
+    // Value at Risk (VaR) - loss percentiles
+    if (metrics & METRIC_VAR_95) stats.var_95 = -values[(int)(0.05 * n)];
+    if (metrics & METRIC_VAR_99) stats.var_99 = -values[(int)(0.01 * n)];
+    
+    return stats;
+}
+
+void print_histogram(FILE *output, const int *bins, int width, int height, double min_val, double max_val);
+
+void create_histogram(double *values, int n, FILE *output, int width, int height) {
+    if (n <= 0) {
+        fprintf(stderr, "Error: Cannot create histogram from empty dataset\n");
+        return;
+    }
+    
+    // Values need not be sorted; the planner skips the sort when it can
+    double min_val = values[0];
+    double max_val = values[0];
+    for (int i = 1; i < n; i++) {
+        if (values[i] < min_val) min_val = values[i];
+        if (values[i] > max_val) max_val = values[i];
+    }
+    double range = max_val - min_val;
+    
+    if (range <= 0) {
+        fprintf(stderr, "Warning: Zero range in histogram data, using default range\n");
+        range = 1.0;  // Default to prevent division by zero
+    }
+    
+    int *bins = calloc(width, sizeof(int));
+    if (!bins) {
+        fprintf(stderr, "Error: Memory allocation failed for histogram bins\n");
+        return;
+    }
+    
+    // Fill bins
+    for (int i = 0; i < n; i++) {
+        int bin = (int)((values[i] - min_val) / range * (width - 1));
+        if (bin >= 0 && bin < width) {
+            bins[bin]++;
+        }
+    }
+    
+    print_histogram(output, bins, width, height, min_val, max_val);
+    free(bins);
+}
+
+void print_histogram(FILE *output, const int *bins, int width, int height, double min_val, double max_val) {
+    // Find max frequency for scaling
+    int max_freq = 0;
+    for (int i = 0; i < width; i++) {
+        if (bins[i] > max_freq) {
+            max_freq = bins[i];
+        }
+    }
+    
+    fprintf(output, "\nDISTRIBUTION HISTOGRAM:\n");
+    fprintf(output, "========================\n");
+    
+    // Print histogram
+    for (int row = height - 1; row >= 0; row--) {
+        fprintf(output, "%3d%% |", (row * 100) / height);
+        for (int col = 0; col < width; col++) {
+            int bar_height = max_freq > 0 ? (bins[col] * height) / max_freq : 0;
+            if (bar_height > row) {
+                fprintf(output, "*");
+            } else {
+                fprintf(output, " ");
+            }
+        }
+        fprintf(output, "|\n");
+    }
+    
+    // Print x-axis
+    fprintf(output, "     +");
+    for (int i = 0; i < width; i++) {
+        fprintf(output, "-");
+    }
+    fprintf(output, "+\n");
+    fprintf(output, "    %.1f%%", min_val);
+    for (int i = 0; i < width - 10; i++) {
+        fprintf(output, " ");
+    }
+    fprintf(output, "%.1f%%\n\n", max_val);
+}
+
+void export_csv(const char *ticker, double *values, int n, const SimulationConfig *config) {
+    char csv_filename[MAX_LINE_LENGTH + 50];
+    snprintf(csv_filename, sizeof(csv_filename), "%s_%s.csv", ticker, "simulation_results");
+    
+    FILE *csv_file = fopen(csv_filename, "w");
+    if (!csv_file) {
+        fprintf(stderr, "Error: Could not create CSV file %s\n", csv_filename);
+        return;
+    }
+    
+    fprintf(csv_file, "Simulation,FinalValue\n");
+    for (int i = 0; i < n; i++) {
+        fprintf(csv_file, "%d,%.4f\n", i + 1, values[i]);
+    }
+    
+    fclose(csv_file);
+    printf("CSV data exported to %s\n", csv_filename);
+}
+
+int scratch_open(ScratchFile *scratch, const char *filename) {
+    memset(scratch, 0, sizeof(*scratch));
+    scratch->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (scratch->fd < 0) {
+        fprintf(stderr, "Error: Could not create scratch file %s\n", filename);
+        return 0;
+    }
+    
+    long page_size = sysconf(_SC_PAGESIZE);
+    scratch->page_size = page_size > 0 ? (size_t)page_size : 4096;
+    
+    ScratchFileHeader header = {0};
+    memcpy(header.magic, SCRATCH_MAGIC, sizeof(header.magic));
+    header.version = SCRATCH_VERSION;
+    if (pwrite(scratch->fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+        fprintf(stderr, "Error: Could not write scratch file header to %s\n", filename);
+        close(scratch->fd);
+        scratch->fd = -1;
+        return 0;
+    }
+    
+    scratch->next_offset = scratch->page_size;
+    return 1;
+}
+
+// Map a fresh page-aligned block for one ticker and point the path buffers into it.
+int scratch_map_block(ScratchFile *scratch, const StockData *stock, int num_simulations) {
+    size_t n = (size_t)num_simulations;
+    size_t payload = SCRATCH_HEADER_SIZE + n * sizeof(double) + n * stock->num_years * sizeof(float);
+    size_t length = (payload + scratch->page_size - 1) / scratch->page_size * scratch->page_size;
+    off_t offset = (off_t)scratch->next_offset;
+    
+    if (ftruncate(scratch->fd, offset + (off_t)length) != 0) {
+        fprintf(stderr, "Error: Could not grow scratch file for %s (disk full?)\n", stock->ticker);
+        return 0;
+    }
+    
+    void *map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, scratch->fd, offset);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Error: Could not map scratch block for %s\n", stock->ticker);
+        return 0;
+    }
+    
+    ScratchBlockHeader *header = (ScratchBlockHeader *)map;
+    memset(header, 0, sizeof(*header));
+    snprintf(header->ticker, sizeof(header->ticker), "%s", stock->ticker);
+    header->num_years = stock->num_years;
+    header->first_year = stock->years[0];
+    header->num_simulations = n;
+    header->block_bytes = length;
+    
+    scratch->map = map;
+    scratch->map_length = length;
+    scratch->final_values = (double *)((char *)map + SCRATCH_HEADER_SIZE);
+    scratch->annual_returns = (float *)(scratch->final_values + n);
+    
+    // The simulation writes num_years sequential streams; let the kernel
+    // cluster writeback instead of faulting pages in at random.
+    madvise(map, length, MADV_SEQUENTIAL);
+    return 1;
+}
+
+// Prefetch the next year row while the current one is being reduced.
+void scratch_prefetch_row(const ScratchFile *scratch, int year, int num_simulations) {
+    size_t row_bytes = (size_t)num_simulations * sizeof(float);
+    uintptr_t start = (uintptr_t)(scratch->annual_returns + (size_t)year * num_simulations);
+    uintptr_t aligned = start & ~((uintptr_t)scratch->page_size - 1);
+    madvise((void *)aligned, row_bytes + (start - aligned), MADV_WILLNEED);
+}
+
+// Flush a finished block asynchronously and drop it from the address space so
+// the page cache can evict it; the data stays in the scratch file.
+void scratch_release_block(ScratchFile *scratch) {
+    if (!scratch->map) {
+        return;
+    }
+    
+    msync(scratch->map, scratch->map_length, MS_ASYNC);
+    munmap(scratch->map, scratch->map_length);
+    posix_fadvise(scratch->fd, (off_t)scratch->next_offset, (off_t)scratch->map_length, POSIX_FADV_DONTNEED);
+    
+    scratch->next_offset += scratch->map_length;
+    scratch->num_blocks++;
+    scratch->map = NULL;
+    scratch->map_length = 0;
+    scratch->final_values = NULL;
+    scratch->annual_returns = NULL;
+}
+
+void scratch_close(ScratchFile *scratch) {
+    if (scratch->fd < 0) {
+        return;
+    }
+    
+    scratch_release_block(scratch);
+    
+    ScratchFileHeader header = {0};
+    memcpy(header.magic, SCRATCH_MAGIC, sizeof(header.magic));
+    header.version = SCRATCH_VERSION;
+    header.num_blocks = scratch->num_blocks;
+    header.total_bytes = scratch->next_offset;
+    if (pwrite(scratch->fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+        fprintf(stderr, "Warning: Could not finalize scratch file header\n");
+    }
+    
+    close(scratch->fd);
+    scratch->fd = -1;
+}
+
+void moments_init(RunningMoments *m) {
+    m->count = 0;
+    m->mean = 0.0;
+    m->m2 = 0.0;
+    m->min = INFINITY;
+    m->max = -INFINITY;
+}
+
+static inline void moments_add(RunningMoments *m, double value) {
+    m->count++;
+    double delta = value - m->mean;
+    m->mean += delta / m->count;
+    m->m2 += delta * (value - m->mean);
+    if (value < m->min) m->min = value;
+    if (value > m->max) m->max = value;
+}
+
+void moments_merge(RunningMoments *dst, const RunningMoments *src) {
+    if (src->count == 0) {
+        return;
+    }
+    if (dst->count == 0) {
+        *dst = *src;
+        return;
+    }
+    
+    double total = (double)dst->count + (double)src->count;
+    double delta = src->mean - dst->mean;
+    dst->mean += delta * src->count / total;
+    dst->m2 += src->m2 + delta * delta * ((double)dst->count * src->count / total);
+    dst->count += src->count;
+    if (src->min < dst->min) dst->min = src->min;
+    if (src->max > dst->max) dst->max = src->max;
+}
+
+double moments_std_dev(const RunningMoments *m) {
+    return m->count > 1 ? sqrt(m->m2 / (m->count - 1)) : 0.0;
+}
+
+static inline void sketch_side_clear(SketchSide *side) {
+    if (side->lo <= side->hi) {
+        memset(side->counts + side->lo, 0, (size_t)(side->hi - side->lo + 1) * sizeof(uint64_t));
+    }
+    side->lo = SKETCH_BUCKETS;
+    side->hi = -1;
+}
+
+void sketch_init(QuantileSketch *sketch) {
+    memset(sketch, 0, sizeof(*sketch));
+    sketch->negative.lo = sketch->positive.lo = SKETCH_BUCKETS;
+    sketch->negative.hi = sketch->positive.hi = -1;
+}
+
+void sketch_clear(QuantileSketch *sketch) {
+    sketch->zero_count = 0;
+    sketch_side_clear(&sketch->negative);
+    sketch_side_clear(&sketch->positive);
+}
+
+static inline int sketch_key(double magnitude) {
+    int key = (int)ceil(log(magnitude) * (1.0 / SKETCH_LOG_GAMMA)) + SKETCH_KEY_OFFSET;
+    return key < 0 ? 0 : (key >= SKETCH_BUCKETS ? SKETCH_BUCKETS - 1 : key);
+}
+
+// Bucket key covers magnitudes in (gamma^(k-1), gamma^k]
+static inline double sketch_bucket_bound(int key) {
+    return exp((key - SKETCH_KEY_OFFSET) * SKETCH_LOG_GAMMA);
+}
+
+static inline void sketch_add(QuantileSketch *sketch, double value) {
+    double magnitude = fabs(value);
+    if (magnitude < SKETCH_MIN_MAGNITUDE) {
+        sketch->zero_count++;
+        return;
+    }
+    SketchSide *side = value > 0 ? &sketch->positive : &sketch->negative;
+    int key = sketch_key(magnitude);
+    side->counts[key]++;
+    if (key < side->lo) side->lo = key;
+    if (key > side->hi) side->hi = key;
+}
+
+static void sketch_side_merge(SketchSide *dst, const SketchSide *src) {
+    for (int k = src->lo; k <= src->hi; k++) {
+        dst->counts[k] += src->counts[k];
+    }
+    if (src->lo < dst->lo) dst->lo = src->lo;
+    if (src->hi > dst->hi) dst->hi = src->hi;
+}
+
+void sketch_merge(QuantileSketch *dst, const QuantileSketch *src) {
+    dst->zero_count += src->zero_count;
+    sketch_side_merge(&dst->negative, &src->negative);
+    sketch_side_merge(&dst->positive, &src->positive);
+}
+
+/*
+ * Value of the given 0-based rank. Buckets are walked from the most negative
+ * value upwards and the rank is interpolated linearly inside its bucket.
+ */
+double sketch_value_at_rank(const QuantileSketch *sketch, uint64_t rank) {
+    uint64_t seen = 0;
+    const SketchSide *neg = &sketch->negative;
+    for (int k = neg->hi; k >= neg->lo; k--) {
+        uint64_t c = neg->counts[k];
+        if (c && rank < seen + c) {
+            double outer = sketch_bucket_bound(k), inner = sketch_bucket_bound(k - 1);
+            double fraction = (rank - seen + 0.5) / c;
+            return -(outer - fraction * (outer - inner));
+        }
+        seen += c;
+    }
+    
+    if (rank < seen + sketch->zero_count) {
+        return 0.0;
+    }
+    seen += sketch->zero_count;
+    
+    const SketchSide *pos = &sketch->positive;
+    for (int k = pos->lo; k <= pos->hi; k++) {
+        uint64_t c = pos->counts[k];
+        if (c && rank < seen + c) {
+            double inner = sketch_bucket_bound(k - 1), outer = sketch_bucket_bound(k);
+            double fraction = (rank - seen + 0.5) / c;
+            return inner + fraction * (outer - inner);
+        }
+        seen += c;
+    }
+    return pos->hi >= 0 ? sketch_bucket_bound(pos->hi) : 0.0;
+}
+
+static inline void tail_add(TailBuffer *tail, double value) {
+    if (tail->size < TAIL_BUFFER_SIZE) {
+        int i = tail->size++;
+        while (i > 0 && tail->values[(i - 1) / 2] < value) {
+            tail->values[i] = tail->values[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+        tail->values[i] = value;
+        return;
+    }
+    if (value >= tail->values[0]) {
+        return;
+    }
+    
+    // Replace the largest retained value and sift down
+    int i = 0;
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= TAIL_BUFFER_SIZE) break;
+        if (child + 1 < TAIL_BUFFER_SIZE && tail->values[child + 1] > tail->values[child]) child++;
+        if (tail->values[child] <= value) break;
+        tail->values[i] = tail->values[child];
+        i = child;
+    }
+    tail->values[i] = value;
+}
+
+void tail_merge(TailBuffer *dst, const TailBuffer *src) {
+    for (int i = 0; i < src->size; i++) {
+        tail_add(dst, src->values[i]);
+    }
+}
+
+// Copy of the tail in ascending order
+int tail_sorted(const TailBuffer *tail, double *out) {
+    memcpy(out, tail->values, (size_t)tail->size * sizeof(double));
+    sort_doubles(out, tail->size, SORT_QSORT, 1);
+    return tail->size;
+}
+
+/*
+ * Peaks-over-threshold tail model for losses (negated final values). The
+ * worst values kept by the bounded tail heap set the threshold at the
+ * last of them; the exceedances beyond it are fitted with a Generalized
+ * Pareto Distribution, which extrapolates VaR and ES past the levels the
+ * paths themselves can resolve.
+ */
+typedef struct {
+    int exceedances;
+    uint64_t num_paths;
+    double threshold;   // loss at the threshold, percent
+    double shape;       // xi; > 0 is a heavy tail, < 0 a bounded one
+    double scale;       // sigma
+} TailFit;
+
+/*
+ * Fit the GPD to `worst` (the count smallest values, ascending) with the
+ * Zhang-Stephens estimator: a likelihood-weighted average over a grid of
+ * b = -xi / sigma. Unlike plain maximum likelihood it always returns a
+ * finite fit. Returns 0 when there are too few exceedances.
+ */
+int fit_tail(const double *worst, int count, uint64_t num_paths, TailFit *fit) {
+    int m = count - 1;
+    if (m < GPD_MIN_EXCEEDANCES) {
+        return 0;
+    }
+    
+    double threshold = -worst[m];
+    double y[TAIL_BUFFER_SIZE];
+    for (int i = 0; i < m; i++) {
+        y[i] = -worst[i] - threshold;    // descending
+    }
+    double y_max = y[0];
+    double y_quartile = y[m - (int)(m / 4.0 + 0.5)];
+    if (y_max <= 0 || y_quartile <= 0) {
+        return 0;
+    }
+    
+    int grid = GPD_GRID_BASE + (int)sqrt((double)m);
+    double b[GPD_GRID_BASE + TAIL_BUFFER_SIZE];
+    double log_lik[GPD_GRID_BASE + TAIL_BUFFER_SIZE];
+    for (int j = 0; j < grid; j++) {
+        b[j] = 1.0 / y_max + (1.0 - sqrt(grid / (j + 0.5))) / (3.0 * y_quartile);
+        double k = 0.0;
+        for (int i = 0; i < m; i++) {
+            k += log1p(-b[j] * y[i]);
+        }
+        k /= m;
+        log_lik[j] = m * (log(-b[j] / k) - k - 1.0);
+    }
+    
+    double b_hat = 0.0;
+    for (int j = 0; j < grid; j++) {
+        double denom = 0.0;
+        for (int t = 0; t < grid; t++) {
+            denom += exp(log_lik[t] - log_lik[j]);
+        }
+        b_hat += b[j] / denom;
+    }
+    
+    double xi = 0.0;
+    for (int i = 0; i < m; i++) {
+        xi += log1p(-b_hat * y[i]);
+    }
+    xi /= m;
+    
+    fit->exceedances = m;
+    fit->num_paths = num_paths;
+    fit->threshold = threshold;
+    fit->shape = xi;
+    fit->scale = fabs(b_hat) > 1e-12 ? -xi / b_hat : y_quartile;
+    return 1;
+}
+
+// Loss exceeded with probability p, for the given GPD parameters
+static double tail_var_at(const TailFit *fit, double p, double shape, double scale) {
+    double ratio = (double)fit->num_paths * p / fit->exceedances;
+    if (fabs(shape) < 1e-9) {
+        return fit->threshold - scale * log(ratio);
+    }
+    return fit->threshold + scale / shape * (pow(ratio, -shape) - 1.0);
+}
+
+double tail_var(const TailFit *fit, double p) {
+    return tail_var_at(fit, p, fit->shape, fit->scale);
+}
+
+// Expected loss beyond tail_var(p); infinite when xi >= 1
+double tail_expected_shortfall(const TailFit *fit, double p) {
+    if (fit->shape >= 1.0) {
+        return INFINITY;
+    }
+    return (tail_var(fit, p) + fit->scale - fit->shape * fit->threshold) / (1.0 - fit->shape);
+}
+
+/*
+ * Standard error of tail_var by the delta method, using the asymptotic
+ * covariance of the GPD estimates, plus the variance of the threshold as
+ * an order statistic: the GPD density there is (m/n)/sigma, which gives
+ * sigma^2 (1 - m/n) / m. Without that term the interval collapses for
+ * levels near the threshold, where the fitted parameters barely matter.
+ */
+double tail_var_std_error(const TailFit *fit, double p) {
+    double xi = fit->shape, sigma = fit->scale;
+    double h_xi = 1e-5, h_sigma = 1e-5 * sigma;
+    double d_xi = (tail_var_at(fit, p, xi + h_xi, sigma) - tail_var_at(fit, p, xi - h_xi, sigma)) / (2 * h_xi);
+    double d_sigma = (tail_var_at(fit, p, xi, sigma + h_sigma) - tail_var_at(fit, p, xi, sigma - h_sigma)) / (2 * h_sigma);
+    
+    double c = 1.0 + xi;
+    double variance = (d_xi * d_xi * c * c - 2.0 * d_xi * d_sigma * sigma * c + d_sigma * d_sigma * 2.0 * sigma * sigma * c)
+                      / fit->exceedances;
+    double tail_fraction = (double)fit->exceedances / fit->num_paths;
+    variance += sigma * sigma * (1.0 - tail_fraction) / fit->exceedances;
+    return sqrt(fmax(variance, 0.0));
+}
+
+void write_tail_fit(FILE *output, const double *worst, int count, uint64_t num_paths) {
+    static const double levels[] = { 0.005, 0.001, 0.0005, 0.0001 };
+    TailFit fit;
+    
+    fprintf(output, "\nEXTREME VALUE TAIL (GPD, peaks over threshold):\n");
+    fprintf(output, "-----------------------------------------------\n");
+    if (!fit_tail(worst, count, num_paths, &fit)) {
+        fprintf(output, "Not enough tail paths for a fit (need %d)\n", GPD_MIN_EXCEEDANCES + 1);
+        return;
+    }
+    
+    fprintf(output, "Threshold: %.2f%% loss (worst %d of %llu paths) | Shape: %.3f | Scale: %.3f\n",
+            fit.threshold, fit.exceedances, (unsigned long long)num_paths, fit.shape, fit.scale);
+    fprintf(output, "Confidence      VaR      95%% interval        Expected Shortfall\n");
+    for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+        double p = levels[l];
+        if (p * num_paths > fit.exceedances) {
+            // The threshold is already beyond this level: the empirical tail answers it
+            continue;
+        }
+        double var = tail_var(&fit, p);
+        double se = tail_var_std_error(&fit, p);
+        fprintf(output, "  %7.2f%%  %8.2f%%  [%7.2f%%, %7.2f%%]  %8.2f%%\n", (1.0 - p) * 100.0, var,
+                var - 1.96 * se, var + 1.96 * se, tail_expected_shortfall(&fit, p));
+    }
+}
+
+void path_risk_init(PathRisk *risk, const BarrierSet *barriers) {
+    memset(risk, 0, sizeof(*risk));
+    risk->barriers = *barriers;
+    moments_init(&risk->drawdown);
+    sketch_init(&risk->drawdown_sketch);
+    moments_init(&risk->years_below);
+}
+
+void path_risk_reset(PathRisk *risk) {
+    moments_init(&risk->drawdown);
+    sketch_clear(&risk->drawdown_sketch);
+    moments_init(&risk->years_below);
+    risk->ever_below = 0;
+    memset(risk->first_passage, 0, sizeof(risk->first_passage));
+}
+
+/*
+ * Compound one path's annual growth rates, tracking the running peak and
+ * level. Barriers are sorted descending and a level that crosses one has
+ * crossed every higher one, so a single cursor finds each first passage.
+ */
+static inline void path_risk_add(PathRisk *risk, const double *annual, int num_years) {
+    double level = 1.0, peak = 1.0, max_drawdown = 0.0;
+    int below = 0, next_barrier = 0;
+    for (int year = 0; year < num_years; year++) {
+        level *= 1.0 + annual[year] / 100.0;
+        peak = level > peak ? level : peak;
+        double drawdown = 1.0 - level / peak;
+        max_drawdown = drawdown > max_drawdown ? drawdown : max_drawdown;
+        below += level < 1.0;
+        double change = (level - 1.0) * 100.0;
+        while (next_barrier < risk->barriers.count && change <= risk->barriers.levels[next_barrier]) {
+            risk->first_passage[next_barrier++][year]++;
+        }
+    }
+    moments_add(&risk->drawdown, max_drawdown * 100.0);
+    sketch_add(&risk->drawdown_sketch, max_drawdown * 100.0);
+    moments_add(&risk->years_below, below);
+    risk->ever_below += below > 0;
+}
+
+void path_risk_merge(PathRisk *dst, const PathRisk *src) {
+    moments_merge(&dst->drawdown, &src->drawdown);
+    sketch_merge(&dst->drawdown_sketch, &src->drawdown_sketch);
+    moments_merge(&dst->years_below, &src->years_below);
+    dst->ever_below += src->ever_below;
+    for (int b = 0; b < dst->barriers.count; b++) {
+        for (int y = 0; y < MAX_YEARS; y++) {
+            dst->first_passage[b][y] += src->first_passage[b][y];
+        }
+    }
+}
+
+// Compound one path and add its cumulative growth at every year end to that year's sketch
+static inline void fan_add(QuantileSketch *sketches, const double *annual, int num_years) {
+    double level = 1.0;
+    for (int year = 0; year < num_years; year++) {
+        level *= 1.0 + annual[year] / 100.0;
+        sketch_add(&sketches[year], (level - 1.0) * 100.0);
+    }
+}
+
+// The barriers to track for a run, or NULL when path metrics are off
+const BarrierSet *path_barriers(const SimulationConfig *config) {
+    return (config->metrics & METRIC_PATH) ? &config->barriers : NULL;
+}
+
+int barriers_equal(const BarrierSet *a, const BarrierSet *b) {
+    if (a->count != b->count) {
+        return 0;
+    }
+    for (int i = 0; i < a->count; i++) {
+        if (a->levels[i] != b->levels[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void batch_record(RunningMoments *batches, const Statistics *stats) {
+    double values[BATCH_STATS] = { stats->mean, stats->std_dev, -stats->var_99, stats->percentile_5,
+                                   stats->percentile_25, stats->percentile_50, stats->percentile_75,
+                                   stats->percentile_95 };
+    for (int i = 0; i < BATCH_STATS; i++) {
+        moments_add(&batches[i], values[i]);
+    }
+}
+
+// Batch-means standard error of one statistic; NAN with fewer than two batches
+double batch_error(const RunningMoments *batches, int which) {
+    const RunningMoments *m = &batches[which];
+    return m->count > 1 ? moments_std_dev(m) / sqrt((double)m->count) : NAN;
+}
+
+/*
+ * Batch means over final values in path order: num_batches contiguous
+ * batches, each summarised through one reused sketch, so the values are
+ * not sorted again. Must run before the values are reordered.
+ */
+void batch_statistics(const double *values, int n, int num_batches, RunningMoments *batches) {
+    for (int i = 0; i < BATCH_STATS; i++) {
+        moments_init(&batches[i]);
+    }
+    if (num_batches > n / 2) {
+        num_batches = n / 2;
+    }
+    if (num_batches < 2) {
+        return;
+    }
+    QuantileSketch *sketch = malloc(sizeof(QuantileSketch));
+    if (!sketch) {
+        fprintf(stderr, "Error: Memory allocation failed for batch sketch\n");
+        return;
+    }
+    sketch_init(sketch);
+    
+    for (int b = 0; b < num_batches; b++) {
+        int lo = (int)((int64_t)n * b / num_batches), hi = (int)((int64_t)n * (b + 1) / num_batches);
+        uint64_t count = (uint64_t)(hi - lo);
+        RunningMoments moments;
+        moments_init(&moments);
+        sketch_clear(sketch);
+        for (int i = lo; i < hi; i++) {
+            moments_add(&moments, values[i]);
+            sketch_add(sketch, values[i]);
+        }
+        
+        Statistics stats = {0};
+        stats.mean = moments.mean;
+        stats.std_dev = moments_std_dev(&moments);
+        stats.var_99 = -sketch_value_at_rank(sketch, (uint64_t)(0.01 * count));
+        stats.percentile_5 = sketch_value_at_rank(sketch, (uint64_t)(0.05 * count));
+        stats.percentile_25 = sketch_value_at_rank(sketch, (uint64_t)(0.25 * count));
+        stats.percentile_50 = sketch_value_at_rank(sketch, (uint64_t)(0.50 * count));
+        stats.percentile_75 = sketch_value_at_rank(sketch, (uint64_t)(0.75 * count));
+        stats.percentile_95 = sketch_value_at_rank(sketch, (uint64_t)(0.95 * count));
+        batch_record(batches, &stats);
+    }
+    free(sketch);
+}
+
+int accumulator_init(PathAccumulator *acc, int num_years, int with_years, const BarrierSet *barriers, int with_fan) {
+    memset(acc, 0, sizeof(*acc));
+    moments_init(&acc->moments);
+    sketch_init(&acc->sketch);
+    acc->num_years = num_years;
+    for (int y = 0; y < num_years; y++) {
+        moments_init(&acc->year_moments[y]);
+    }
+    for (int i = 0; i < BATCH_STATS; i++) {
+        moments_init(&acc->batches[i]);
+    }
+    
+    if (with_years) {
+        acc->year_sketches = malloc((size_t)num_years * sizeof(QuantileSketch));
+        if (!acc->year_sketches) {
+            fprintf(stderr, "Error: Memory allocation failed for per-year sketches\n");
+            return 0;
+        }
+        for (int y = 0; y < num_years; y++) {
+            sketch_init(&acc->year_sketches[y]);
+        }
+    }
+    
+    if (barriers) {
+        acc->path_risk = malloc(sizeof(PathRisk));
+        if (!acc->path_risk) {
+            fprintf(stderr, "Error: Memory allocation failed for path metrics\n");
+            return 0;
+        }
+        path_risk_init(acc->path_risk, barriers);
+    }
+    
+    if (with_fan) {
+        acc->fan_sketches = malloc((size_t)num_years * sizeof(QuantileSketch));
+        if (!acc->fan_sketches) {
+            fprintf(stderr, "Error: Memory allocation failed for fan chart sketches\n");
+            return 0;
+        }
+        for (int y = 0; y < num_years; y++) {
+            sketch_init(&acc->fan_sketches[y]);
+        }
+    }
+    return 1;
+}
+
+void accumulator_reset(PathAccumulator *acc) {
+    moments_init(&acc->moments);
+    acc->prob_positive = acc->prob_above_10 = acc->prob_above_20 = acc->prob_below_neg10 = 0;
+    acc->low_tail.size = 0;
+    acc->high_tail.size = 0;
+    sketch_clear(&acc->sketch);
+    memset(acc->year_comoments, 0, sizeof(acc->year_comoments));
+    for (int i = 0; i < BATCH_STATS; i++) {
+        moments_init(&acc->batches[i]);
+    }
+    for (int y = 0; y < acc->num_years; y++) {
+        moments_init(&acc->year_moments[y]);
+        if (acc->year_sketches) {
+            sketch_clear(&acc->year_sketches[y]);
+        }
+        if (acc->fan_sketches) {
+            sketch_clear(&acc->fan_sketches[y]);
+        }
+    }
+    if (acc->path_risk) {
+        path_risk_reset(acc->path_risk);
+    }
+}
+
+void accumulator_free(PathAccumulator *acc) {
+    free(acc->year_sketches);
+    acc->year_sketches = NULL;
+    free(acc->path_risk);
+    acc->path_risk = NULL;
+    free(acc->fan_sketches);
+    acc->fan_sketches = NULL;
+}
+
+static inline void accumulator_add_path(PathAccumulator *acc, double final_value, const double *annual) {
+    moments_add(&acc->moments, final_value);
+    acc->prob_positive += final_value > 0;
+    acc->prob_above_10 += final_value > 10;
+    acc->prob_above_20 += final_value > 20;
+    acc->prob_below_neg10 += final_value < -10;
+    tail_add(&acc->low_tail, final_value);
+    tail_add(&acc->high_tail, -final_value);
+    sketch_add(&acc->sketch, final_value);
+    // Lag-1 co-moments against the means before this path (Welford form)
+    double weight = (double)acc->year_moments[0].count / (acc->year_moments[0].count + 1);
+    for (int y = 1; y < acc->num_years; y++) {
+        acc->year_comoments[y] += weight * (annual[y - 1] - acc->year_moments[y - 1].mean) *
+                                  (annual[y] - acc->year_moments[y].mean);
+    }
+    for (int y = 0; y < acc->num_years; y++) {
+        moments_add(&acc->year_moments[y], annual[y]);
+        if (acc->year_sketches) {
+            sketch_add(&acc->year_sketches[y], annual[y]);
+        }
+    }
+    if (acc->path_risk) {
+        path_risk_add(acc->path_risk, annual, acc->num_years);
+    }
+    if (acc->fan_sketches) {
+        fan_add(acc->fan_sketches, annual, acc->num_years);
+    }
+}
+
+void accumulator_merge(PathAccumulator *dst, const PathAccumulator *src) {
+    moments_merge(&dst->moments, &src->moments);
+    dst->prob_positive += src->prob_positive;
+    dst->prob_above_10 += src->prob_above_10;
+    dst->prob_above_20 += src->prob_above_20;
+    dst->prob_below_neg10 += src->prob_below_neg10;
+    tail_merge(&dst->low_tail, &src->low_tail);
+    tail_merge(&dst->high_tail, &src->high_tail);
+    sketch_merge(&dst->sketch, &src->sketch);
+    // Co-moments merge with the year means before they are combined
+    uint64_t dst_count = dst->year_moments[0].count, src_count = src->year_moments[0].count;
+    for (int y = 1; y < dst->num_years && src_count > 0; y++) {
+        double total = (double)dst_count + (double)src_count;
+        dst->year_comoments[y] += src->year_comoments[y] +
+            (src->year_moments[y - 1].mean - dst->year_moments[y - 1].mean) *
+            (src->year_moments[y].mean - dst->year_moments[y].mean) * ((double)dst_count * src_count / total);
+    }
+    for (int y = 0; y < dst->num_years; y++) {
+        moments_merge(&dst->year_moments[y], &src->year_moments[y]);
+        if (dst->year_sketches && src->year_sketches) {
+            sketch_merge(&dst->year_sketches[y], &src->year_sketches[y]);
+        }
+        if (dst->fan_sketches && src->fan_sketches) {
+            sketch_merge(&dst->fan_sketches[y], &src->fan_sketches[y]);
+        }
+    }
+    if (dst->path_risk && src->path_risk) {
+        path_risk_merge(dst->path_risk, src->path_risk);
+    }
+    for (int i = 0; i < BATCH_STATS; i++) {
+        moments_merge(&dst->batches[i], &src->batches[i]);
+    }
+}
+
+// Order statistic of the final values: exact inside the tail buffers, sketched elsewhere
+double accumulator_value_at_rank(const PathAccumulator *acc, uint64_t rank) {
+    uint64_t n = acc->moments.count;
+    double tail[TAIL_BUFFER_SIZE];
+    
+    if (rank < (uint64_t)acc->low_tail.size) {
+        tail_sorted(&acc->low_tail, tail);
+        return tail[rank];
+    }
+    if (rank >= n - acc->high_tail.size) {
+        tail_sorted(&acc->high_tail, tail);
+        return -tail[n - 1 - rank];
+    }
+    return sketch_value_at_rank(&acc->sketch, rank);
+}
+
+Statistics accumulator_statistics(const PathAccumulator *acc) {
+    Statistics stats = {0};
+    uint64_t n = acc->moments.count;
+    if (n == 0) {
+        return stats;
+    }
+    
+    stats.mean = acc->moments.mean;
+    stats.std_dev = moments_std_dev(&acc->moments);
+    stats.min = acc->moments.min;
+    stats.max = acc->moments.max;
+    stats.percentile_5 = accumulator_value_at_rank(acc, (uint64_t)(0.05 * n));
+    stats.percentile_25 = accumulator_value_at_rank(acc, (uint64_t)(0.25 * n));
+    stats.percentile_50 = accumulator_value_at_rank(acc, (uint64_t)(0.50 * n));
+    stats.percentile_75 = accumulator_value_at_rank(acc, (uint64_t)(0.75 * n));
+    stats.percentile_95 = accumulator_value_at_rank(acc, (uint64_t)(0.95 * n));
+    stats.var_95 = -stats.percentile_5;
+    stats.var_99 = -accumulator_value_at_rank(acc, (uint64_t)(0.01 * n));
+    return stats;
+}
+
+Statistics accumulator_year_statistics(const PathAccumulator *acc, int year) {
+    Statistics stats = {0};
+    const RunningMoments *m = &acc->year_moments[year];
+    stats.mean = m->mean;
+    stats.std_dev = moments_std_dev(m);
+    stats.min = m->min;
+    stats.max = m->max;
+    if (acc->year_sketches && m->count > 0) {
+        stats.percentile_25 = sketch_value_at_rank(&acc->year_sketches[year], (uint64_t)(0.25 * m->count));
+        stats.percentile_50 = sketch_value_at_rank(&acc->year_sketches[year], (uint64_t)(0.50 * m->count));
+        stats.percentile_75 = sketch_value_at_rank(&acc->year_sketches[year], (uint64_t)(0.75 * m->count));
+    }
+    return stats;
+}
+
+// Realized correlation of years y-1 and y across paths (NAN for the first year)
+double accumulator_lag_correlation(const PathAccumulator *acc, int year) {
+    if (year < 1) {
+        return NAN;
+    }
+    double scale = sqrt(acc->year_moments[year - 1].m2 * acc->year_moments[year].m2);
+    return scale > 0 ? acc->year_comoments[year] / scale : NAN;
+}
+
+ProbabilityCounts accumulator_probabilities(const PathAccumulator *acc) {
+    ProbabilityCounts probs = { acc->moments.count, acc->prob_positive, acc->prob_above_10,
+                                acc->prob_above_20, acc->prob_below_neg10 };
+    return probs;
+}
+
+// Spread `count` uniformly over the bin coordinates [x0, x1]
+static void histogram_spread(double *bins, int width, double x0, double x1, double count) {
+    if (x1 - x0 < 1e-12) {
+        int bin = (int)x0;
+        bins[bin < 0 ? 0 : (bin >= width ? width - 1 : bin)] += count;
+        return;
+    }
+    for (int bin = (int)floor(x0); bin <= (int)floor(x1); bin++) {
+        double lo = bin > x0 ? bin : x0;
+        double hi = bin + 1 < x1 ? bin + 1 : x1;
+        if (hi > lo) {
+            bins[bin < 0 ? 0 : (bin >= width ? width - 1 : bin)] += count * (hi - lo) / (x1 - x0);
+        }
+    }
+}
+
+/*
+ * Display histogram built from sketch buckets; no raw values needed. Each
+ * bucket's count is spread over the display bins its value range overlaps,
+ * so narrow sketch buckets do not alias against wide display bins.
+ */
+void sketch_histogram(const QuantileSketch *sketch, double min_val, double max_val, int *bins, int width) {
+    double range = max_val - min_val;
+    if (range <= 0) {
+        range = 1.0;
+    }
+    double scale = (width - 1) / range;
+    
+    double *weights = calloc(width, sizeof(double));
+    if (!weights) {
+        return;
+    }
+    
+    for (int side = 0; side < 2; side++) {
+        const SketchSide *buckets = side ? &sketch->positive : &sketch->negative;
+        double sign = side ? 1.0 : -1.0;
+        for (int k = buckets->lo; k <= buckets->hi; k++) {
+            if (!buckets->counts[k]) continue;
+            double a = sign * sketch_bucket_bound(k - 1), b = sign * sketch_bucket_bound(k);
+            double lo = (a < b ? a : b), hi = (a < b ? b : a);
+            lo = lo < min_val ? min_val : lo;
+            hi = hi > max_val ? max_val : hi;
+            histogram_spread(weights, width, (lo - min_val) * scale, (hi - min_val) * scale,
+                             (double)buckets->counts[k]);
+        }
+    }
+    if (sketch->zero_count) {
+        histogram_spread(weights, width, (0.0 - min_val) * scale, (0.0 - min_val) * scale, (double)sketch->zero_count);
+    }
+    
+    for (int i = 0; i < width; i++) {
+        bins[i] += (int)llround(weights[i]);
+    }
+    free(weights);
+}
+
+/*
+ * Close the section parsed into stocks[count]; returns the new count. A
+ * section with a "SCENARIO: NAME WEIGHT" line becomes one scenario of its
+ * ticker, joining an earlier section of the same ticker if there is one.
+ */
+static int finish_forecast_section(StockData *stocks, int count, const char *scenario, double weight) {
+    StockData *section = &stocks[count];
+    if (section->num_years == 0) {
+        return count;
+    }
+    if (!scenario) {
+        return count + 1;
+    }
+    if (weight <= 0) {
+        fprintf(stderr, "Warning: Scenario %s of %s has no positive weight; skipped\n", scenario, section->ticker);
+        memset(section, 0, sizeof(*section));
+        return count;
+    }
+    
+    StockData *target = section;
+    for (int i = 0; i < count; i++) {
+        if (stocks[i].num_scenarios > 0 && strcmp(stocks[i].ticker, section->ticker) == 0) {
+            target = &stocks[i];
+            break;
+        }
+    }
+    if (target != section && (target->num_scenarios == MAX_SCENARIOS || target->num_years != section->num_years ||
+                              target->years[0] != section->years[0])) {
+        fprintf(stderr, "Warning: Scenario %s of %s skipped (period differs or more than %d scenarios)\n",
+                scenario, section->ticker, MAX_SCENARIOS);
+        memset(section, 0, sizeof(*section));
+        return count;
+    }
+    
+    int k = target->num_scenarios++;
+    snprintf(target->scenario_names[k], MAX_TICKER_LENGTH, "%s", scenario);
+    target->scenario_weights[k] = weight;
+    memcpy(target->scenario_growth[k], section->growth_rates, sizeof(section->growth_rates));
+    if (target != section) {
+        memset(section, 0, sizeof(*section));
+        return count;
+    }
+    return count + 1;
+}
+
+// Normalize scenario weights and blend the scenarios into growth_rates
+static void finish_scenarios(StockData *stock) {
+    if (stock->num_scenarios <= 1) {
+        stock->num_scenarios = 0;   // a lone scenario is just the forecast
+        return;
+    }
+    double total = 0.0;
+    for (int k = 0; k < stock->num_scenarios; k++) {
+        total += stock->scenario_weights[k];
+    }
+    double cumulative = 0.0;
+    memset(stock->growth_rates, 0, sizeof(stock->growth_rates));
+    for (int k = 0; k < stock->num_scenarios; k++) {
+        stock->scenario_weights[k] /= total;
+        cumulative += stock->scenario_weights[k];
+        stock->scenario_cumulative[k] = cumulative;
+        for (int year = 0; year < stock->num_years; year++) {
+            stock->growth_rates[year] += stock->scenario_weights[k] * stock->scenario_growth[k][year];
+        }
+    }
+}
+
+int parse_stock_data(const char *filename, StockData **stocks_ptr, int max_stocks) {
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        fprintf(stderr, "Error: Could not open file %s\n", filename);
+        return 0;
+    }
+    
+    // A max_stocks of 0 means no cap; the array grows as sections are found
+    int capacity = max_stocks > 0 ? max_stocks : STOCK_ALLOC_CHUNK;
+    StockData *stocks = calloc(capacity, sizeof(StockData));
+    if (!stocks) {
+        fprintf(stderr, "Error: Memory allocation failed for stock data\n");
+        fclose(file);
+        return 0;
+    }
+    
+    char line[MAX_LINE_LENGTH];
+    int stock_count = 0;
+    int in_forecast = 0;
+    char scenario[MAX_TICKER_LENGTH];
+    int has_scenario = 0;
+    double scenario_weight = 0.0;
+    
+    while (fgets(line, sizeof(line), file) && (max_stocks <= 0 || stock_count < max_stocks)) {
+        // Remove newline character
+        line[strcspn(line, "\n")] = 0;
+        
+        // Check for new forecast section
+        if (strstr(line, "REVENUE FORECAST FOR")) {
+            if (stock_count == capacity) {
+                StockData *grown = realloc(stocks, (size_t)capacity * 2 * sizeof(StockData));
+                if (!grown) {
+                    fprintf(stderr, "Error: Memory allocation failed growing stock data\n");
+                    break;
+                }
+                memset(grown + capacity, 0, (size_t)capacity * sizeof(StockData));
+                stocks = grown;
+                capacity *= 2;
+            }
+            in_forecast = 1;
+            has_scenario = 0;
+            // Extract ticker name
+            char *ticker_start = strstr(line, "FOR ") + 4;
+            char *ticker_end = strstr(ticker_start, " (");
+            if (ticker_start && ticker_end) {
+                int ticker_len = ticker_end - ticker_start;
+                if (ticker_len < MAX_TICKER_LENGTH - 1) {
+                    strncpy(stocks[stock_count].ticker, ticker_start, ticker_len);
+                    stocks[stock_count].ticker[ticker_len] = '\0';
+                    stocks[stock_count].num_years = 0;
+                } else {
+                    fprintf(stderr, "Warning: Ticker name too long, truncating: %.*s\n", ticker_len, ticker_start);
+                    strncpy(stocks[stock_count].ticker, ticker_start, MAX_TICKER_LENGTH - 1);
+                    stocks[stock_count].ticker[MAX_TICKER_LENGTH - 1] = '\0';
+                    stocks[stock_count].num_years = 0;
+                }
+            }
+            continue;
+        }
+        
+        // Check for end of section
+        if (strstr(line, "---") && in_forecast) {
+            stock_count = finish_forecast_section(stocks, stock_count, has_scenario ? scenario : NULL, scenario_weight);
+            in_forecast = 0;
+            continue;
+        }
+        
+        // Optional scenario tag: "SCENARIO: bull 25%"
+        if (in_forecast && strncasecmp(line, "SCENARIO", 8) == 0) {
+            const char *rest = line + 8;
+            rest += *rest == ':';
+            has_scenario = sscanf(rest, " %19s %lf", scenario, &scenario_weight) == 2;
+            if (!has_scenario) {
+                fprintf(stderr, "Warning: Ignoring malformed scenario line: %s\n", line);
+            }
+            continue;
+        }
+        
+        // Parse year and growth rate
+        if (in_forecast && strlen(line) > 0) {
+            int year;
+            double growth;
+            if ((sscanf(line, "%d: %lf%%", &year, &growth) == 2 || 
+                 sscanf(line, "%d %lf%%", &year, &growth) == 2) && 
+                stocks[stock_count].num_years < MAX_YEARS) {
+                int idx = stocks[stock_count].num_years;
+                stocks[stock_count].years[idx] = year;
+                stocks[stock_count].growth_rates[idx] = growth;
+                stocks[stock_count].num_years++;
+            }
+        }
+    }
+    
+    // Check if we ended on an active forecast section
+    if (in_forecast && stock_count < capacity) {
+        stock_count = finish_forecast_section(stocks, stock_count, has_scenario ? scenario : NULL, scenario_weight);
+    }
+    for (int i = 0; i < stock_count; i++) {
+        finish_scenarios(&stocks[i]);
+    }
+    
+    fclose(file);
+    *stocks_ptr = stocks;
+    return stock_count;
+}
+
+/*
+ * Factor loadings file:
+ *
+ *   # comment
+ *   FACTORS market tech        optional; names the K factors
+ *   AAPL 0.60 0.40             one line per ticker, K loadings each
+ *
+ * Loadings are on standardized shocks, so the squares of a ticker's
+ * loadings may sum to at most 1; the rest is idiosyncratic. Tickers not
+ * listed are independent of the factors.
+ */
+int load_factor_loadings(const char *filename, FactorLoadings *factors) {
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        fprintf(stderr, "Error: Could not open factor loadings file %s\n", filename);
+        return 0;
+    }
+    
+    memset(factors, 0, sizeof(*factors));
+    int capacity = 0;
+    char line[MAX_LINE_LENGTH];
+    int line_number = 0;
+    int ok = 1;
+    
+    while (ok && fgets(line, sizeof(line), file)) {
+        line_number++;
+        line[strcspn(line, "#\r\n")] = 0;
+        
+        char *token = strtok(line, " \t,");
+        if (!token) {
+            continue;
+        }
+        
+        if (strcasecmp(token, "FACTORS") == 0) {
+            factors->num_factors = 0;
+            while ((token = strtok(NULL, " \t,")) && factors->num_factors < MAX_FACTORS) {
+                snprintf(factors->names[factors->num_factors++], MAX_TICKER_LENGTH, "%s", token);
+            }
+            continue;
+        }
+        
+        if (factors->num_tickers == capacity) {
+            int grown_capacity = capacity ? capacity * 2 : STOCK_ALLOC_CHUNK;
+            FactorTicker *grown = realloc(factors->tickers, (size_t)grown_capacity * sizeof(FactorTicker));
+            if (!grown) {
+                fprintf(stderr, "Error: Memory allocation failed for factor loadings\n");
+                ok = 0;
+                break;
+            }
+            factors->tickers = grown;
+            capacity = grown_capacity;
+        }
+        
+        FactorTicker *entry = &factors->tickers[factors->num_tickers];
+        memset(entry, 0, sizeof(*entry));
+        snprintf(entry->ticker, MAX_TICKER_LENGTH, "%s", token);
+        
+        int count = 0;
+        double sum_squares = 0.0;
+        while ((token = strtok(NULL, " \t,"))) {
+            char *end;
+            double loading = strtod(token, &end);
+            if (*end != '\0' || count == MAX_FACTORS) {
+                fprintf(stderr, "Error: %s:%d: invalid or too many loadings (max %d)\n", filename, line_number, MAX_FACTORS);
+                ok = 0;
+                break;
+            }
+            entry->loadings[count++] = loading;
+            sum_squares += loading * loading;
+        }
+        if (!ok) {
+            break;
+        }
+        
+        // The first ticker fixes K when there is no FACTORS line
+        if (factors->num_factors == 0) {
+            factors->num_factors = count;
+            for (int k = 0; k < count; k++) {
+                snprintf(factors->names[k], MAX_TICKER_LENGTH, "F%d", k + 1);
+            }
+        }
+        if (count != factors->num_factors) {
+            fprintf(stderr, "Error: %s:%d: %s has %d loadings, expected %d\n",
+                    filename, line_number, entry->ticker, count, factors->num_factors);
+            ok = 0;
+        } else if (sum_squares > 1.0 + 1e-9) {
+            fprintf(stderr, "Error: %s:%d: squared loadings of %s sum to %.3f (> 1)\n",
+                    filename, line_number, entry->ticker, sum_squares);
+            ok = 0;
+        } else {
+            factors->num_tickers++;
+        }
+    }
+    
+    fclose(file);
+    if (ok && factors->num_factors == 0) {
+        fprintf(stderr, "Error: No factor loadings found in %s\n", filename);
+        ok = 0;
+    }
+    if (!ok) {
+        free(factors->tickers);
+        factors->tickers = NULL;
+    }
+    return ok;
+}
+
+const double *find_factor_loadings(const FactorLoadings *factors, const char *ticker) {
+    for (int i = 0; i < factors->num_tickers; i++) {
+        if (strcmp(factors->tickers[i].ticker, ticker) == 0) {
+            return factors->tickers[i].loadings;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Regime file (--regimes), one regime per line:
+ *
+ *   # name      shift  scale  transition probabilities to each regime
+ *   expansion     0.0    1.0  0.85 0.15
+ *   recession    -6.0    1.6  0.45 0.55
+ *
+ * Shift is added to every ticker's growth in that regime's years and
+ * scale multiplies the deviation. Rows are renormalized to sum to 1. The
+ * first year is drawn from the chain's stationary distribution unless
+ * `start` names a regime.
+ */
+int load_regimes(const char *filename, const char *start, RegimeModel *regimes) {
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        fprintf(stderr, "Error: Could not open regime file %s\n", filename);
+        return 0;
+    }
+    
+    memset(regimes, 0, sizeof(*regimes));
+    int columns[MAX_REGIMES];
     char line[MAX_LINE_LENGTH];
-    int stock_count = 0;
-    int in_forecast = 0;
+    int line_number = 0;
+    int ok = 1;
+    
+    while (ok && fgets(line, sizeof(line), file)) {
+        line_number++;
+        line[strcspn(line, "#\r\n")] = 0;
+        
+        char *token = strtok(line, " \t,");
+        if (!token) {
+            continue;
+        }
+        if (regimes->num_regimes == MAX_REGIMES) {
+            fprintf(stderr, "Error: %s:%d: too many regimes (max %d)\n", filename, line_number, MAX_REGIMES);
+            ok = 0;
+            break;
+        }
+        
+        int r = regimes->num_regimes;
+        snprintf(regimes->names[r], MAX_TICKER_LENGTH, "%s", token);
+        double values[2 + MAX_REGIMES];
+        int count = 0;
+        while ((token = strtok(NULL, " \t,"))) {
+            char *end;
+            double value = strtod(token, &end);
+            if (*end != '\0' || count == 2 + MAX_REGIMES) {
+                fprintf(stderr, "Error: %s:%d: invalid or too many values\n", filename, line_number);
+                ok = 0;
+                break;
+            }
+            values[count++] = value;
+        }
+        if (!ok) {
+            break;
+        }
+        if (count < 3 || values[1] <= 0) {
+            fprintf(stderr, "Error: %s:%d: expected NAME SHIFT SCALE P1 P2 ... with SCALE > 0\n", filename, line_number);
+            ok = 0;
+            break;
+        }
+        
+        regimes->shift[r] = values[0];
+        regimes->scale[r] = values[1];
+        columns[r] = count - 2;
+        double row_sum = 0.0;
+        for (int k = 0; k < count - 2; k++) {
+            if (values[2 + k] < 0) {
+                fprintf(stderr, "Error: %s:%d: negative transition probability\n", filename, line_number);
+                ok = 0;
+            }
+            regimes->transition[r][k] = values[2 + k];
+            row_sum += values[2 + k];
+        }
+        if (ok && row_sum <= 0) {
+            fprintf(stderr, "Error: %s:%d: transition probabilities sum to zero\n", filename, line_number);
+            ok = 0;
+        }
+        for (int k = 0; ok && k < count - 2; k++) {
+            regimes->transition[r][k] /= row_sum;
+        }
+        regimes->num_regimes++;
+    }
+    fclose(file);
+    
+    int n = regimes->num_regimes;
+    if (ok && n == 0) {
+        fprintf(stderr, "Error: No regimes found in %s\n", filename);
+        ok = 0;
+    }
+    for (int r = 0; ok && r < n; r++) {
+        if (columns[r] != n) {
+            fprintf(stderr, "Error: %s: regime %s has %d transition probabilities, expected %d\n",
+                    filename, regimes->names[r], columns[r], n);
+            ok = 0;
+        }
+    }
+    if (!ok) {
+        return 0;
+    }
+    
+    if (start && start[0] != '\0') {
+        int found = 0;
+        for (int r = 0; r < n; r++) {
+            if (strcasecmp(regimes->names[r], start) == 0) {
+                regimes->initial[r] = 1.0;
+                found = 1;
+            }
+        }
+        if (!found) {
+            fprintf(stderr, "Error: Unknown starting regime %s\n", start);
+            return 0;
+        }
+    } else {
+        // Stationary distribution by power iteration
+        for (int r = 0; r < n; r++) {
+            regimes->initial[r] = 1.0 / n;
+        }
+        for (int iteration = 0; iteration < REGIME_STATIONARY_ITERATIONS; iteration++) {
+            double next[MAX_REGIMES] = { 0 };
+            for (int r = 0; r < n; r++) {
+                for (int k = 0; k < n; k++) {
+                    next[k] += regimes->initial[r] * regimes->transition[r][k];
+                }
+            }
+            memcpy(regimes->initial, next, sizeof(next));
+        }
+    }
+    
+    for (int r = 0; r < n; r++) {
+        double sum = 0.0, initial_sum = 0.0;
+        for (int k = 0; k < n; k++) {
+            sum += regimes->transition[r][k];
+            regimes->cumulative[r][k] = sum;
+        }
+        initial_sum = r > 0 ? regimes->initial_cumulative[r - 1] : 0.0;
+        regimes->initial_cumulative[r] = initial_sum + regimes->initial[r];
+    }
+    return 1;
+}
+
+/*
+ * History file (--history): CSV rows "TICKER,VALUE" or "TICKER,YEAR,VALUE"
+ * in time order per ticker, where VALUE is a realized growth rate or
+ * forecast error in percent. Rows whose value is not a number (headers)
+ * are skipped. Each ticker's values are demeaned and scaled to unit
+ * variance, so the bootstrap supplies the shape and serial dependence of
+ * the residuals while the adjusted standard deviation sets their size.
+ */
+int load_history(const char *filename, HistoryFile *history) {
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        fprintf(stderr, "Error: Could not open history file %s\n", filename);
+        return 0;
+    }
+    
+    memset(history, 0, sizeof(*history));
+    int *row_series = NULL;
+    double *row_values = NULL;
+    int num_rows = 0, row_capacity = 0, series_capacity = 0;
+    char line[MAX_LINE_LENGTH];
+    int ok = 1;
+    
+    while (ok && fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "#\r\n")] = 0;
+        char *fields[3];
+        int num_fields = 0;
+        for (char *token = strtok(line, ",;\t"); token && num_fields < 3; token = strtok(NULL, ",;\t")) {
+            fields[num_fields++] = token;
+        }
+        if (num_fields < 2) {
+            continue;
+        }
+        char *ticker = fields[0];
+        while (isspace((unsigned char)*ticker)) ticker++;
+        ticker[strcspn(ticker, " ")] = 0;
+        char *end;
+        double value = strtod(fields[num_fields - 1], &end);
+        while (isspace((unsigned char)*end)) end++;
+        if (end == fields[num_fields - 1] || *end != '\0' || !isfinite(value)) {
+            continue;   // header or malformed row
+        }
+        
+        int series = -1;
+        for (int i = 0; i < history->num_series; i++) {
+            if (strcmp(history->series[i].ticker, ticker) == 0) {
+                series = i;
+                break;
+            }
+        }
+        if (series < 0) {
+            if (history->num_series == series_capacity) {
+                series_capacity = series_capacity ? series_capacity * 2 : STOCK_ALLOC_CHUNK;
+                HistorySeries *grown = realloc(history->series, (size_t)series_capacity * sizeof(HistorySeries));
+                if (!grown) {
+                    ok = 0;
+                    break;
+                }
+                history->series = grown;
+            }
+            series = history->num_series++;
+            memset(&history->series[series], 0, sizeof(HistorySeries));
+            snprintf(history->series[series].ticker, MAX_TICKER_LENGTH, "%s", ticker);
+        }
+        
+        if (num_rows == row_capacity) {
+            row_capacity = row_capacity ? row_capacity * 2 : 1024;
+            int *grown_series = realloc(row_series, (size_t)row_capacity * sizeof(int));
+            if (grown_series) {
+                row_series = grown_series;
+            }
+            double *grown_values = realloc(row_values, (size_t)row_capacity * sizeof(double));
+            if (grown_values) {
+                row_values = grown_values;
+            }
+            if (!grown_series || !grown_values) {
+                ok = 0;
+                break;
+            }
+        }
+        row_series[num_rows] = series;
+        row_values[num_rows] = value;
+        history->series[series].count++;
+        num_rows++;
+    }
+    fclose(file);
+    
+    if (ok && num_rows > 0) {
+        history->residuals = malloc((size_t)num_rows * sizeof(double));
+        ok = history->residuals != NULL;
+    }
+    if (!ok) {
+        fprintf(stderr, "Error: Memory allocation failed for history %s\n", filename);
+    } else if (num_rows == 0) {
+        fprintf(stderr, "Error: No history rows found in %s\n", filename);
+        ok = 0;
+    }
+    
+    if (ok) {
+        // Pack each ticker's rows contiguously, keeping their order
+        int offset = 0;
+        for (int i = 0; i < history->num_series; i++) {
+            history->series[i].offset = offset;
+            offset += history->series[i].count;
+            history->series[i].count = 0;
+        }
+        for (int r = 0; r < num_rows; r++) {
+            HistorySeries *series = &history->series[row_series[r]];
+            history->residuals[series->offset + series->count++] = row_values[r];
+        }
+        
+        for (int i = 0; ok && i < history->num_series; i++) {
+            HistorySeries *series = &history->series[i];
+            double *values = history->residuals + series->offset;
+            double mean = 0.0, variance = 0.0;
+            for (int k = 0; k < series->count; k++) {
+                mean += values[k];
+            }
+            mean /= series->count;
+            for (int k = 0; k < series->count; k++) {
+                variance += (values[k] - mean) * (values[k] - mean);
+            }
+            variance /= series->count > 1 ? series->count - 1 : 1;
+            if (series->count < HISTORY_MIN_OBSERVATIONS || variance <= 0) {
+                fprintf(stderr, "Error: %s: %s needs at least %d varying observations (has %d)\n",
+                        filename, series->ticker, HISTORY_MIN_OBSERVATIONS, series->count);
+                ok = 0;
+                break;
+            }
+            double scale = 1.0 / sqrt(variance);
+            for (int k = 0; k < series->count; k++) {
+                values[k] = (values[k] - mean) * scale;
+            }
+        }
+    }
+    
+    free(row_series);
+    free(row_values);
+    if (!ok) {
+        free(history->series);
+        free(history->residuals);
+        memset(history, 0, sizeof(*history));
+    }
+    return ok;
+}
+
+const HistorySeries *find_history_series(const HistoryFile *history, const char *ticker) {
+    for (int i = 0; history && i < history->num_series; i++) {
+        if (strcmp(history->series[i].ticker, ticker) == 0) {
+            return &history->series[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Per-ticker model file (--model-file), one ticker per line:
+ *
+ *   # comment
+ *   *     dist=t:6                defaults for tickers not listed
+ *   TSLA  dist=nig:1.5,-0.6 garch=0.15,0.75 jumps=0.2,-15,10 ar=0.4
+ *
+ * Anything a line does not set falls back to the command-line options.
+ */
+static int parse_model_setting(TickerModel *model, const char *key, const char *value) {
+    if (strcmp(key, "dist") == 0) {
+        model->has_distribution = parse_distribution(value, &model->distribution);
+        return model->has_distribution;
+    }
+    if (strcmp(key, "garch") == 0) {
+        model->has_garch = parse_garch(value, &model->garch);
+        return model->has_garch;
+    }
+    if (strcmp(key, "jumps") == 0) {
+        model->has_jumps = parse_jumps(value, &model->jumps);
+        return model->has_jumps;
+    }
+    if (strcmp(key, "ar") == 0) {
+        model->has_persistence = parse_persistence(value, &model->persistence);
+        return model->has_persistence;
+    }
+    return 0;
+}
+
+int load_model_file(const char *filename, ModelFile *models) {
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        fprintf(stderr, "Error: Could not open model file %s\n", filename);
+        return 0;
+    }
+    
+    memset(models, 0, sizeof(*models));
+    int capacity = 0;
+    char line[MAX_LINE_LENGTH];
+    int line_number = 0;
+    int ok = 1;
+    
+    while (ok && fgets(line, sizeof(line), file)) {
+        line_number++;
+        line[strcspn(line, "#\r\n")] = 0;
+        
+        char *token = strtok(line, " \t");
+        if (!token) {
+            continue;
+        }
+        
+        if (models->num_tickers == capacity) {
+            int grown_capacity = capacity ? capacity * 2 : STOCK_ALLOC_CHUNK;
+            TickerModel *grown = realloc(models->tickers, (size_t)grown_capacity * sizeof(TickerModel));
+            if (!grown) {
+                fprintf(stderr, "Error: Memory allocation failed for ticker models\n");
+                ok = 0;
+                break;
+            }
+            models->tickers = grown;
+            capacity = grown_capacity;
+        }
+        
+        TickerModel *model = &models->tickers[models->num_tickers];
+        memset(model, 0, sizeof(*model));
+        snprintf(model->ticker, MAX_TICKER_LENGTH, "%s", token);
+        
+        while (ok && (token = strtok(NULL, " \t"))) {
+            char *value = strchr(token, '=');
+            if (value) {
+                *value++ = '\0';
+            }
+            if (!value || !parse_model_setting(model, token, value)) {
+                fprintf(stderr, "Error: %s:%d: invalid setting '%s%s%s'\n",
+                        filename, line_number, token, value ? "=" : "", value ? value : "");
+                ok = 0;
+            }
+        }
+        if (ok) {
+            models->num_tickers++;
+        }
+    }
+    
+    fclose(file);
+    if (!ok) {
+        free(models->tickers);
+        models->tickers = NULL;
+    }
+    return ok;
+}
+
+/*
+ * YEARS column of a stress rule: all, N or N-M, as 1-based forecast years
+ * up to MAX_YEARS or, above that, calendar years as in the forecasts file.
+ */
+static int parse_stress_years(const char *spec, StressRule *rule) {
+    int first, last, used = 0;
+    if (strcmp(spec, "all") == 0) {
+        rule->first_year = 0;
+        rule->last_year = MAX_YEARS - 1;
+        return 1;
+    }
+    if (sscanf(spec, "%d-%d%n", &first, &last, &used) != 2 || spec[used] != '\0') {
+        used = 0;
+        if (sscanf(spec, "%d%n", &first, &used) != 1 || spec[used] != '\0') {
+            return 0;
+        }
+        last = first;
+    }
+    rule->calendar = first > MAX_YEARS;
+    rule->first_year = rule->calendar ? first : first - 1;
+    rule->last_year = rule->calendar ? last : last - 1;
+    return first >= 1 && last >= first && (last > MAX_YEARS) == rule->calendar;
+}
+
+// SHOCK column of a stress rule: +/-POINTS added to the growth rate, or xFACTOR scaling it
+static int parse_stress_shock(const char *spec, StressRule *rule) {
+    rule->multiplicative = spec[0] == 'x' || spec[0] == '*';
+    const char *number = spec + rule->multiplicative;
+    char *end;
+    rule->value = strtod(number, &end);
+    return end != number && *end == '\0';
+}
+
+/*
+ * Stress file: "NAME TARGET YEARS SHOCK" rules, several per scenario if
+ * needed, and "SECTOR NAME TICKER..." lines defining the @NAME targets.
+ */
+int load_stress_file(const char *filename, StressFile *stress) {
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        fprintf(stderr, "Error: Could not open stress file %s\n", filename);
+        return 0;
+    }
+    
+    memset(stress, 0, sizeof(*stress));
+    int capacity = 0;
+    char line[MAX_LINE_LENGTH];
+    int line_number = 0;
+    int ok = 1;
+    
+    while (ok && fgets(line, sizeof(line), file)) {
+        line_number++;
+        line[strcspn(line, "#\r\n")] = 0;
+        
+        char *token = strtok(line, " \t");
+        if (!token) {
+            continue;
+        }
+        
+        if (strcmp(token, "SECTOR") == 0) {
+            char *sector = strtok(NULL, " \t");
+            if (!sector) {
+                fprintf(stderr, "Error: %s:%d: expected SECTOR NAME TICKER...\n", filename, line_number);
+                ok = 0;
+            }
+            while (ok && (token = strtok(NULL, " \t,"))) {
+                if (stress->num_members == capacity) {
+                    int grown_capacity = capacity ? capacity * 2 : STOCK_ALLOC_CHUNK;
+                    SectorMember *grown = realloc(stress->members, (size_t)grown_capacity * sizeof(SectorMember));
+                    if (!grown) {
+                        fprintf(stderr, "Error: Memory allocation failed for sector members\n");
+                        ok = 0;
+                        break;
+                    }
+                    stress->members = grown;
+                    capacity = grown_capacity;
+                }
+                SectorMember *member = &stress->members[stress->num_members++];
+                snprintf(member->sector, MAX_TICKER_LENGTH, "%s", sector);
+                snprintf(member->ticker, MAX_TICKER_LENGTH, "%s", token);
+            }
+            continue;
+        }
+        
+        StressRule rule = {0};
+        char *target = strtok(NULL, " \t");
+        char *years = strtok(NULL, " \t");
+        char *shock = strtok(NULL, " \t");
+        if (!target || !years || !shock || strtok(NULL, " \t") ||
+            !parse_stress_years(years, &rule) || !parse_stress_shock(shock, &rule)) {
+            fprintf(stderr, "Error: %s:%d: expected NAME TARGET YEARS SHOCK (YEARS: all, N or N-M with forecast "
+                    "years 1-%d or calendar years; SHOCK: +/-POINTS or xFACTOR)\n", filename, line_number, MAX_YEARS);
+            ok = 0;
+            break;
+        }
+        
+        int k = 0;
+        while (k < stress->num_scenarios && strcmp(stress->names[k], token) != 0) {
+            k++;
+        }
+        if (k == MAX_STRESS_SCENARIOS || stress->num_rules == MAX_STRESS_RULES) {
+            fprintf(stderr, "Error: %s:%d: too many stress scenarios or rules (max %d and %d)\n",
+                    filename, line_number, MAX_STRESS_SCENARIOS, MAX_STRESS_RULES);
+            ok = 0;
+            break;
+        }
+        if (k == stress->num_scenarios) {
+            snprintf(stress->names[k], MAX_TICKER_LENGTH, "%s", token);
+            stress->num_scenarios++;
+        }
+        rule.scenario = k;
+        snprintf(rule.target, MAX_TICKER_LENGTH, "%s", target);
+        stress->rules[stress->num_rules++] = rule;
+    }
+    fclose(file);
+    
+    if (ok && stress->num_rules == 0) {
+        fprintf(stderr, "Error: No stress scenarios found in %s\n", filename);
+        ok = 0;
+    }
+    if (!ok) {
+        free(stress->members);
+        stress->members = NULL;
+    }
+    return ok;
+}
+
+static int stress_target_matches(const StressFile *stress, const char *target, const char *ticker) {
+    if (target[0] != '@') {
+        return fnmatch(target, ticker, 0) == 0;
+    }
+    for (int m = 0; m < stress->num_members; m++) {
+        if (strcmp(stress->members[m].sector, target + 1) == 0 && strcmp(stress->members[m].ticker, ticker) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Apply one scenario to a copy of a ticker's forecasts; returns the number
+ * of rules that matched, or -1 when a matching rule covers none of the
+ * ticker's forecast years (a silent no-op would read as "no impact").
+ */
+int apply_stress(const StressFile *stress, int scenario, StockData *stock) {
+    int matched = 0;
+    for (int r = 0; r < stress->num_rules; r++) {
+        const StressRule *rule = &stress->rules[r];
+        if (rule->scenario != scenario || !stress_target_matches(stress, rule->target, stock->ticker)) {
+            continue;
+        }
+        matched++;
+        int touched = 0;
+        for (int year = 0; year < stock->num_years; year++) {
+            int key = rule->calendar ? stock->years[year] : year;
+            if (key < rule->first_year || key > rule->last_year) {
+                continue;
+            }
+            touched++;
+            // The blend and every mixture scenario move together, so the blend stays their average
+            double *rates[MAX_SCENARIOS + 1] = { &stock->growth_rates[year] };
+            for (int k = 0; k < stock->num_scenarios; k++) {
+                rates[k + 1] = &stock->scenario_growth[k][year];
+            }
+            for (int k = 0; k <= stock->num_scenarios; k++) {
+                *rates[k] = rule->multiplicative ? *rates[k] * rule->value : *rates[k] + rule->value;
+            }
+        }
+        if (!touched) {
+            fprintf(stderr, "Error: Stress scenario %s rule for %s covers none of %s's forecast years (%d-%d)\n",
+                    stress->names[scenario], rule->target, stock->ticker, stock->years[0],
+                    stock->years[stock->num_years - 1]);
+            return -1;
+        }
+    }
+    return matched;
+}
+
+// The ticker's own line, else the "*" line, else NULL
+const TickerModel *find_ticker_model(const ModelFile *models, const char *ticker) {
+    const TickerModel *fallback = NULL;
+    if (!models) {
+        return NULL;
+    }
+    for (int i = 0; i < models->num_tickers; i++) {
+        if (strcmp(models->tickers[i].ticker, ticker) == 0) {
+            return &models->tickers[i];
+        }
+        if (strcmp(models->tickers[i].ticker, "*") == 0) {
+            fallback = &models->tickers[i];
+        }
+    }
+    return fallback;
+}
+
+ShockDistribution ticker_distribution(const SimulationConfig *config, const char *ticker) {
+    const TickerModel *model = find_ticker_model(config->models, ticker);
+    return model && model->has_distribution ? model->distribution : config->distribution;
+}
+
+GarchParams ticker_garch(const SimulationConfig *config, const char *ticker) {
+    const TickerModel *model = find_ticker_model(config->models, ticker);
+    return model && model->has_garch ? model->garch : config->garch;
+}
+
+JumpParams ticker_jumps(const SimulationConfig *config, const char *ticker) {
+    const TickerModel *model = find_ticker_model(config->models, ticker);
+    return model && model->has_jumps ? model->jumps : config->jumps;
+}
+
+double ticker_persistence(const SimulationConfig *config, const char *ticker) {
+    const TickerModel *model = find_ticker_model(config->models, ticker);
+    return model && model->has_persistence ? model->persistence : config->persistence;
+}
+
+/*
+ * Years are independent Gaussians around one forecast, as the analytic and
+ * likelihood-ratio methods assume. The t copula's per-path mixing variable
+ * makes a path's years dependent even though each stays Gaussian.
+ */
+int stock_is_gaussian(const SimulationConfig *config, const StockData *stock) {
+    const char *ticker = stock->ticker;
+    return ticker_distribution(config, ticker).kind == DIST_NORMAL && ticker_garch(config, ticker).alpha == 0 &&
+           ticker_jumps(config, ticker).intensity == 0 && ticker_persistence(config, ticker) == 0 &&
+           !config->regimes && !config->copula && !find_history_series(config->history, ticker) &&
+           stock->num_scenarios == 0;
+}
+
+// Mean and volatility-adjusted dispersion of the forecast growth rates
+double compute_forecast_std(const StockData *stock, double volatility_factor, double *forecast_mean_out) {
+    double forecast_mean = 0.0;
+    for (int i = 0; i < stock->num_years; i++) {
+        forecast_mean += stock->growth_rates[i];
+    }
+    forecast_mean /= stock->num_years;
+    
+    double forecast_std = 0.0;
+    for (int i = 0; i < stock->num_years; i++) {
+        double diff = stock->growth_rates[i] - forecast_mean;
+        forecast_std += diff * diff;
+    }
+    forecast_std = sqrt(forecast_std / stock->num_years);
+    
+    if (forecast_mean_out) {
+        *forecast_mean_out = forecast_mean;
+    }
+    
+    // Add volatility adjustment
+    return forecast_std * volatility_factor;
+}
+
+/*
+ * Closed-form approximation of the Gaussian-per-year model. The yearly
+ * growth factors 1 + g/100 are independent, so every raw moment of their
+ * product is the product of the per-year raw moments. Quantiles come from
+ * the lognormal matching the first two moments; the error estimate is the
+ * Cornish-Fisher quantile shift at the 1%/99% level implied by the gap
+ * between the exact skewness and the lognormal's.
+ */
+typedef struct {
+    double mean;              // cumulative growth, percent
+    double std_dev;
+    double log_mu;            // lognormal fit of the cumulative growth factor
+    double log_sigma;
+    double error;             // estimated quantile error, percentage points
+    double negative_factor;   // probability some year's growth factor is <= 0
+} AnalyticModel;
+
+void analytic_model_init(AnalyticModel *model, const StockData *stock, double forecast_std) {
+    double v = (forecast_std / 100.0) * (forecast_std / 100.0);
+    double m1 = 1.0, m2 = 1.0, m3 = 1.0;
+    double all_positive = 1.0;
+    
+    for (int year = 0; year < stock->num_years; year++) {
+        double m = 1.0 + stock->growth_rates[year] / 100.0;
+        m1 *= m;
+        m2 *= m * m + v;
+        m3 *= m * m * m + 3.0 * m * v;
+        all_positive *= forecast_std > 0 ? normal_cdf(m / sqrt(v)) : (m > 0 ? 1.0 : 0.0);
+    }
+    
+    double variance = m2 - m1 * m1;
+    if (variance < 0) {
+        variance = 0;
+    }
+    double sd = sqrt(variance);
+    
+    model->mean = (m1 - 1.0) * 100.0;
+    model->std_dev = sd * 100.0;
+    model->negative_factor = 1.0 - all_positive;
+    model->error = 0.0;
+    
+    if (m1 > 0 && sd > 0) {
+        double sigma2 = log(m2 / (m1 * m1));
+        model->log_sigma = sqrt(sigma2);
+        model->log_mu = log(m1) - 0.5 * sigma2;
+        
+        double skew = (m3 - 3.0 * m1 * m2 + 2.0 * m1 * m1 * m1) / (variance * sd);
+        double lognormal_skew = (exp(sigma2) + 2.0) * sqrt(exp(sigma2) - 1.0);
+        double z = normal_quantile(0.99);
+        model->error = fabs(skew - lognormal_skew) * (z * z - 1.0) / 6.0 * model->std_dev;
+    } else {
+        // Degenerate: no dispersion, or a mean factor the lognormal cannot represent
+        model->log_sigma = 0.0;
+        model->log_mu = m1 > 0 ? log(m1) : 0.0;
+        if (sd > 0) {
+            model->error = INFINITY;
+        }
+    }
+}
+
+// Cumulative growth (percent) at probability p
+double analytic_quantile(const AnalyticModel *model, double p) {
+    return (exp(model->log_mu + model->log_sigma * normal_quantile(p)) - 1.0) * 100.0;
+}
+
+// P(cumulative growth <= x percent)
+double analytic_cdf(const AnalyticModel *model, double x) {
+    double factor = 1.0 + x / 100.0;
+    if (factor <= 0) {
+        return 0.0;
+    }
+    double z = log(factor) - model->log_mu;
+    if (model->log_sigma <= 0) {
+        return z >= 0 ? 1.0 : 0.0;
+    }
+    return normal_cdf(z / model->log_sigma);
+}
+
+// Statistics as a run of num_simulations paths would report them
+Statistics analytic_statistics(const AnalyticModel *model, uint64_t num_simulations) {
+    Statistics stats;
+    double extreme = 1.0 / ((double)num_simulations + 1.0);
+    stats.mean = model->mean;
+    stats.std_dev = model->std_dev;
+    stats.min = analytic_quantile(model, extreme);
+    stats.max = analytic_quantile(model, 1.0 - extreme);
+    stats.percentile_5 = analytic_quantile(model, 0.05);
+    stats.percentile_25 = analytic_quantile(model, 0.25);
+    stats.percentile_50 = analytic_quantile(model, 0.50);
+    stats.percentile_75 = analytic_quantile(model, 0.75);
+    stats.percentile_95 = analytic_quantile(model, 0.95);
+    stats.var_95 = -stats.percentile_5;
+    stats.var_99 = -analytic_quantile(model, 0.01);
+    return stats;
+}
+
+// Expected probability counts for num_simulations paths
+ProbabilityCounts analytic_probabilities(const AnalyticModel *model, uint64_t num_simulations) {
+    double n = (double)num_simulations;
+    ProbabilityCounts probs;
+    probs.count = num_simulations;
+    probs.positive = (uint64_t)llround(n * (1.0 - analytic_cdf(model, 0.0)));
+    probs.above_10 = (uint64_t)llround(n * (1.0 - analytic_cdf(model, 10.0)));
+    probs.above_20 = (uint64_t)llround(n * (1.0 - analytic_cdf(model, 20.0)));
+    probs.below_neg10 = (uint64_t)llround(n * analytic_cdf(model, -10.0));
+    return probs;
+}
+
+/*
+ * Everything simulate_path needs for one ticker. With --factors, each
+ * standardized yearly shock is sum(loading_k * f_k) + idiosyncratic * e,
+ * where the factor draws f come from one stream shared by every ticker
+ * and e from the ticker's own stream. With --t-copula the shared stream
+ * also draws one chi-square mixing variable W per path; every shock of the
+ * path is scaled by 1/sqrt(W/dof) and mapped back to a normal score. Each
+ * yearly shock stays N(0, 1), but crashes coincide across tickers (and
+ * cluster across the years of a path). A
+ * portfolio model has no stream of its own and averages its members'
+ * paths over one set of shared draws.
+ */
+typedef struct PathModel {
+    const StockData *stock;
+    double forecast_std;
+    uint32_t key[2];
+    int num_factors;
+    double loadings[MAX_FACTORS];
+    double idiosyncratic;
+    uint32_t factor_key[2];
+    const CopulaTable *copula;
+    const ShockTable *shocks;        // NULL for Gaussian shocks
+    GarchParams garch;
+    const RegimeModel *regimes;
+    uint32_t regime_key[2];
+    uint64_t scenario_offset;        // start of the scenario Weyl sequence
+    double persistence;
+    const double *history;           // the ticker's standardized residuals, NULL without history
+    int history_length;
+    double block_restart;            // 1 / mean block length
+    JumpParams jumps;
+    double jump_cdf[JUMP_MAX_COUNT];   // Poisson CDF of the path's total jump count
+    uint32_t jump_key[2];
+    const struct PathModel *members;
+    int num_members;
+} PathModel;
+
+void path_model_init(PathModel *model, const StockData *stock, double forecast_std, const SimulationConfig *config) {
+    memset(model, 0, sizeof(*model));
+    model->stock = stock;
+    model->forecast_std = forecast_std;
+    model->idiosyncratic = 1.0;
+    rng_stream_key(config->seed, stock->ticker, model->key);
+    
+    if (config->factors) {
+        const double *loadings = find_factor_loadings(config->factors, stock->ticker);
+        double sum_squares = 0.0;
+        model->num_factors = config->factors->num_factors;
+        for (int k = 0; k < model->num_factors; k++) {
+            model->loadings[k] = loadings ? loadings[k] : 0.0;
+            sum_squares += model->loadings[k] * model->loadings[k];
+        }
+        model->idiosyncratic = sqrt(fmax(1.0 - sum_squares, 0.0));
+    }
+    model->copula = config->copula;
+    ShockDistribution distribution = ticker_distribution(config, stock->ticker);
+    model->shocks = shock_table_for(&distribution);
+    model->garch = ticker_garch(config, stock->ticker);
+    model->persistence = ticker_persistence(config, stock->ticker);
+    // Seeded by the run alone, so tickers with equal weights share each path's scenario
+    uint32_t scenario_key[2];
+    rng_stream_key(config->seed, SCENARIO_STREAM_NAME, scenario_key);
+    model->scenario_offset = ((uint64_t)scenario_key[1] << 32) | scenario_key[0];
+    const HistorySeries *series = find_history_series(config->history, stock->ticker);
+    if (series) {
+        model->history = config->history->residuals + series->offset;
+        model->history_length = series->count;
+        model->block_restart = 1.0 / config->block_length;
+    }
+    model->regimes = config->regimes;
+    if (config->regimes) {
+        rng_stream_key(config->seed, REGIME_STREAM_NAME, model->regime_key);
+    }
+    
+    // Jumps draw from their own stream, so the diffusion shocks match a run without them
+    model->jumps = ticker_jumps(config, stock->ticker);
+    if (model->jumps.intensity > 0) {
+        char stream_name[MAX_TICKER_LENGTH + sizeof(JUMP_STREAM_SUFFIX)];
+        snprintf(stream_name, sizeof(stream_name), "%s%s", stock->ticker, JUMP_STREAM_SUFFIX);
+        rng_stream_key(config->seed, stream_name, model->jump_key);
+        double rate = model->jumps.intensity * stock->num_years;
+        double term = exp(-rate), cdf = 0.0;
+        for (int k = 0; k < JUMP_MAX_COUNT; k++) {
+            cdf += term;
+            model->jump_cdf[k] = cdf;
+            term *= rate / (k + 1);
+        }
+    }
+    if (config->factors || config->copula) {
+        rng_stream_key(config->seed, FACTOR_STREAM_NAME, model->factor_key);
+    }
+}
+
+// Equal-weight portfolio of `members`, which must share one forecast period
+void portfolio_model_init(PathModel *model, const StockData *stock, const PathModel *members, int num_members) {
+    memset(model, 0, sizeof(*model));
+    model->stock = stock;
+    model->members = members;
+    model->num_members = num_members;
+    model->num_factors = members[0].num_factors;
+    model->copula = members[0].copula;
+    memcpy(model->factor_key, members[0].factor_key, sizeof(model->factor_key));
+}
+
+/*
+ * The shared draws of one path: num_years * num_factors factor normals
+ * (year-major), then with a copula the path's 1/sqrt(W/dof).
+ */
+static inline void draw_factors(const PathModel *model, uint64_t path, double *shared) {
+    int num_years = model->stock->num_years;
+    PathRng rng;
+    rng_init(&rng, model->factor_key, path);
+    for (int i = 0; i < num_years * model->num_factors; i++) {
+        shared[i] = generate_normal(&rng, 0.0, 1.0);
+    }
+    if (model->copula) {
+        double dof = model->copula->dof;
+        shared[num_years * model->num_factors] = 1.0 / sqrt(2.0 * generate_gamma(&rng, 0.5 * dof) / dof);
+    }
+}
+
+/*
+ * Regime of every year of `path`. The stream is keyed by
+ * REGIME_STREAM_NAME, not the ticker, so all tickers share the path's
+ * macro history. Each step is one uniform compared against the row's
+ * cumulative probabilities; the comparisons are summed, not branched on.
+ */
+static inline void draw_regimes(const RegimeModel *regimes, const uint32_t key[2], uint64_t path,
+                                int num_years, int *states) {
+    PathRng rng;
+    rng_init(&rng, key, path);
+    int last = regimes->num_regimes - 1;
+    const double *cumulative = regimes->initial_cumulative;
+    for (int year = 0; year < num_years; year++) {
+        double u = rng_uniform(&rng);
+        int state = 0;
+        for (int k = 0; k < last; k++) {
+            state += u >= cumulative[k];
+        }
+        states[year] = state;
+        cumulative = regimes->cumulative[state];
+    }
+}
+
+/*
+ * Scenario of path `path` under a scenario mixture. The golden-ratio
+ * Weyl sequence x_i = offset + i 2^64 / phi spreads every run of
+ * consecutive paths evenly over [0, 1), so each scenario receives its
+ * weight's share of paths up to O(log n), in any prefix or shard.
+ */
+static inline int path_scenario(const PathModel *model, uint64_t path) {
+    const StockData *stock = model->stock;
+    uint64_t x = model->scenario_offset + path * 0x9E3779B97F4A7C15ULL;
+    double u = (double)(x >> 11) * (1.0 / 9007199254740992.0);
+    int scenario = 0;
+    for (int k = 0; k < stock->num_scenarios - 1; k++) {
+        scenario += u >= stock->scenario_cumulative[k];
+    }
+    return scenario;
+}
+
+static inline const double *path_growth_rates(const PathModel *model, uint64_t path) {
+    const StockData *stock = model->stock;
+    return stock->num_scenarios > 0 ? stock->scenario_growth[path_scenario(model, path)] : stock->growth_rates;
+}
+
+/*
+ * Stationary block bootstrap (Politis-Romano) of the ticker's residuals:
+ * each year starts a new block at a uniform index with probability 1/L
+ * and otherwise continues with the next residual, wrapping around, so
+ * blocks have geometric length with mean L. One uniform decides both:
+ * below 1/L, u L is itself uniform and picks the start.
+ */
+static inline void draw_block_bootstrap(const PathModel *model, PathRng *rng, double *shocks) {
+    int length = model->history_length;
+    double restart = model->block_restart;
+    int index = 0;
+    for (int year = 0; year < model->stock->num_years; year++) {
+        double u = rng_uniform(rng);
+        if (year == 0 || u < restart) {
+            double position = year == 0 ? u : u / restart;
+            index = (int)(position * length);
+            index = index < length ? index : length - 1;
+        } else {
+            index = index + 1 < length ? index + 1 : 0;
+        }
+        shocks[year] = model->history[index];
+    }
+}
+
+/*
+ * Compensated jump total of every year of `path`: the year's jumps minus
+ * lambda mu, so jumps add risk without moving the mean growth. Jumps of a
+ * Poisson process fall in each year uniformly, so the path's total count
+ * N ~ Poisson(lambda Y) is drawn by one inversion of the precomputed CDF
+ * and each jump then lands in a uniform year with a N(mu, sigma) size. At
+ * low intensity most paths stop after that single uniform.
+ */
+static inline void draw_jumps(const PathModel *model, uint64_t path, double *jumps) {
+    const JumpParams *params = &model->jumps;
+    int num_years = model->stock->num_years;
+    for (int year = 0; year < num_years; year++) {
+        jumps[year] = -params->intensity * params->mean;
+    }
+    
+    PathRng rng;
+    rng_init(&rng, model->jump_key, path);
+    double u = rng_uniform(&rng);
+    if (u < model->jump_cdf[0]) {
+        return;
+    }
+    int count = 1;
+    while (count < JUMP_MAX_COUNT - 1 && u >= model->jump_cdf[count]) {
+        count++;
+    }
+    for (int j = 0; j < count; j++) {
+        int year = (int)(rng_uniform(&rng) * num_years);
+        jumps[year < num_years ? year : num_years - 1] += params->mean + params->std_dev * generate_normal(&rng, 0.0, 1.0);
+    }
+}
+
+/*
+ * Growth pass shared by the shock-based kernels: scale each standardized
+ * shock by the year's volatility and compound. Under GARCH(1,1) the
+ * variance h starts at its long-run level s^2 and, after each deviation
+ * e, becomes s^2 (1 - alpha - beta) + alpha e^2 + beta h, so a bad year
+ * widens the next one. The state is one local per path. Regimes shift the
+ * year's growth and scale its deviation, and jumps add to the shift;
+ * without them the shift is 0 and the scale 1, which leaves every result
+ * bit-identical. With persistence phi the shocks first pass through
+ * d = phi d' + sqrt(1 - phi^2) x, which keeps each year's variance at 1.
+ */
+static inline double compound_shocks(const PathModel *model, uint64_t path, const double *shocks, double *annual) {
+    const StockData *stock = model->stock;
+    const double *growth = path_growth_rates(model, path);
+    double shift[MAX_YEARS], scale[MAX_YEARS];
+    double cumulative_growth = 1.0;
+    
+    double persistent[MAX_YEARS];
+    if (model->persistence != 0) {
+        double phi = model->persistence, innovation = sqrt(1.0 - phi * phi);
+        double deviation = shocks[0];
+        persistent[0] = deviation;
+        for (int year = 1; year < stock->num_years; year++) {
+            deviation = phi * deviation + innovation * shocks[year];
+            persistent[year] = deviation;
+        }
+        shocks = persistent;
+    }
+    
+    if (model->regimes) {
+        int states[MAX_YEARS];
+        draw_regimes(model->regimes, model->regime_key, path, stock->num_years, states);
+        for (int year = 0; year < stock->num_years; year++) {
+            shift[year] = model->regimes->shift[states[year]];
+            scale[year] = model->regimes->scale[states[year]];
+        }
+    } else {
+        for (int year = 0; year < stock->num_years; year++) {
+            shift[year] = 0.0;
+            scale[year] = 1.0;
+        }
+    }
+    if (model->jumps.intensity > 0) {
+        double jumps[MAX_YEARS];
+        draw_jumps(model, path, jumps);
+        for (int year = 0; year < stock->num_years; year++) {
+            shift[year] += jumps[year];
+        }
+    }
+    
+    if (model->garch.alpha > 0) {
+        double alpha = model->garch.alpha, beta = model->garch.beta;
+        double long_run = model->forecast_std * model->forecast_std;
+        double omega = long_run * (1.0 - alpha - beta);
+        double variance = long_run;
+        for (int year = 0; year < stock->num_years; year++) {
+            double deviation = sqrt(variance) * shocks[year];
+            annual[year] = growth[year] + shift[year] + scale[year] * deviation;
+            cumulative_growth *= (1.0 + annual[year] / 100.0);
+            variance = omega + alpha * deviation * deviation + beta * variance;
+        }
+    } else {
+        for (int year = 0; year < stock->num_years; year++) {
+            annual[year] = growth[year] + shift[year] + scale[year] * model->forecast_std * shocks[year];
+            cumulative_growth *= (1.0 + annual[year] / 100.0);
+        }
+    }
+    return (cumulative_growth - 1.0) * 100.0;
+}
+
+static inline double simulate_factor_path(const PathModel *model, uint64_t path, const double *shared, double *annual) {
+    const StockData *stock = model->stock;
+    int num_years = stock->num_years;
+    double shocks[MAX_YEARS];
+    PathRng rng;
+    rng_init(&rng, model->key, path);
+    
+    if (model->history) {
+        // Only reached in a regimes-only portfolio; --history excludes factors and the copula
+        draw_block_bootstrap(model, &rng, shocks);
+        return compound_shocks(model, path, shocks, annual);
+    }
+    for (int year = 0; year < num_years; year++) {
+        double shock = model->idiosyncratic * generate_normal(&rng, 0.0, 1.0);
+        for (int k = 0; k < model->num_factors; k++) {
+            shock += model->loadings[k] * shared[year * model->num_factors + k];
+        }
+        shocks[year] = shock;
+    }
+    
+    // Copula and marginal mappings in their own passes over the year block
+    if (model->copula) {
+        double mixing = shared[num_years * model->num_factors];
+        for (int year = 0; year < num_years; year++) {
+            shocks[year] = copula_score(model->copula, shocks[year] * mixing);
+        }
+    }
+    if (model->shocks) {
+        for (int year = 0; year < num_years; year++) {
+            shocks[year] = shock_value(model->shocks, shocks[year]);
+        }
+    }
+    
+    return compound_shocks(model, path, shocks, annual);
+}
+
+/*
+ * Equal-weight buy-and-hold mix: the members' cumulative values are
+ * averaged at every year end and annual[] is the year-over-year change of
+ * that average, so path metrics compound to the reported final value.
+ */
+static double simulate_portfolio_path(const PathModel *model, uint64_t path, double *annual) {
+    double factors[MAX_YEARS * MAX_FACTORS + 1];
+    double member_annual[MAX_YEARS];
+    double value[MAX_YEARS] = { 0 };
+    int num_years = model->stock->num_years;
+    double final_value = 0.0;
+    
+    draw_factors(model, path, factors);
+    for (int m = 0; m < model->num_members; m++) {
+        final_value += simulate_factor_path(&model->members[m], path, factors, member_annual);
+        double level = 1.0;
+        for (int year = 0; year < num_years; year++) {
+            level *= 1.0 + member_annual[year] / 100.0;
+            value[year] += level;
+        }
+    }
+    double previous = 1.0;
+    for (int year = 0; year < num_years; year++) {
+        value[year] /= model->num_members;
+        annual[year] = previous != 0.0 ? (value[year] / previous - 1.0) * 100.0 : 0.0;
+        previous = value[year];
+    }
+    return final_value / model->num_members;
+}
+
+// Simulate path number `path`; fills annual[] and returns the final value in percent
+static inline double simulate_path(const PathModel *model, uint64_t path, double *annual) {
+    if (model->num_members > 0) {
+        return simulate_portfolio_path(model, path, annual);
+    }
+    if (model->num_factors > 0 || model->copula) {
+        double factors[MAX_YEARS * MAX_FACTORS + 1];
+        draw_factors(model, path, factors);
+        return simulate_factor_path(model, path, factors, annual);
+    }
+    
+    const StockData *stock = model->stock;
+    PathRng rng;
+    rng_init(&rng, model->key, path);
+    
+    if (model->history) {
+        double shocks[MAX_YEARS];
+        draw_block_bootstrap(model, &rng, shocks);
+        return compound_shocks(model, path, shocks, annual);
+    }
+    if (model->shocks || model->garch.alpha > 0 || model->regimes || model->jumps.intensity > 0 ||
+        model->persistence != 0) {
+        double shocks[MAX_YEARS];
+        sample_shocks(model->shocks, &rng, shocks, stock->num_years);
+        return compound_shocks(model, path, shocks, annual);
+    }
+    
+    const double *growth = path_growth_rates(model, path);
+    double cumulative_growth = 1.0;
+    for (int year = 0; year < stock->num_years; year++) {
+        // Use forecasted growth as mean with added uncertainty
+        double simulated_growth = generate_normal(&rng, growth[year], model->forecast_std);
+        annual[year] = simulated_growth;
+        cumulative_growth *= (1.0 + simulated_growth / 100.0);
+    }
+    
+    // Final value as percentage change from initial
+    return (cumulative_growth - 1.0) * 100.0;
+}
+
+/*
+ * simulate_path with every yearly shock shifted down by `tilt` standard
+ * deviations. Stores the path's likelihood ratio against the untilted
+ * model, exp(sum(tilt * z - tilt^2 / 2)) over the unshifted draws z.
+ */
+static inline double simulate_tilted_path(const PathModel *model, uint64_t path, double tilt, double *weight) {
+    const StockData *stock = model->stock;
+    double annual[MAX_YEARS];
+    simulate_path(model, path, annual);
+    
+    double cumulative_growth = 1.0;
+    double sum_z = 0.0;
+    for (int year = 0; year < stock->num_years; year++) {
+        sum_z += (annual[year] - stock->growth_rates[year]) / model->forecast_std;
+        cumulative_growth *= 1.0 + (annual[year] - model->forecast_std * tilt) / 100.0;
+    }
+    
+    *weight = exp(tilt * sum_z - 0.5 * tilt * tilt * stock->num_years);
+    return (cumulative_growth - 1.0) * 100.0;
+}
+
+/*
+ * Simulate paths [begin, end) into `total`. Paths are grouped into
+ * STREAM_CHUNK_PATHS chunks counted from `begin`; chunk accumulators are
+ * filled in parallel and merged in chunk order, so the result does not
+ * depend on the thread count. `round_done`, if given, runs after every
+ * merged round with the next unsimulated path; returning 0 aborts.
+ */
+typedef int (*RoundCallback)(void *context, uint64_t next_path, const PathAccumulator *total);
+
+int simulate_range(const PathModel *model, uint64_t begin, uint64_t end, PathAccumulator *total,
+                   const SimulationConfig *config, RoundCallback round_done, void *context) {
+    int num_threads = config->num_threads > 0 ? config->num_threads : 1;
+    PathAccumulator *chunks = calloc(num_threads, sizeof(PathAccumulator));
+    if (!chunks) {
+        fprintf(stderr, "Error: Memory allocation failed for chunk accumulators\n");
+        return 0;
+    }
+    
+    int ok = 1;
+    for (int t = 0; t < num_threads && ok; t++) {
+        ok = accumulator_init(&chunks[t], total->num_years, total->year_sketches != NULL,
+                              total->path_risk ? &total->path_risk->barriers : NULL, total->fan_sketches != NULL);
+    }
+    
+    uint64_t num_chunks = (end - begin + STREAM_CHUNK_PATHS - 1) / STREAM_CHUNK_PATHS;
+    for (uint64_t round = 0; ok && round < num_chunks; round += num_threads) {
+        int in_round = (int)(num_chunks - round < (uint64_t)num_threads ? num_chunks - round : (uint64_t)num_threads);
+        
+        #pragma omp parallel for num_threads(num_threads) schedule(static, 1) if(num_threads > 1)
+        for (int c = 0; c < in_round; c++) {
+            PathAccumulator *acc = &chunks[c];
+            uint64_t lo = begin + (round + c) * STREAM_CHUNK_PATHS;
+            uint64_t hi = lo + STREAM_CHUNK_PATHS < end ? lo + STREAM_CHUNK_PATHS : end;
+            double annual[MAX_YEARS];
+            
+            accumulator_reset(acc);
+            for (uint64_t path = lo; path < hi; path++) {
+                double final_value = simulate_path(model, path, annual);
+                accumulator_add_path(acc, final_value, annual);
+            }
+        }
+        
+        for (int c = 0; c < in_round; c++) {
+            // Full chunks double as the batches for batch-means standard errors
+            if (chunks[c].moments.count == STREAM_CHUNK_PATHS) {
+                Statistics batch = accumulator_statistics(&chunks[c]);
+                batch_record(chunks[c].batches, &batch);
+            }
+            accumulator_merge(total, &chunks[c]);
+        }
+        
+        if (round_done) {
+            uint64_t next_path = begin + (round + in_round) * STREAM_CHUNK_PATHS;
+            ok = round_done(context, next_path < end ? next_path : end, total);
+        }
+        
+        if (config->verbose) {
+            printf("\rRunning simulations for %s: %d%%", model->stock->ticker,
+                   (int)(((round + in_round) * 100) / num_chunks));
+            fflush(stdout);
+        }
+    }
+    
+    if (config->verbose) {
+        printf("\n");
+    }
+    
+    for (int t = 0; t < num_threads; t++) {
+        accumulator_free(&chunks[t]);
+    }
+    free(chunks);
+    return ok;
+}
+
+void write_ticker_header(FILE *output, const StockData *stock, uint64_t num_simulations,
+                         double forecast_mean, double forecast_std, const SimulationConfig *config) {
+    fprintf(output, "\n====================================================================================\n");
+    fprintf(output, "MONTE CARLO SIMULATION RESULTS FOR %s\n", stock->ticker);
+    fprintf(output, "====================================================================================\n");
+    fprintf(output, "Number of Simulations: %llu\n", (unsigned long long)num_simulations);
+    fprintf(output, "Forecast Period: %d-%d (%d years)\n", 
+            stock->years[0], stock->years[stock->num_years-1], stock->num_years);
+    fprintf(output, "Base Forecast Mean Growth: %.2f%%\n", forecast_mean);
+    fprintf(output, "Adjusted Standard Deviation: %.2f%%\n", forecast_std);
+    ShockDistribution distribution = ticker_distribution(config, stock->ticker);
+    const HistorySeries *series = find_history_series(config->history, stock->ticker);
+    if (series) {
+        fprintf(output, "Shock Model: stationary block bootstrap of %d historical residuals (mean block %.1f years)\n",
+                series->count, config->block_length);
+    } else if (distribution.kind != DIST_NORMAL) {
+        char description[128];
+        describe_distribution(&distribution, description, sizeof(description));
+        fprintf(output, "Shock Distribution: %s\n", description);
+    }
+    GarchParams garch = ticker_garch(config, stock->ticker);
+    if (garch.alpha > 0) {
+        fprintf(output, "Volatility Model: GARCH(1,1), alpha %.3f, beta %.3f (persistence %.3f)\n",
+                garch.alpha, garch.beta, garch.alpha + garch.beta);
+    }
+    double persistence = ticker_persistence(config, stock->ticker);
+    if (persistence != 0) {
+        fprintf(output, "Deviation Persistence: AR(1), phi %.3f\n", persistence);
+    }
+    JumpParams jumps = ticker_jumps(config, stock->ticker);
+    if (jumps.intensity > 0) {
+        fprintf(output, "Jump Model: %.3g jumps/year of %.2f%% +/- %.2f%% (compensated), P(any jump) %.1f%%\n",
+                jumps.intensity, jumps.mean, jumps.std_dev, (1.0 - exp(-jumps.intensity * stock->num_years)) * 100.0);
+    }
+    if (config->regimes) {
+        fprintf(output, "Regime Model: %d-state Markov chain (", config->regimes->num_regimes);
+        for (int r = 0; r < config->regimes->num_regimes; r++) {
+            fprintf(output, "%s%s", r ? ", " : "", config->regimes->names[r]);
+        }
+        fprintf(output, ")\n");
+    }
+    fprintf(output, "Volatility Factor Applied: %.1fx\n\n", config->volatility_factor);
+}
+
+// End a statistics line, with its standard error when there is one
+static void end_statistic(FILE *output, double error) {
+    if (!isnan(error)) {
+        fprintf(output, "  (SE %.2f)", error);
+    }
+    fprintf(output, "\n");
+}
+
+/*
+ * batches, if given, adds batch-means standard errors to the estimated
+ * statistics (extremes have none) and binomial ones to the probabilities.
+ */
+void write_ticker_statistics(FILE *output, const Statistics *stats, const ProbabilityCounts *probs, unsigned metrics,
+                             const RunningMoments *batches) {
+    // Streamed runs batch by full chunks, so a short one may have too few for any SE
+    int have_errors = batches && batches[BATCH_MEAN].count > 1;
+    double errors[BATCH_STATS];
+    for (int i = 0; i < BATCH_STATS; i++) {
+        errors[i] = have_errors ? batch_error(batches, i) : NAN;
+    }
+    if (batches && !have_errors && !(metrics & METRIC_SUMMARY)) {
+        fprintf(output, "SE unavailable: fewer than 2 full chunks of %d paths\n", STREAM_CHUNK_PATHS);
+    }
+    
+    if (metrics & METRIC_SUMMARY) {
+        fprintf(output, "SIMULATION SUMMARY STATISTICS:\n");
+        fprintf(output, "------------------------------\n");
+        if (have_errors) {
+            fprintf(output, "Standard errors (SE) from %llu batches of paths\n", (unsigned long long)batches[BATCH_MEAN].count);
+        } else if (batches) {
+            fprintf(output, "SE unavailable: fewer than 2 full chunks of %d paths\n", STREAM_CHUNK_PATHS);
+        }
+        if (metrics & METRIC_MEAN) {
+            fprintf(output, "Mean Cumulative Growth:     %8.2f%%", stats->mean);
+            end_statistic(output, errors[BATCH_MEAN]);
+        }
+        if (metrics & METRIC_STD_DEV) {
+            fprintf(output, "Standard Deviation:         %8.2f%%", stats->std_dev);
+            end_statistic(output, errors[BATCH_STD_DEV]);
+        }
+        if (metrics & METRIC_MIN) fprintf(output, "Minimum Growth:             %8.2f%%\n", stats->min);
+        if (metrics & METRIC_MAX) fprintf(output, "Maximum Growth:             %8.2f%%\n", stats->max);
+    }
+    if (metrics & METRIC_PERCENTILES) {
+        fprintf(output, "\nPERCENTILE ANALYSIS:\n");
+        fprintf(output, "--------------------\n");
+        if (metrics & METRIC_P5) {
+            fprintf(output, "5th Percentile (Worst 5%%):  %8.2f%%", stats->percentile_5);
+            end_statistic(output, errors[BATCH_P5]);
+        }
+        if (metrics & METRIC_P25) {
+            fprintf(output, "25th Percentile:            %8.2f%%", stats->percentile_25);
+            end_statistic(output, errors[BATCH_P25]);
+        }
+        if (metrics & METRIC_P50) {
+            fprintf(output, "50th Percentile (Median):   %8.2f%%", stats->percentile_50);
+            end_statistic(output, errors[BATCH_P50]);
+        }
+        if (metrics & METRIC_P75) {
+            fprintf(output, "75th Percentile:            %8.2f%%", stats->percentile_75);
+            end_statistic(output, errors[BATCH_P75]);
+        }
+        if (metrics & METRIC_P95) {
+            fprintf(output, "95th Percentile (Best 5%%):  %8.2f%%", stats->percentile_95);
+            end_statistic(output, errors[BATCH_P95]);
+        }
+    }
+    
+    if (metrics & METRIC_RISK) {
+        fprintf(output, "\nRISK METRICS:\n");
+        fprintf(output, "-------------\n");
+        if (metrics & METRIC_VAR_95) {
+            fprintf(output, "Value at Risk (95%% confidence): %8.2f%%", stats->var_95);
+            end_statistic(output, errors[BATCH_P5]);
+        }
+        if (metrics & METRIC_VAR_99) {
+            fprintf(output, "Value at Risk (99%% confidence): %8.2f%%", stats->var_99);
+            end_statistic(output, errors[BATCH_P1]);
+        }
+    }
+    
+    if (metrics & METRIC_PROBABILITIES) {
+        double n = (double)probs->count;
+        uint64_t counts[4] = { probs->positive, probs->above_10, probs->above_20, probs->below_neg10 };
+        const char *labels[4] = { "Probability of Positive Growth:  ", "Probability of >10% Growth:      ",
+                                  "Probability of >20% Growth:      ", "Probability of <-10% Loss:       " };
+        fprintf(output, "\nPROBABILITY ANALYSIS:\n");
+        fprintf(output, "---------------------\n");
+        for (int i = 0; i < 4; i++) {
+            double p = counts[i] / n;
+            fprintf(output, "%s%6.2f%%", labels[i], p * 100.0);
+            end_statistic(output, have_errors ? sqrt(p * (1.0 - p) / n) * 100.0 : NAN);
+        }
+    }
+}
+
+// Pearson correlation of two equally long samples
+double sample_correlation(const double *x, const double *y, int n) {
+    double mean_x = 0.0, mean_y = 0.0;
+    for (int i = 0; i < n; i++) {
+        mean_x += x[i];
+        mean_y += y[i];
+    }
+    mean_x /= n;
+    mean_y /= n;
+    double sxy = 0.0, sxx = 0.0, syy = 0.0;
+    for (int i = 0; i < n; i++) {
+        sxy += (x[i] - mean_x) * (y[i] - mean_y);
+        sxx += (x[i] - mean_x) * (x[i] - mean_x);
+        syy += (y[i] - mean_y) * (y[i] - mean_y);
+    }
+    return sxx > 0 && syy > 0 ? sxy / sqrt(sxx * syy) : NAN;
+}
+
+void write_year_statistics(FILE *output, const StockData *stock, int year, const Statistics *year_stats) {
+    fprintf(output, "Year %d (Forecast: %.2f%%):\n", stock->years[year], stock->growth_rates[year]);
+    fprintf(output, "  Simulated Mean: %7.2f%% | Std Dev: %6.2f%%\n", year_stats->mean, year_stats->std_dev);
+    fprintf(output, "  Range: %7.2f%% to %7.2f%% | Median: %7.2f%%\n", 
+            year_stats->min, year_stats->max, year_stats->percentile_50);
+}
+
+/*
+ * Model diagnostics for one year, printed only for tickers that are not
+ * plain independent Gaussian years. Under GARCH: simulated and robust
+ * (IQR / 1.349) deviation as multiples of the base deviation, against the
+ * kurtosis the recursion implies; clustering fattens the year's tails, so
+ * the robust deviation falls below the simulated one as kurtosis grows.
+ * From the second year on: the realized correlation with the previous
+ * year across paths, against the AR(1) phi when one is set.
+ */
+void write_year_diagnostics(FILE *output, const StockData *stock, int year, const Statistics *year_stats,
+                            double lag_correlation, double forecast_std, const SimulationConfig *config) {
+    if (stock_is_gaussian(config, stock)) {
+        return;
+    }
+    GarchParams garch = ticker_garch(config, stock->ticker);
+    if (garch.alpha > 0 && forecast_std > 0) {
+        ShockDistribution distribution = ticker_distribution(config, stock->ticker);
+        double kurtosis = garch_year_kurtosis(&garch, shock_kurtosis(shock_table_for(&distribution)), year);
+        double robust = (year_stats->percentile_75 - year_stats->percentile_25) / 1.349;
+        fprintf(output, "  Dispersion: %.2fx base | Robust: %.2fx base | Model Kurtosis: %.2f\n",
+                year_stats->std_dev / forecast_std, robust / forecast_std, kurtosis);
+    }
+    if (!isnan(lag_correlation)) {
+        double persistence = ticker_persistence(config, stock->ticker);
+        fprintf(output, "  Lag-1 Autocorrelation: %6.3f", lag_correlation);
+        if (persistence != 0) {
+            fprintf(output, " (model %.3f)", persistence);
+        }
+        fprintf(output, "\n");
+    }
+}
+
+/*
+ * Scenario mixture breakdown from the simulated final values in path
+ * order: each path's scenario is recomputed from its index, so the
+ * conditional statistics come from the same single pass and need no
+ * extra sort; quantiles are read from one sketch per scenario.
+ */
+void write_scenario_analysis(FILE *output, const PathModel *model, const double *final_values, int n) {
+    const StockData *stock = model->stock;
+    if (stock->num_scenarios == 0 || n <= 0) {
+        return;
+    }
+    RunningMoments moments[MAX_SCENARIOS];
+    uint64_t losses[MAX_SCENARIOS] = { 0 };
+    QuantileSketch *sketches = malloc((size_t)stock->num_scenarios * sizeof(QuantileSketch));
+    if (!sketches) {
+        fprintf(stderr, "Error: Memory allocation failed for scenario sketches\n");
+        return;
+    }
+    for (int k = 0; k < stock->num_scenarios; k++) {
+        moments_init(&moments[k]);
+        sketch_init(&sketches[k]);
+    }
+    for (int i = 0; i < n; i++) {
+        int k = path_scenario(model, (uint64_t)i);
+        moments_add(&moments[k], final_values[i]);
+        sketch_add(&sketches[k], final_values[i]);
+        losses[k] += final_values[i] < 0;
+    }
+    
+    fprintf(output, "SCENARIO MIXTURE (paths stratified by weight):\n");
+    fprintf(output, "----------------------------------------------\n");
+    fprintf(output, "%-14s%8s %9s %9s %9s %9s %9s %9s %9s\n", "Scenario", "Weight", "Paths", "Mean", "Std Dev",
+            "5th Pct", "Median", "95th Pct", "P(Loss)");
+    for (int k = 0; k < stock->num_scenarios; k++) {
+        uint64_t count = moments[k].count;
+        if (count == 0) {
+            fprintf(output, "%-14s%7.1f%% %9d\n", stock->scenario_names[k], stock->scenario_weights[k] * 100.0, 0);
+            continue;
+        }
+        fprintf(output, "%-14s%7.1f%% %9llu %8.2f%% %8.2f%% %8.2f%% %8.2f%% %8.2f%% %8.2f%%\n",
+                stock->scenario_names[k], stock->scenario_weights[k] * 100.0, (unsigned long long)count,
+                moments[k].mean, moments_std_dev(&moments[k]),
+                sketch_value_at_rank(&sketches[k], (uint64_t)(0.05 * count)),
+                sketch_value_at_rank(&sketches[k], (uint64_t)(0.50 * count)),
+                sketch_value_at_rank(&sketches[k], (uint64_t)(0.95 * count)),
+                losses[k] * 100.0 / count);
+    }
+    fprintf(output, "\n");
+    free(sketches);
+}
+
+/*
+ * Regime occupancy over the ticker's paths, from the same counter-based
+ * regime stream the simulation drew: the share of paths with at least one
+ * year in each regime and the average number of years spent there.
+ */
+void write_regime_occupancy(FILE *output, const StockData *stock, uint64_t num_paths, const SimulationConfig *config) {
+    const RegimeModel *regimes = config->regimes;
+    if (!regimes || num_paths == 0) {
+        return;
+    }
+    uint32_t key[2];
+    rng_stream_key(config->seed, REGIME_STREAM_NAME, key);
+    uint64_t visited[MAX_REGIMES] = { 0 }, years[MAX_REGIMES] = { 0 };
+    
+    #pragma omp parallel num_threads(config->num_threads) if(config->num_threads > 1)
+    {
+        uint64_t local_visited[MAX_REGIMES] = { 0 }, local_years[MAX_REGIMES] = { 0 };
+        #pragma omp for
+        for (int64_t path = 0; path < (int64_t)num_paths; path++) {
+            int states[MAX_YEARS];
+            int seen[MAX_REGIMES] = { 0 };
+            draw_regimes(regimes, key, (uint64_t)path, stock->num_years, states);
+            for (int year = 0; year < stock->num_years; year++) {
+                local_years[states[year]]++;
+                seen[states[year]] = 1;
+            }
+            for (int r = 0; r < regimes->num_regimes; r++) {
+                local_visited[r] += seen[r];
+            }
+        }
+        #pragma omp critical
+        for (int r = 0; r < regimes->num_regimes; r++) {
+            visited[r] += local_visited[r];
+            years[r] += local_years[r];
+        }
+    }
+    
+    fprintf(output, "\nREGIME OCCUPANCY:\n");
+    fprintf(output, "-----------------\n");
+    fprintf(output, "%-16s%8s  %6s  %10s  %14s  %9s\n", "Regime", "Shift", "Scale", "First Year", "Paths Visiting", "Avg Years");
+    for (int r = 0; r < regimes->num_regimes; r++) {
+        fprintf(output, "%-16s%7.2f%%  %5.2fx  %9.2f%%  %13.2f%%  %9.2f\n", regimes->names[r],
+                regimes->shift[r], regimes->scale[r], regimes->initial[r] * 100.0,
+                visited[r] * 100.0 / num_paths, (double)years[r] / num_paths);
+    }
+}
+
+/*
+ * Path-dependent risk: drawdown distribution, time spent below the start
+ * and, per barrier, the cumulative share of paths that have ended a year
+ * at or below it; the last row is the probability of ever falling below.
+ */
+void write_path_risk(FILE *output, const StockData *stock, const PathRisk *risk) {
+    uint64_t n = risk->drawdown.count;
+    if (n == 0) {
+        return;
+    }
+    
+    fprintf(output, "\nPATH-DEPENDENT RISK:\n");
+    fprintf(output, "--------------------\n");
+    fprintf(output, "Maximum Drawdown:   Mean %6.2f%% | Median %6.2f%% | 95th Pct %6.2f%% | Worst %6.2f%%\n",
+            risk->drawdown.mean, sketch_value_at_rank(&risk->drawdown_sketch, (uint64_t)(0.50 * n)),
+            sketch_value_at_rank(&risk->drawdown_sketch, (uint64_t)(0.95 * n)), risk->drawdown.max);
+    fprintf(output, "Years Below Start:  Mean %.2f of %d | Paths Ever Below: %6.2f%%\n",
+            risk->years_below.mean, stock->num_years, risk->ever_below * 100.0 / n);
+    if (risk->barriers.count == 0) {
+        return;
+    }
+    
+    fprintf(output, "First Passage (share of paths at or below each level by year end):\n");
+    fprintf(output, "%-8s", "Year");
+    for (int b = 0; b < risk->barriers.count; b++) {
+        fprintf(output, "  %7.1f%%", risk->barriers.levels[b]);
+    }
+    fprintf(output, "\n");
+    uint64_t passed[MAX_BARRIERS] = { 0 };
+    for (int year = 0; year < stock->num_years; year++) {
+        fprintf(output, "%-8d", stock->years[year]);
+        for (int b = 0; b < risk->barriers.count; b++) {
+            passed[b] += risk->first_passage[b][year];
+            fprintf(output, "  %7.2f%%", passed[b] * 100.0 / n);
+        }
+        fprintf(output, "\n");
+    }
+}
+
+// Axis step of 1, 2 or 5 times a power of ten giving about `ticks` intervals over `range`
+static double axis_step(double range, int ticks) {
+    double raw = range / ticks;
+    double magnitude = pow(10.0, floor(log10(raw)));
+    double fraction = raw / magnitude;
+    return (fraction <= 1.0 ? 1.0 : fraction <= 2.0 ? 2.0 : fraction <= 5.0 ? 5.0 : 10.0) * magnitude;
+}
+
+// Write text with the XML special characters escaped
+static void write_xml_text(FILE *file, const char *text) {
+    for (; *text; text++) {
+        switch (*text) {
+            case '&': fputs("&amp;", file); break;
+            case '<': fputs("&lt;", file); break;
+            case '>': fputs("&gt;", file); break;
+            case '"': fputs("&quot;", file); break;
+            case '\'': fputs("&apos;", file); break;
+            default: fputc(*text, file); break;
+        }
+    }
+}
+
+/*
+ * Draw the fan chart as a standalone SVG, <TICKER>_fan_chart.svg in the
+ * working directory: the 5-95 and 25-75 percentile bands as nested
+ * polygons and the median as a line, over a gridded percent axis.
+ */
+void write_fan_svg(const StockData *stock, const double bands[][FAN_BANDS]) {
+    // The ticker becomes a file name in the working directory: keep only safe characters
+    char safe_ticker[MAX_TICKER_LENGTH];
+    size_t length = 0;
+    for (; stock->ticker[length] && length + 1 < sizeof(safe_ticker); length++) {
+        char c = stock->ticker[length];
+        safe_ticker[length] = isalnum((unsigned char)c) || c == '-' || (c == '.' && length > 0) ? c : '_';
+    }
+    safe_ticker[length] = '\0';
+    
+    char svg_filename[MAX_LINE_LENGTH + 50];
+    snprintf(svg_filename, sizeof(svg_filename), "%s_%s.svg", safe_ticker, "fan_chart");
+    
+    FILE *svg = fopen(svg_filename, "w");
+    if (!svg) {
+        fprintf(stderr, "Error: Could not create SVG file %s\n", svg_filename);
+        return;
+    }
+    
+    const double left = 70.0, right = 30.0, top = 50.0, bottom = 50.0;
+    double plot_width = FAN_SVG_WIDTH - left - right, plot_height = FAN_SVG_HEIGHT - top - bottom;
+    int num_years = stock->num_years;
+    
+    double lo = 0.0, hi = 0.0;
+    for (int year = 0; year < num_years; year++) {
+        lo = bands[year][0] < lo ? bands[year][0] : lo;
+        hi = bands[year][FAN_BANDS - 1] > hi ? bands[year][FAN_BANDS - 1] : hi;
+    }
+    double step = axis_step(hi - lo > 0 ? hi - lo : 1.0, 6);
+    lo = floor(lo / step) * step;
+    hi = ceil(hi / step) * step;
+    if (hi <= lo) {
+        hi = lo + step;
+    }
+    int decimals = step < 1.0 ? 1 : 0;
+    double scale = plot_height / (hi - lo);
+    
+    // Point 0 is the start of the first forecast year, where every band is at 0%
+    double x[MAX_YEARS + 1], y[FAN_BANDS][MAX_YEARS + 1];
+    for (int i = 0; i <= num_years; i++) {
+        x[i] = left + plot_width * i / num_years;
+        for (int b = 0; b < FAN_BANDS; b++) {
+            y[b][i] = top + (hi - (i > 0 ? bands[i - 1][b] : 0.0)) * scale;
+        }
+    }
+    
+    fprintf(svg, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+    fprintf(svg, "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%d\" height=\"%d\" viewBox=\"0 0 %d %d\" "
+            "font-family=\"sans-serif\" font-size=\"12\">\n", FAN_SVG_WIDTH, FAN_SVG_HEIGHT, FAN_SVG_WIDTH, FAN_SVG_HEIGHT);
+    fprintf(svg, "<rect width=\"100%%\" height=\"100%%\" fill=\"white\"/>\n");
+    fprintf(svg, "<text x=\"%.1f\" y=\"28\" text-anchor=\"middle\" font-size=\"16\">", FAN_SVG_WIDTH / 2.0);
+    write_xml_text(svg, stock->ticker);
+    fprintf(svg, " cumulative growth fan chart</text>\n");
+    
+    // Percent grid and labels
+    for (double v = lo; v <= hi + step / 2; v += step) {
+        double grid_y = top + (hi - v) * scale;
+        fprintf(svg, "<line x1=\"%.1f\" y1=\"%.1f\" x2=\"%.1f\" y2=\"%.1f\" stroke=\"%s\"/>\n", left, grid_y,
+                left + plot_width, grid_y, fabs(v) < step / 2 ? "#888888" : "#e0e0e0");
+        fprintf(svg, "<text x=\"%.1f\" y=\"%.1f\" text-anchor=\"end\">%.*f%%</text>\n", left - 8, grid_y + 4,
+                decimals, v);
+    }
+    fprintf(svg, "<text x=\"%.1f\" y=\"%.1f\" text-anchor=\"middle\">Start</text>\n", x[0], top + plot_height + 20);
+    for (int i = 1; i <= num_years; i++) {
+        fprintf(svg, "<text x=\"%.1f\" y=\"%.1f\" text-anchor=\"middle\">%d</text>\n", x[i], top + plot_height + 20,
+                stock->years[i - 1]);
+    }
+    
+    // Bands as outer-to-inner polygons: the upper edge forward, the lower edge back
+    static const char *band_colours[] = { "#c6dbef", "#6baed6" };
+    for (int band = 0; band < 2; band++) {
+        fprintf(svg, "<polygon fill=\"%s\" points=\"", band_colours[band]);
+        for (int i = 0; i <= num_years; i++) {
+            fprintf(svg, "%.1f,%.1f ", x[i], y[FAN_BANDS - 1 - band][i]);
+        }
+        for (int i = num_years; i >= 0; i--) {
+            fprintf(svg, "%.1f,%.1f ", x[i], y[band][i]);
+        }
+        fprintf(svg, "\"/>\n");
+    }
+    fprintf(svg, "<polyline fill=\"none\" stroke=\"#08306b\" stroke-width=\"2\" points=\"");
+    for (int i = 0; i <= num_years; i++) {
+        fprintf(svg, "%.1f,%.1f ", x[i], y[FAN_BANDS / 2][i]);
+    }
+    fprintf(svg, "\"/>\n");
+    fprintf(svg, "<rect x=\"%.1f\" y=\"%.1f\" width=\"%.1f\" height=\"%.1f\" fill=\"none\" stroke=\"#444444\"/>\n",
+            left, top, plot_width, plot_height);
+    
+    // Legend
+    static const char *legend[] = { "5th-95th percentile", "25th-75th percentile", "Median" };
+    static const char *legend_colours[] = { "#c6dbef", "#6baed6", "#08306b" };
+    for (int i = 0; i < 3; i++) {
+        double legend_x = left + 10 + i * 170;
+        fprintf(svg, "<rect x=\"%.1f\" y=\"%.1f\" width=\"14\" height=\"%d\" fill=\"%s\"/>\n", legend_x,
+                FAN_SVG_HEIGHT - 22.0 + (i == 2 ? 5 : 0), i == 2 ? 3 : 12, legend_colours[i]);
+        fprintf(svg, "<text x=\"%.1f\" y=\"%.1f\">%s</text>\n", legend_x + 20, FAN_SVG_HEIGHT - 12.0, legend[i]);
+    }
+    fprintf(svg, "</svg>\n");
+    
+    fclose(svg);
+    printf("Fan chart exported to %s\n", svg_filename);
+}
+
+/*
+ * Fan chart: percentiles of the cumulative growth at every year end, one
+ * sketch per year filled as the paths are compounded, so no path data is
+ * kept or re-read. With --fan-svg the bands are also drawn to a file.
+ */
+void write_fan_chart(FILE *output, const StockData *stock, const QuantileSketch *sketches, uint64_t n,
+                     const SimulationConfig *config) {
+    static const double levels[FAN_BANDS] = { 0.05, 0.25, 0.50, 0.75, 0.95 };
+    double bands[MAX_YEARS][FAN_BANDS];
+    if (n == 0) {
+        return;
+    }
+    
+    fprintf(output, "\nFAN CHART (cumulative growth percentiles by year end):\n");
+    fprintf(output, "------------------------------------------------------\n");
+    fprintf(output, "%-8s  %8s  %8s  %8s  %8s  %8s\n", "Year", "5th", "25th", "Median", "75th", "95th");
+    for (int year = 0; year < stock->num_years; year++) {
+        fprintf(output, "%-8d", stock->years[year]);
+        for (int b = 0; b < FAN_BANDS; b++) {
+            bands[year][b] = sketch_value_at_rank(&sketches[year], (uint64_t)(levels[b] * n));
+            fprintf(output, "  %7.2f%%", bands[year][b]);
+        }
+        fprintf(output, "\n");
+    }
+    
+    if (config->fan_svg) {
+        write_fan_svg(stock, bands);
+    }
+}
+
+void write_ticker_footer(FILE *output, const StockData *stock) {
+    fprintf(output, "\n====================================================================================\n");
+    fprintf(output, "END OF ANALYSIS FOR %s\n", stock->ticker);
+    fprintf(output, "====================================================================================\n\n\n");
+}
+
+// Report for a streamed (sharded, merged) run, same layout as run_monte_carlo
+void write_accumulator_report(FILE *output, const StockData *stock, double forecast_mean, double forecast_std,
+                              const PathAccumulator *acc, const SimulationConfig *config) {
+    unsigned metrics = config->metrics;
+    Statistics stats = accumulator_statistics(acc);
+    ProbabilityCounts probs = accumulator_probabilities(acc);
+    
+    write_ticker_header(output, stock, acc->moments.count, forecast_mean, forecast_std, config);
+    write_ticker_statistics(output, &stats, &probs, metrics, config->error_batches > 0 ? acc->batches : NULL);
+    write_regime_occupancy(output, stock, acc->moments.count, config);
+    
+    if (metrics & METRIC_TAIL) {
+        double worst[TAIL_BUFFER_SIZE];
+        int count = tail_sorted(&acc->low_tail, worst);
+        write_tail_fit(output, worst, count, acc->moments.count);
+    }
+    if ((metrics & METRIC_PATH) && acc->path_risk) {
+        write_path_risk(output, stock, acc->path_risk);
+    }
+    if ((metrics & METRIC_FAN) && acc->fan_sketches) {
+        write_fan_chart(output, stock, acc->fan_sketches, acc->moments.count, config);
+    }
+    
+    if (metrics & METRIC_HISTOGRAM) {
+        int *bins = calloc(config->graph_width, sizeof(int));
+        if (bins) {
+            sketch_histogram(&acc->sketch, stats.min, stats.max, bins, config->graph_width);
+            print_histogram(output, bins, config->graph_width, config->graph_height, stats.min, stats.max);
+            free(bins);
+        } else {
+            fprintf(stderr, "Error: Memory allocation failed for histogram bins\n");
+        }
+    } else {
+        fprintf(output, "\n");
+    }
+    
+    if ((metrics & METRIC_YEARS) && acc->year_sketches) {
+        fprintf(output, "YEAR-BY-YEAR ANALYSIS:\n");
+        fprintf(output, "======================\n");
+        for (int year = 0; year < stock->num_years; year++) {
+            Statistics year_stats = accumulator_year_statistics(acc, year);
+            write_year_statistics(output, stock, year, &year_stats);
+            write_year_diagnostics(output, stock, year, &year_stats, accumulator_lag_correlation(acc, year),
+                                   forecast_std, config);
+        }
+    }
+    
+    write_ticker_footer(output, stock);
+}
+
+/*
+ * Sensitivities of the mean and the tail quantiles to every input, from
+ * one extra pass that regenerates the paths from their counter-based
+ * streams. Inputs are each year's growth rate and the adjusted standard
+ * deviation s. Mean sensitivities are pathwise: the adjoint sweep gives
+ * dF/dg_y as the product of the other years' factors. Quantile
+ * sensitivities use the likelihood-ratio estimator
+ * dq/dtheta = -E[1{F <= q} score] / f(q), where f(q) is read from the
+ * order statistics around q. The growth rows are total derivatives: they
+ * include the rate's effect on s through compute_forecast_std, so they
+ * match a bump of the rate in the forecasts file.
+ */
+void write_sensitivities(FILE *output, const PathModel *model, const double *final_values, int n,
+                         const SimulationConfig *config) {
+    static const double levels[SENSITIVITY_LEVELS] = { 0.50, 0.05, 0.01 };
+    const StockData *stock = model->stock;
+    int num_years = stock->num_years;
+    int num_inputs = num_years + 1;             // growth rates, then s
+    int per_chunk = num_inputs * (1 + SENSITIVITY_LEVELS);
+    double s = model->forecast_std;
+    
+    if (n < 2 || s <= 0) {
+        return;
+    }
+    if (model->shocks || model->garch.alpha > 0 || model->regimes || model->jumps.intensity > 0 ||
+        model->persistence != 0 || model->history || model->stock->num_scenarios > 0) {
+        // The likelihood-ratio scores are those of independent Gaussian years
+        fprintf(output, "\nSENSITIVITY ANALYSIS: needs independent Gaussian years\n");
+        return;
+    }
+    
+    double *sorted = malloc((size_t)n * sizeof(double));
+    int num_chunks = (n + STREAM_CHUNK_PATHS - 1) / STREAM_CHUNK_PATHS;
+    double *sums = calloc((size_t)num_chunks * per_chunk, sizeof(double));
+    if (!sorted || !sums) {
+        fprintf(stderr, "Error: Memory allocation failed for sensitivity analysis\n");
+        free(sorted);
+        free(sums);
+        return;
+    }
+    
+    memcpy(sorted, final_values, (size_t)n * sizeof(double));
+    sort_doubles(sorted, n, config->sort_algorithm, config->num_threads);
+    
+    double quantile[SENSITIVITY_LEVELS], density[SENSITIVITY_LEVELS];
+    int spread = (int)sqrt((double)n) / 2 + 1;
+    for (int l = 0; l < SENSITIVITY_LEVELS; l++) {
+        int rank = (int)(levels[l] * n);
+        int lo = rank - spread < 0 ? 0 : rank - spread;
+        int hi = rank + spread >= n ? n - 1 : rank + spread;
+        quantile[l] = sorted[rank];
+        double width = sorted[hi] - sorted[lo];
+        density[l] = width > 0 ? (double)(hi - lo) / n / width : 0.0;
+    }
+    free(sorted);
+    
+    // Chunk sums are combined in chunk order, so the result is thread-count independent
+    #pragma omp parallel for num_threads(config->num_threads) schedule(dynamic) if(config->num_threads > 1)
+    for (int c = 0; c < num_chunks; c++) {
+        double *mean_grad = sums + (size_t)c * per_chunk;
+        double *tail_score = mean_grad + num_inputs;
+        int end = (c + 1) * STREAM_CHUNK_PATHS < n ? (c + 1) * STREAM_CHUNK_PATHS : n;
+        
+        for (int path = c * STREAM_CHUNK_PATHS; path < end; path++) {
+            double annual[MAX_YEARS], z[MAX_YEARS], factor[MAX_YEARS], prefix[MAX_YEARS + 1];
+            simulate_path(model, path, annual);
+            
+            prefix[0] = 1.0;
+            for (int year = 0; year < num_years; year++) {
+                z[year] = (annual[year] - stock->growth_rates[year]) / s;
+                factor[year] = 1.0 + annual[year] / 100.0;
+                prefix[year + 1] = prefix[year] * factor[year];
+            }
+            double final_value = (prefix[num_years] - 1.0) * 100.0;
+            
+            // Adjoint sweep: dF/dg_y = prod of the other factors, dF/ds = sum z_y dF/dg_y
+            double suffix = 1.0, d_std = 0.0, score_std = 0.0;
+            for (int year = num_years - 1; year >= 0; year--) {
+                double d_growth = prefix[year] * suffix;
+                mean_grad[year] += d_growth;
+                d_std += d_growth * z[year];
+                score_std += (z[year] * z[year] - 1.0) / s;
+                suffix *= factor[year];
+            }
+            mean_grad[num_years] += d_std;
+            
+            for (int l = 0; l < SENSITIVITY_LEVELS; l++) {
+                if (final_value <= quantile[l]) {
+                    double *score = tail_score + l * num_inputs;
+                    for (int year = 0; year < num_years; year++) {
+                        score[year] += z[year] / s;
+                    }
+                    score[num_years] += score_std;
+                }
+            }
+        }
+    }
+    
+    for (int c = 1; c < num_chunks; c++) {
+        for (int k = 0; k < per_chunk; k++) {
+            sums[k] += sums[(size_t)c * per_chunk + k];
+        }
+    }
+    
+    // d metric / d input: column 0 the mean, then one column per quantile level
+    double table[MAX_YEARS + 1][1 + SENSITIVITY_LEVELS];
+    for (int k = 0; k < num_inputs; k++) {
+        table[k][0] = sums[k] / n;
+        for (int l = 0; l < SENSITIVITY_LEVELS; l++) {
+            double tail = sums[num_inputs + l * num_inputs + k] / n;
+            table[k][1 + l] = density[l] > 0 ? -tail / density[l] : 0.0;
+        }
+    }
+    
+    // Growth rates also move s: ds/dg_y = vol^2 (g_y - mean) / (N s)
+    double forecast_mean = 0.0;
+    for (int year = 0; year < num_years; year++) {
+        forecast_mean += stock->growth_rates[year];
+    }
+    forecast_mean /= num_years;
+    for (int year = 0; year < num_years; year++) {
+        double ds = config->volatility_factor * config->volatility_factor *
+                    (stock->growth_rates[year] - forecast_mean) / (num_years * s);
+        for (int col = 0; col < 1 + SENSITIVITY_LEVELS; col++) {
+            table[year][col] += table[num_years][col] * ds;
+        }
+    }
+    
+    fprintf(output, "\nSENSITIVITY ANALYSIS (change per +1 point of input):\n");
+    fprintf(output, "----------------------------------------------------\n");
+    fprintf(output, "%-20s%8s  %8s  %8s  %8s\n", "Input", "Mean", "Median", "VaR 95%", "VaR 99%");
+    for (int k = 0; k < num_inputs; k++) {
+        char label[32];
+        if (k < num_years) {
+            snprintf(label, sizeof(label), "Growth %d", stock->years[k]);
+        } else {
+            snprintf(label, sizeof(label), "Adjusted Std Dev");
+        }
+        // VaR is the negated quantile
+        fprintf(output, "%-20s%8.3f  %8.3f  %8.3f  %8.3f\n", label, table[k][0], table[k][1], -table[k][2], -table[k][3]);
+    }
+    
+    free(sums);
+}
+
+// Report for an --analytic ticker, same layout as run_monte_carlo
+void write_analytic_report(FILE *output, const StockData *stock, double forecast_mean, double forecast_std,
+                           const AnalyticModel *model, const SimulationConfig *config) {
+    unsigned metrics = config->metrics;
+    uint64_t n = (uint64_t)config->num_simulations;
+    Statistics stats = analytic_statistics(model, n);
+    ProbabilityCounts probs = analytic_probabilities(model, n);
+    
+    write_ticker_header(output, stock, n, forecast_mean, forecast_std, config);
+    fprintf(output, "ANALYTIC APPROXIMATION (lognormal moment matching, no paths simulated):\n");
+    fprintf(output, "Estimated quantile error: +/-%.2f percentage points\n\n", model->error);
+    write_ticker_statistics(output, &stats, &probs, metrics, NULL);
+    
+    if (metrics & METRIC_HISTOGRAM) {
+        int width = config->graph_width;
+        int *bins = calloc(width, sizeof(int));
+        if (bins) {
+            double bin_width = (stats.max - stats.min) / width;
+            double lower = analytic_cdf(model, stats.min);
+            for (int i = 0; i < width; i++) {
+                double upper = analytic_cdf(model, stats.min + (i + 1) * bin_width);
+                bins[i] = (int)llround((upper - lower) * (double)n);
+                lower = upper;
+            }
+            print_histogram(output, bins, width, config->graph_height, stats.min, stats.max);
+            free(bins);
+        } else {
+            fprintf(stderr, "Error: Memory allocation failed for histogram bins\n");
+        }
+    } else {
+        fprintf(output, "\n");
+    }
+    
+    if (metrics & METRIC_YEARS) {
+        // Each year is exactly Gaussian around its forecast
+        double extreme = normal_quantile(1.0 / ((double)n + 1.0));
+        fprintf(output, "YEAR-BY-YEAR ANALYSIS:\n");
+        fprintf(output, "======================\n");
+        for (int year = 0; year < stock->num_years; year++) {
+            Statistics year_stats = {0};
+            year_stats.mean = stock->growth_rates[year];
+            year_stats.std_dev = forecast_std;
+            year_stats.min = year_stats.mean + extreme * forecast_std;
+            year_stats.max = year_stats.mean - extreme * forecast_std;
+            year_stats.percentile_50 = year_stats.mean;
+            write_year_statistics(output, stock, year, &year_stats);
+        }
+    }
+    
+    write_ticker_footer(output, stock);
+}
+
+void run_monte_carlo(StockData *stock, FILE *output, const SimulationConfig *config, ScratchFile *scratch) {
+    if (!stock || !output) {
+        fprintf(stderr, "Error: Invalid stock data or output file\n");
+        return;
+    }
+    
+    MetricPlan plan = plan_metrics(config->metrics, config);
+    
+    double *final_values = NULL;
+    double *annual_returns = NULL;
+    float *spilled_returns = NULL;
+    
+    if (scratch) {
+        // Out-of-core: paths live in the memory-mapped scratch block
+        if (!scratch_map_block(scratch, stock, config->num_simulations)) {
+            return;
+        }
+        final_values = scratch->final_values;
+        spilled_returns = scratch->annual_returns;
+    } else {
+        final_values = malloc(config->num_simulations * sizeof(double));
+        if (!final_values) {
+            fprintf(stderr, "Error: Memory allocation failed for simulation results\n");
+            return;
+        }
+        
+        if (plan.retain_paths) {
+            annual_returns = malloc((size_t)config->num_simulations * stock->num_years * sizeof(double));
+        }
+        if (plan.retain_paths && !annual_returns) {
+            fprintf(stderr, "Error: Memory allocation failed for annual returns\n");
+            free(final_values);
+            return;
+        }
+    }
+    
+    // Calculate base statistics from forecasted growth rates
+    double forecast_mean;
+    double forecast_std = compute_forecast_std(stock, config->volatility_factor, &forecast_mean);
+    
+    write_ticker_header(output, stock, config->num_simulations, forecast_mean, forecast_std, config);
+    
+    PathModel model;
+    path_model_init(&model, stock, forecast_std, config);
+    
+    /*
+     * Paths run in PATH_RISK_CHUNKS fixed ranges; with path metrics each
+     * range fills its own PathRisk, merged in range order afterwards so
+     * the result does not depend on the thread count.
+     */
+    int chunk_paths = (config->num_simulations + PATH_RISK_CHUNKS - 1) / PATH_RISK_CHUNKS;
+    int num_chunks = chunk_paths > 0 ? (config->num_simulations + chunk_paths - 1) / chunk_paths : 0;
+    PathRisk *chunk_risk = NULL;
+    if (plan.metrics & METRIC_PATH) {
+        chunk_risk = malloc((size_t)(num_chunks > 0 ? num_chunks : 1) * sizeof(PathRisk));
+        if (!chunk_risk) {
+            fprintf(stderr, "Error: Memory allocation failed for path metrics\n");
+        }
+        for (int c = 0; chunk_risk && c < num_chunks; c++) {
+            path_risk_init(&chunk_risk[c], &config->barriers);
+        }
+    }
+    
+    // Fan sketches are per thread: their integer counts merge to the same result in any order
+    int fan_threads = config->num_threads > 1 ? config->num_threads : 1;
+    QuantileSketch *fan_sketches = NULL;
+    if (plan.metrics & METRIC_FAN) {
+        fan_sketches = malloc((size_t)fan_threads * stock->num_years * sizeof(QuantileSketch));
+        if (!fan_sketches) {
+            fprintf(stderr, "Error: Memory allocation failed for fan chart sketches\n");
+        }
+        for (int i = 0; fan_sketches && i < fan_threads * stock->num_years; i++) {
+            sketch_init(&fan_sketches[i]);
+        }
+    }
+    
+    // Run simulations - use OpenMP if available
+    #pragma omp parallel for num_threads(config->num_threads) schedule(dynamic) if(config->num_threads > 1)
+    for (int chunk = 0; chunk < num_chunks; chunk++) {
+        int end = chunk_paths * (chunk + 1) < config->num_simulations ? chunk_paths * (chunk + 1) : config->num_simulations;
+        for (int sim = chunk_paths * chunk; sim < end; sim++) {
+            double annual[MAX_YEARS];
+            final_values[sim] = simulate_path(&model, sim, annual);
+            
+            if (spilled_returns) {
+                for (int year = 0; year < stock->num_years; year++) {
+                    spilled_returns[(size_t)year * config->num_simulations + sim] = (float)annual[year];
+                }
+            } else if (annual_returns) {
+                memcpy(annual_returns + (size_t)sim * stock->num_years, annual, stock->num_years * sizeof(double));
+            }
+            if (chunk_risk) {
+                path_risk_add(&chunk_risk[chunk], annual, stock->num_years);
+            }
+            if (fan_sketches) {
+                fan_add(fan_sketches + (size_t)thread_index() * stock->num_years, annual, stock->num_years);
+            }
+            
+            // Display progress in verbose mode
+            if (config->verbose && sim % (config->num_simulations / 10 + 1) == 0) {
+                #pragma omp critical
+                {
+                    printf("\rRunning simulations for %s: %d%%", stock->ticker, (int)(((long long)sim * 100) / config->num_simulations));
+                    fflush(stdout);
+                }
+            }
+        }
+    }
+    
+    if (config->verbose) {
+        printf("\rRunning simulations for %s: 100%%\n", stock->ticker);
+    }
+    
+    for (int c = 1; chunk_risk && c < num_chunks; c++) {
+        path_risk_merge(&chunk_risk[0], &chunk_risk[c]);
+    }
+    for (int t = 1; fan_sketches && t < fan_threads; t++) {
+        for (int year = 0; year < stock->num_years; year++) {
+            sketch_merge(&fan_sketches[year], &fan_sketches[(size_t)t * stock->num_years + year]);
+        }
+    }
+    
+    // Scenario breakdown and batch means need the values in path order, before any sort
+    write_scenario_analysis(output, &model, final_values, config->num_simulations);
+    RunningMoments batches[BATCH_STATS];
+    if (config->error_batches > 0) {
+        batch_statistics(final_values, config->num_simulations, config->error_batches, batches);
+    }
+    
+    // Calculate statistics
+    Statistics stats = calculate_statistics(final_values, config->num_simulations, &plan, config);
+    unsigned metrics = plan.metrics;
+    
+    // Probability analysis
+    ProbabilityCounts probs = { (uint64_t)config->num_simulations, 0, 0, 0, 0 };
+    if (metrics & METRIC_PROBABILITIES) {
+        for (int i = 0; i < config->num_simulations; i++) {
+            if (final_values[i] > 0) probs.positive++;
+            if (final_values[i] > 10) probs.above_10++;
+            if (final_values[i] > 20) probs.above_20++;
+            if (final_values[i] < -10) probs.below_neg10++;
+        }
+    }
+    
+    // Output detailed results
+    write_ticker_statistics(output, &stats, &probs, metrics, config->error_batches > 0 ? batches : NULL);
+    write_regime_occupancy(output, stock, (uint64_t)config->num_simulations, config);
+    
+    if (metrics & METRIC_TAIL) {
+        TailBuffer tail = { 0 };
+        double worst[TAIL_BUFFER_SIZE];
+        for (int i = 0; i < config->num_simulations; i++) {
+            tail_add(&tail, final_values[i]);
+        }
+        int count = tail_sorted(&tail, worst);
+        write_tail_fit(output, worst, count, config->num_simulations);
+    }
+    if (chunk_risk && num_chunks > 0) {
+        write_path_risk(output, stock, &chunk_risk[0]);
+    }
+    free(chunk_risk);
+    if (fan_sketches) {
+        write_fan_chart(output, stock, fan_sketches, (uint64_t)config->num_simulations, config);
+    }
+    free(fan_sketches);
+    
+    if (config->sensitivities) {
+        write_sensitivities(output, &model, final_values, config->num_simulations, config);
+    }
+    
+    // Create histogram
+    if (metrics & METRIC_HISTOGRAM) {
+        create_histogram(final_values, config->num_simulations, output, config->graph_width, config->graph_height);
+    } else {
+        fprintf(output, "\n");
+    }
+    
+    // Export CSV if requested
+    if (config->export_csv) {
+        export_csv(stock->ticker, final_values, config->num_simulations, config);
+    }
+    
+    // Year-by-year analysis
+    if (metrics & METRIC_YEARS) {
+        MetricPlan year_plan = { METRIC_SUMMARY | METRIC_P50, 0, 0 };
+        if (model.garch.alpha > 0) {
+            year_plan.metrics |= METRIC_P25 | METRIC_P75;   // robust dispersion
+        }
+        
+        // The previous year's column, kept in path order for the lag correlation
+        double *previous_returns = NULL;
+        if (!stock_is_gaussian(config, stock)) {
+            previous_returns = malloc(config->num_simulations * sizeof(double));
+        }
+        
+        fprintf(output, "YEAR-BY-YEAR ANALYSIS:\n");
+        fprintf(output, "======================\n");
+        if (spilled_returns) {
+            // Paths were written; switch the mapping to read-ahead for the row passes
+            madvise(scratch->map, scratch->map_length, MADV_NORMAL);
+            scratch_prefetch_row(scratch, 0, config->num_simulations);
+        }
+        for (int year = 0; year < stock->num_years; year++) {
+            double *year_returns = malloc(config->num_simulations * sizeof(double));
+            if (!year_returns) {
+                fprintf(stderr, "Error: Memory allocation failed for year-by-year analysis\n");
+                continue;
+            }
+            
+            if (spilled_returns) {
+                if (year + 1 < stock->num_years) {
+                    scratch_prefetch_row(scratch, year + 1, config->num_simulations);
+                }
+                const float *row = spilled_returns + (size_t)year * config->num_simulations;
+                for (int sim = 0; sim < config->num_simulations; sim++) {
+                    year_returns[sim] = row[sim];
+                }
+            } else {
+                for (int sim = 0; sim < config->num_simulations; sim++) {
+                    year_returns[sim] = annual_returns[(size_t)sim * stock->num_years + year];
+                }
+            }
+            
+            double lag_correlation = NAN;
+            if (previous_returns) {
+                if (year > 0) {
+                    lag_correlation = sample_correlation(previous_returns, year_returns, config->num_simulations);
+                }
+                memcpy(previous_returns, year_returns, config->num_simulations * sizeof(double));
+            }
+            
+            Statistics year_stats = calculate_statistics(year_returns, config->num_simulations, &year_plan, config);
+            write_year_statistics(output, stock, year, &year_stats);
+            write_year_diagnostics(output, stock, year, &year_stats, lag_correlation, forecast_std, config);
+            
+            free(year_returns);
+        }
+        free(previous_returns);
+    }
+    
+    write_ticker_footer(output, stock);
+    
+    if (scratch) {
+        scratch_release_block(scratch);
+    } else {
+        free(final_values);
+        free(annual_returns);
+    }
+}
+
+static int write_block(FILE *file, const void *data, size_t size) {
+    return size == 0 || fwrite(data, size, 1, file) == 1;
+}
+
+static int read_block(FILE *file, void *data, size_t size) {
+    return size == 0 || fread(data, size, 1, file) == 1;
+}
+
+static int write_sketch(FILE *file, const QuantileSketch *sketch) {
+    int ok = write_block(file, &sketch->zero_count, sizeof(sketch->zero_count));
+    const SketchSide *sides[2] = { &sketch->negative, &sketch->positive };
+    for (int i = 0; i < 2 && ok; i++) {
+        int32_t range[2] = { sides[i]->lo, sides[i]->hi };
+        ok = write_block(file, range, sizeof(range));
+        if (ok && range[0] <= range[1]) {
+            ok = write_block(file, sides[i]->counts + range[0], (size_t)(range[1] - range[0] + 1) * sizeof(uint64_t));
+        }
+    }
+    return ok;
+}
+
+static int read_sketch(FILE *file, QuantileSketch *sketch) {
+    sketch_clear(sketch);
+    int ok = read_block(file, &sketch->zero_count, sizeof(sketch->zero_count));
+    SketchSide *sides[2] = { &sketch->negative, &sketch->positive };
+    for (int i = 0; i < 2 && ok; i++) {
+        int32_t range[2];
+        ok = read_block(file, range, sizeof(range));
+        if (!ok || range[0] > range[1]) {
+            continue;
+        }
+        if (range[0] < 0 || range[1] >= SKETCH_BUCKETS) {
+            return 0;
+        }
+        sides[i]->lo = range[0];
+        sides[i]->hi = range[1];
+        ok = read_block(file, sides[i]->counts + range[0], (size_t)(range[1] - range[0] + 1) * sizeof(uint64_t));
+    }
+    return ok;
+}
+
+int write_accumulator(FILE *file, const PathAccumulator *acc) {
+    int ok = write_block(file, &acc->moments, sizeof(acc->moments));
+    uint64_t probs[4] = { acc->prob_positive, acc->prob_above_10, acc->prob_above_20, acc->prob_below_neg10 };
+    ok = ok && write_block(file, probs, sizeof(probs));
+    ok = ok && write_block(file, &acc->low_tail.size, sizeof(int));
+    ok = ok && write_block(file, acc->low_tail.values, (size_t)acc->low_tail.size * sizeof(double));
+    ok = ok && write_block(file, &acc->high_tail.size, sizeof(int));
+    ok = ok && write_block(file, acc->high_tail.values, (size_t)acc->high_tail.size * sizeof(double));
+    ok = ok && write_sketch(file, &acc->sketch);
+    ok = ok && write_block(file, acc->year_moments, (size_t)acc->num_years * sizeof(RunningMoments));
+    ok = ok && write_block(file, acc->year_comoments, (size_t)acc->num_years * sizeof(double));
+    ok = ok && write_block(file, acc->batches, sizeof(acc->batches));
+    for (int y = 0; ok && acc->year_sketches && y < acc->num_years; y++) {
+        ok = write_sketch(file, &acc->year_sketches[y]);
+    }
+    if (ok && acc->path_risk) {
+        // Barrier levels live in the file header; only the counts are written
+        const PathRisk *risk = acc->path_risk;
+        ok = write_block(file, &risk->drawdown, sizeof(risk->drawdown)) && write_sketch(file, &risk->drawdown_sketch) &&
+             write_block(file, &risk->years_below, sizeof(risk->years_below)) &&
+             write_block(file, &risk->ever_below, sizeof(risk->ever_below)) &&
+             write_block(file, risk->first_passage, (size_t)risk->barriers.count * sizeof(risk->first_passage[0]));
+    }
+    for (int y = 0; ok && acc->fan_sketches && y < acc->num_years; y++) {
+        ok = write_sketch(file, &acc->fan_sketches[y]);
+    }
+    return ok;
+}
+
+// acc must already be initialised with the matching year count, sketches, barriers and fan sketches
+int read_accumulator(FILE *file, PathAccumulator *acc) {
+    uint64_t probs[4];
+    int ok = read_block(file, &acc->moments, sizeof(acc->moments));
+    ok = ok && read_block(file, probs, sizeof(probs));
+    ok = ok && read_block(file, &acc->low_tail.size, sizeof(int));
+    ok = ok && acc->low_tail.size >= 0 && acc->low_tail.size <= TAIL_BUFFER_SIZE;
+    ok = ok && read_block(file, acc->low_tail.values, (size_t)acc->low_tail.size * sizeof(double));
+    ok = ok && read_block(file, &acc->high_tail.size, sizeof(int));
+    ok = ok && acc->high_tail.size >= 0 && acc->high_tail.size <= TAIL_BUFFER_SIZE;
+    ok = ok && read_block(file, acc->high_tail.values, (size_t)acc->high_tail.size * sizeof(double));
+    ok = ok && read_sketch(file, &acc->sketch);
+    ok = ok && read_block(file, acc->year_moments, (size_t)acc->num_years * sizeof(RunningMoments));
+    ok = ok && read_block(file, acc->year_comoments, (size_t)acc->num_years * sizeof(double));
+    ok = ok && read_block(file, acc->batches, sizeof(acc->batches));
+    for (int y = 0; ok && acc->year_sketches && y < acc->num_years; y++) {
+        ok = read_sketch(file, &acc->year_sketches[y]);
+    }
+    if (ok && acc->path_risk) {
+        PathRisk *risk = acc->path_risk;
+        ok = read_block(file, &risk->drawdown, sizeof(risk->drawdown)) && read_sketch(file, &risk->drawdown_sketch) &&
+             read_block(file, &risk->years_below, sizeof(risk->years_below)) &&
+             read_block(file, &risk->ever_below, sizeof(risk->ever_below)) &&
+             read_block(file, risk->first_passage, (size_t)risk->barriers.count * sizeof(risk->first_passage[0]));
+    }
+    for (int y = 0; ok && acc->fan_sketches && y < acc->num_years; y++) {
+        ok = read_sketch(file, &acc->fan_sketches[y]);
+    }
+    if (ok) {
+        acc->prob_positive = probs[0];
+        acc->prob_above_10 = probs[1];
+        acc->prob_above_20 = probs[2];
+        acc->prob_below_neg10 = probs[3];
+    }
+    return ok;
+}
+
+void write_run_header(FILE *output, const char *input_description, uint64_t num_simulations,
+                      double volatility_factor, uint64_t seed) {
+    time_t now = time(NULL);
+    fprintf(output, "MONTE CARLO SIMULATION ANALYSIS REPORT\n");
+    fprintf(output, "Generated: %s", ctime(&now));
+    fprintf(output, "Input File: %s\n", input_description);
+    fprintf(output, "Simulations per Stock: %llu\n", (unsigned long long)num_simulations);
+    fprintf(output, "Volatility Factor: %.2f\n", volatility_factor);
+    fprintf(output, "Random Seed: %llu\n", (unsigned long long)seed);
+    fprintf(output, "\n");
+}
+
+// Simulate this process's share of every ticker's path range into a partial-result file
+int run_shard(const StockData *stocks, int num_stocks, const SimulationConfig *config) {
+    FILE *partial = fopen(config->partial_file, "wb");
+    if (!partial) {
+        fprintf(stderr, "Error: Could not create partial-result file %s\n", config->partial_file);
+        return 0;
+    }
+    
+    int with_years = (config->metrics & METRIC_YEARS) != 0;
+    int with_fan = (config->metrics & METRIC_FAN) != 0;
+    PartialFileHeader header = {0};
+    memcpy(header.magic, PARTIAL_MAGIC, sizeof(header.magic));
+    header.version = PARTIAL_VERSION;
+    header.num_tickers = num_stocks;
+    header.seed = config->seed;
+    header.total_simulations = config->num_simulations;
+    header.shard_index = config->shard_index;
+    header.shard_count = config->shard_count;
+    header.volatility_factor = config->volatility_factor;
+    header.with_years = with_years;
+    header.with_path_risk = path_barriers(config) != NULL;
+    header.with_fan = with_fan;
+    header.barriers = config->barriers;
+    header.model_fingerprint = model_fingerprint(config);
+    int ok = write_block(partial, &header, sizeof(header));
+    
+    uint64_t n = (uint64_t)config->num_simulations;
+    uint64_t begin = n * config->shard_index / config->shard_count;
+    uint64_t end = n * (config->shard_index + 1) / config->shard_count;
+    
+    for (int i = 0; ok && i < num_stocks; i++) {
+        printf("Running shard %d/%d (paths %llu-%llu) for %s...\n", config->shard_index, config->shard_count,
+               (unsigned long long)begin, (unsigned long long)end, stocks[i].ticker);
+        
+        PartialTickerHeader ticker = {0};
+        ticker.stock = stocks[i];
+        ticker.forecast_std = compute_forecast_std(&stocks[i], config->volatility_factor, &ticker.forecast_mean);
+        ticker.path_begin = begin;
+        ticker.path_end = end;
+        
+        PathModel model;
+        path_model_init(&model, &stocks[i], ticker.forecast_std, config);
+        
+        PathAccumulator *acc = malloc(sizeof(PathAccumulator));
+        ok = acc && accumulator_init(acc, stocks[i].num_years, with_years, path_barriers(config), with_fan);
+        ok = ok && simulate_range(&model, begin, end, acc, config, NULL, NULL);
+        ok = ok && write_block(partial, &ticker, sizeof(ticker));
+        ok = ok && write_accumulator(partial, acc);
+        if (acc) {
+            accumulator_free(acc);
+            free(acc);
+        }
+    }
+    
+    if (fclose(partial) != 0 || !ok) {
+        fprintf(stderr, "Error: Failed writing partial-result file %s\n", config->partial_file);
+        return 0;
+    }
+    printf("Shard %d/%d written to %s\n", config->shard_index, config->shard_count, config->partial_file);
+    return 1;
+}
+
+// Write the checkpoint to a temporary file, sync it and rename it into place
+int write_checkpoint(const char *filename, const CheckpointHeader *header, const PathAccumulator *acc) {
+    char temp_file[MAX_LINE_LENGTH + 8];
+    snprintf(temp_file, sizeof(temp_file), "%s.tmp", filename);
+    
+    FILE *file = fopen(temp_file, "wb");
+    if (!file) {
+        fprintf(stderr, "Error: Could not create checkpoint file %s\n", temp_file);
+        return 0;
+    }
+    
+    int ok = write_block(file, header, sizeof(*header));
+    if (ok && header->next_path > 0) {
+        ok = write_accumulator(file, acc);
+    }
+    ok = ok && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    ok = (fclose(file) == 0) && ok;
+    ok = ok && rename(temp_file, filename) == 0;
+    if (!ok) {
+        fprintf(stderr, "Error: Failed writing checkpoint %s\n", filename);
+        unlink(temp_file);
+    }
+    return ok;
+}
+
+typedef struct {
+    const SimulationConfig *config;
+    FILE *output;
+    CheckpointHeader header;
+    time_t last_checkpoint;
+} CheckpointState;
+
+// Checkpoint if the interval has elapsed; the report is synced first so the
+// recorded offset never points past data that is not on disk
+static int checkpoint_if_due(CheckpointState *state, uint64_t next_path, const PathAccumulator *acc) {
+    time_t now = time(NULL);
+    if (now - state->last_checkpoint < state->config->checkpoint_interval) {
+        return 1;
+    }
+    
+    if (fflush(state->output) != 0 || fsync(fileno(state->output)) != 0) {
+        fprintf(stderr, "Error: Could not sync report before checkpointing\n");
+        return 0;
+    }
+    state->header.output_offset = (uint64_t)ftello(state->output);
+    state->header.next_path = next_path;
+    state->last_checkpoint = now;
+    return write_checkpoint(state->config->checkpoint_file, &state->header, acc);
+}
+
+static int checkpoint_round(void *context, uint64_t next_path, const PathAccumulator *total) {
+    return checkpoint_if_due((CheckpointState *)context, next_path, total);
+}
+
+// Combined stock_fingerprint() of the input, so a resume sees any edited forecast
+static uint64_t forecasts_fingerprint(const StockData *stocks, int num_stocks) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (int i = 0; i < num_stocks; i++) {
+        uint64_t stock = stock_fingerprint(&stocks[i]);
+        fingerprint_bytes(&hash, &stock, sizeof(stock));
+    }
+    return hash;
+}
+
+/*
+ * Checkpointed run: every ticker is streamed into a PathAccumulator and its
+ * report appended as soon as it completes. Because rounds merge chunks in
+ * path order and the RNG is counter-based, resuming from a checkpoint gives
+ * a report identical to an uninterrupted run.
+ */
+int run_checkpointed(const StockData *stocks, int num_stocks, SimulationConfig *config) {
+    CheckpointState state;
+    memset(&state, 0, sizeof(state));
+    state.config = config;
+    
+    int with_years = (config->metrics & METRIC_YEARS) != 0;
+    int with_fan = (config->metrics & METRIC_FAN) != 0;
+    PathAccumulator *acc = malloc(sizeof(PathAccumulator));
+    if (!acc) {
+        fprintf(stderr, "Error: Memory allocation failed for checkpoint accumulator\n");
+        return 0;
+    }
+    
+    CheckpointHeader *header = &state.header;
+    FILE *checkpoint = config->resume ? fopen(config->checkpoint_file, "rb") : NULL;
+    if (config->resume && !checkpoint) {
+        fprintf(stderr, "Warning: No checkpoint at %s, starting from the beginning\n", config->checkpoint_file);
+    }
+    
+    int restored_accumulator = 0;
+    if (checkpoint) {
+        int ok = read_block(checkpoint, header, sizeof(*header)) && memcmp(header->magic, CHECKPOINT_MAGIC, 8) == 0 &&
+                 header->version == CHECKPOINT_VERSION;
+        if (ok && (header->total_simulations != (uint64_t)config->num_simulations ||
+                   header->volatility_factor != config->volatility_factor || header->metrics != config->metrics ||
+                   !barriers_equal(&header->barriers, &config->barriers) ||
+                   (config->seed_set && header->seed != config->seed) ||
+                   header->model_fingerprint != model_fingerprint(config) ||
+                   header->forecasts_fingerprint != forecasts_fingerprint(stocks, num_stocks) ||
+                   header->ticker_index > (uint32_t)num_stocks)) {
+            fprintf(stderr, "Error: Checkpoint %s belongs to a run with different settings\n", config->checkpoint_file);
+            ok = 0;
+        }
+        if (ok && header->ticker_index < (uint32_t)num_stocks &&
+            strcmp(header->ticker, stocks[header->ticker_index].ticker) != 0) {
+            fprintf(stderr, "Error: Checkpoint %s expects ticker %s next; was the input file changed?\n",
+                    config->checkpoint_file, header->ticker);
+            ok = 0;
+        }
+        if (ok && header->next_path > 0) {
+            ok = accumulator_init(acc, stocks[header->ticker_index].num_years, with_years, path_barriers(config), with_fan) &&
+                 read_accumulator(checkpoint, acc);
+            restored_accumulator = ok;
+        }
+        fclose(checkpoint);
+        if (!ok) {
+            if (restored_accumulator) accumulator_free(acc);
+            free(acc);
+            return 0;
+        }
+        config->seed = header->seed;
+        printf("Resuming %s at path %llu from %s\n", header->ticker_index < (uint32_t)num_stocks ?
+               stocks[header->ticker_index].ticker : "(done)", (unsigned long long)header->next_path,
+               config->checkpoint_file);
+    } else {
+        memset(header, 0, sizeof(*header));
+        memcpy(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic));
+        header->version = CHECKPOINT_VERSION;
+        header->seed = config->seed;
+        header->total_simulations = config->num_simulations;
+        header->volatility_factor = config->volatility_factor;
+        header->metrics = config->metrics;
+        header->with_years = with_years;
+        header->barriers = config->barriers;
+        header->model_fingerprint = model_fingerprint(config);
+        header->forecasts_fingerprint = forecasts_fingerprint(stocks, num_stocks);
+    }
+    
+    // Reopen the report and drop anything written after the checkpoint
+    FILE *output;
+    if (checkpoint) {
+        output = fopen(config->output_file, "r+");
+        if (!output || ftruncate(fileno(output), (off_t)header->output_offset) != 0 || fseeko(output, 0, SEEK_END) != 0) {
+            fprintf(stderr, "Error: Could not reopen report %s for resuming\n", config->output_file);
+            if (output) fclose(output);
+            if (restored_accumulator) accumulator_free(acc);
+            free(acc);
+            return 0;
+        }
+    } else {
+        output = fopen(config->output_file, "w");
+        if (!output) {
+            fprintf(stderr, "Error: Could not create output file %s\n", config->output_file);
+            free(acc);
+            return 0;
+        }
+        write_run_header(output, config->input_file, config->num_simulations, config->volatility_factor, config->seed);
+    }
+    state.output = output;
+    state.last_checkpoint = time(NULL);
+    
+    int ok = 1;
+    for (int i = (int)header->ticker_index; ok && i < num_stocks; i++) {
+        const StockData *stock = &stocks[i];
+        printf("Running Monte Carlo simulation for %s...\n", stock->ticker);
+        
+        uint64_t begin = 0;
+        if (restored_accumulator) {
+            begin = header->next_path;
+            restored_accumulator = 0;
+        } else {
+            ok = accumulator_init(acc, stock->num_years, with_years, path_barriers(config), with_fan);
+        }
+        header->ticker_index = i;
+        snprintf(header->ticker, sizeof(header->ticker), "%s", stock->ticker);
+        
+        double forecast_mean;
+        double forecast_std = compute_forecast_std(stock, config->volatility_factor, &forecast_mean);
+        PathModel model;
+        path_model_init(&model, stock, forecast_std, config);
+        
+        ok = ok && simulate_range(&model, begin, config->num_simulations, acc, config, checkpoint_round, &state);
+        if (ok) {
+            write_accumulator_report(output, stock, forecast_mean, forecast_std, acc, config);
+            
+            // Next ticker, nothing simulated yet
+            header->ticker_index = i + 1;
+            if (i + 1 < num_stocks) {
+                snprintf(header->ticker, sizeof(header->ticker), "%s", stocks[i + 1].ticker);
+            }
+            ok = checkpoint_if_due(&state, 0, acc);
+        }
+        accumulator_free(acc);
+    }
+    
+    if (fclose(output) != 0) {
+        ok = 0;
+    }
+    free(acc);
+    
+    if (ok) {
+        // Finished: the checkpoint has served its purpose
+        unlink(config->checkpoint_file);
+    } else {
+        fprintf(stderr, "Run stopped; rerun with --resume to continue from %s\n", config->checkpoint_file);
+    }
+    return ok;
+}
+
+typedef struct {
+    const char *ticker;
+    uint64_t next_report;
+} RefinementState;
+
+// One machine-readable line per estimate so consumers can follow convergence
+static void print_estimate(const char *ticker, const PathAccumulator *acc) {
+    Statistics stats = accumulator_statistics(acc);
+    printf("ESTIMATE ticker=%s paths=%llu mean=%.4f std=%.4f p5=%.4f p50=%.4f p95=%.4f var95=%.4f var99=%.4f\n",
+           ticker, (unsigned long long)acc->moments.count, stats.mean, stats.std_dev, stats.percentile_5,
+           stats.percentile_50, stats.percentile_95, stats.var_95, stats.var_99);
+    fflush(stdout);
+}
+
+static int refinement_round(void *context, uint64_t next_path, const PathAccumulator *total) {
+    RefinementState *state = context;
+    if (next_path >= state->next_report) {
+        print_estimate(state->ticker, total);
+        while (state->next_report <= next_path) {
+            state->next_report *= 2;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Progressive refinement. Without --extend-to, streams every ticker from
+ * path 0 and saves its accumulator to --state. With --extend-to N, loads
+ * the saved accumulators, simulates only paths [saved, N) and merges, then
+ * rewrites the state. Intermediate estimates go to stdout at each doubling.
+ */
+int run_progressive(const StockData *stocks, int num_stocks, SimulationConfig *config) {
+    int with_years = (config->metrics & METRIC_YEARS) != 0;
+    int with_fan = (config->metrics & METRIC_FAN) != 0;
+    const BarrierSet *barriers = path_barriers(config);
+    PartialFileHeader previous = {0};
+    FILE *old_state = NULL;
+    long long *offsets = NULL;     // per input ticker, offset of its saved record or -1
+    int ok = 1;
     
-    while (fgets(line, sizeof(line), file) && stock_count < max_stocks) {
-        // Remove newline character
-        line[strcspn(line, "\n")] = 0;
+    PathAccumulator *acc = malloc(sizeof(PathAccumulator));
+    offsets = malloc((size_t)num_stocks * sizeof(long long));
+    if (!acc || !offsets) {
+        fprintf(stderr, "Error: Memory allocation failed for refinement state\n");
+        free(acc);
+        free(offsets);
+        return 0;
+    }
+    for (int i = 0; i < num_stocks; i++) {
+        offsets[i] = -1;
+    }
+    
+    uint64_t target = config->extend_to > 0 ? (uint64_t)config->extend_to : (uint64_t)config->num_simulations;
+    
+    if (config->extend_to > 0) {
+        old_state = fopen(config->state_file, "rb");
+        ok = old_state && read_block(old_state, &previous, sizeof(previous)) &&
+             memcmp(previous.magic, PARTIAL_MAGIC, 8) == 0 && previous.version == PARTIAL_VERSION &&
+             previous.shard_count == 1;
+        if (!ok) {
+            fprintf(stderr, "Error: %s is not a saved run state\n", config->state_file);
+        } else if (config->seed_set && config->seed != previous.seed) {
+            fprintf(stderr, "Error: --seed differs from the seed saved in %s\n", config->state_file);
+            ok = 0;
+        } else if (previous.volatility_factor != config->volatility_factor) {
+            fprintf(stderr, "Error: --volatility differs from the saved run (%.2f)\n", previous.volatility_factor);
+            ok = 0;
+        } else if (barriers && previous.with_path_risk && !barriers_equal(barriers, &previous.barriers)) {
+            fprintf(stderr, "Error: --barriers differs from the saved run\n");
+            ok = 0;
+        } else if (previous.model_fingerprint != model_fingerprint(config)) {
+            fprintf(stderr, "Error: The path model (distribution, GARCH, AR, jumps, model file, regimes, factors, "
+                    "copula or history) differs from the saved run\n");
+            ok = 0;
+        } else if (previous.total_simulations > target) {
+            fprintf(stderr, "Error: Saved run already has %llu paths\n", (unsigned long long)previous.total_simulations);
+            ok = 0;
+        }
         
-        // Check for new forecast section
-        if (strstr(line, "REVENUE FORECAST FOR")) {
-            in_forecast = 1;
-            // Extract ticker name
-            char *ticker_start = strstr(line, "FOR ") + 4;
-            char *ticker_end = strstr(ticker_start, " (");
-            if (ticker_start && ticker_end) {
-                int ticker_len = ticker_end - ticker_start;
-                if (ticker_len < MAX_TICKER_LENGTH - 1) {
-                    strncpy(stocks[stock_count].ticker, ticker_start, ticker_len);
-                    stocks[stock_count].ticker[ticker_len] = '\0';
-                    stocks[stock_count].num_years = 0;
-                } else {
-                    fprintf(stderr, "Warning: Ticker name too long, truncating: %.*s\n", ticker_len, ticker_start);
-                    strncpy(stocks[stock_count].ticker, ticker_start, MAX_TICKER_LENGTH - 1);
-                    stocks[stock_count].ticker[MAX_TICKER_LENGTH - 1] = '\0';
-                    stocks[stock_count].num_years = 0;
+        // Index the saved records by ticker
+        PathAccumulator *scan = ok ? malloc(sizeof(PathAccumulator)) : NULL;
+        ok = ok && scan && accumulator_init(scan, MAX_YEARS, previous.with_years,
+                                            previous.with_path_risk ? &previous.barriers : NULL, previous.with_fan);
+        for (uint32_t t = 0; ok && t < previous.num_tickers; t++) {
+            long long offset = ftello(old_state);
+            PartialTickerHeader info;
+            ok = read_block(old_state, &info, sizeof(info)) && info.stock.num_years > 0 && info.stock.num_years <= MAX_YEARS;
+            scan->num_years = info.stock.num_years;
+            ok = ok && read_accumulator(old_state, scan);
+            for (int i = 0; ok && i < num_stocks; i++) {
+                if (strcmp(stocks[i].ticker, info.stock.ticker) != 0) {
+                    continue;
+                }
+                // Extending must continue the same forecasts, or old and new paths would be blended
+                double forecast_mean;
+                if (stock_fingerprint(&stocks[i]) != stock_fingerprint(&info.stock) ||
+                    compute_forecast_std(&stocks[i], config->volatility_factor, &forecast_mean) != info.forecast_std) {
+                    fprintf(stderr, "Error: Forecasts for %s differ from the saved run\n", stocks[i].ticker);
+                    ok = 0;
                 }
+                offsets[i] = offset;
             }
-            continue;
         }
+        if (scan) {
+            scan->num_years = MAX_YEARS;
+            accumulator_free(scan);
+            free(scan);
+        }
+        if (!ok) {
+            fprintf(stderr, "Error: Could not load saved run state from %s\n", config->state_file);
+            if (old_state) fclose(old_state);
+            free(acc);
+            free(offsets);
+            return 0;
+        }
+        config->seed = previous.seed;
+        with_years = with_years && previous.with_years;
+        with_fan = with_fan && previous.with_fan;
+        barriers = previous.with_path_risk ? barriers : NULL;
+    }
+    
+    FILE *output = fopen(config->output_file, "w");
+    char temp_file[MAX_LINE_LENGTH + 8];
+    snprintf(temp_file, sizeof(temp_file), "%s.tmp", config->state_file);
+    FILE *new_state = fopen(temp_file, "wb");
+    if (!output || !new_state) {
+        fprintf(stderr, "Error: Could not create %s\n", output ? temp_file : config->output_file);
+        if (output) fclose(output);
+        if (new_state) fclose(new_state);
+        if (old_state) fclose(old_state);
+        free(acc);
+        free(offsets);
+        return 0;
+    }
+    
+    PartialFileHeader header = {0};
+    memcpy(header.magic, PARTIAL_MAGIC, sizeof(header.magic));
+    header.version = PARTIAL_VERSION;
+    header.num_tickers = num_stocks;
+    header.seed = config->seed;
+    header.total_simulations = target;
+    header.shard_index = 0;
+    header.shard_count = 1;
+    header.volatility_factor = config->volatility_factor;
+    header.with_years = with_years;
+    header.with_path_risk = barriers != NULL;
+    header.with_fan = with_fan;
+    header.barriers = config->barriers;
+    header.model_fingerprint = model_fingerprint(config);
+    ok = write_block(new_state, &header, sizeof(header));
+    
+    write_run_header(output, config->input_file, target, config->volatility_factor, config->seed);
+    
+    for (int i = 0; ok && i < num_stocks; i++) {
+        const StockData *stock = &stocks[i];
+        ok = accumulator_init(acc, stock->num_years, with_years, barriers, with_fan);
         
-        // Check for end of section
-        if (strstr(line, "---") && in_forecast) {
-            if (stocks[stock_count].num_years > 0) {
-                stock_count++;
+        uint64_t begin = 0;
+        if (ok && offsets[i] >= 0) {
+            // Saved state may carry per-year sketches, path metrics or fan sketches this run does not keep
+            PathAccumulator *saved = malloc(sizeof(PathAccumulator));
+            PartialTickerHeader info;
+            ok = saved && accumulator_init(saved, stock->num_years, previous.with_years,
+                                           previous.with_path_risk ? &previous.barriers : NULL, previous.with_fan) &&
+                 fseeko(old_state, (off_t)offsets[i], SEEK_SET) == 0 &&
+                 read_block(old_state, &info, sizeof(info)) && read_accumulator(old_state, saved);
+            if (ok) {
+                accumulator_merge(acc, saved);
+                begin = info.path_end;
             }
-            in_forecast = 0;
+            if (saved) {
+                accumulator_free(saved);
+                free(saved);
+            }
+        }
+        if (!ok) break;
+        
+        if (begin > 0) {
+            printf("Extending %s from %llu to %llu paths...\n", stock->ticker,
+                   (unsigned long long)begin, (unsigned long long)target);
+            print_estimate(stock->ticker, acc);
+        } else {
+            printf("Running Monte Carlo simulation for %s...\n", stock->ticker);
+        }
+        
+        PartialTickerHeader info = {0};
+        info.stock = *stock;
+        info.forecast_std = compute_forecast_std(stock, config->volatility_factor, &info.forecast_mean);
+        info.path_begin = 0;
+        info.path_end = target;
+        
+        PathModel model;
+        path_model_init(&model, stock, info.forecast_std, config);
+        
+        RefinementState refinement = { stock->ticker, begin > 0 ? begin * 2 : STREAM_CHUNK_PATHS };
+        ok = simulate_range(&model, begin, target, acc, config, refinement_round, &refinement);
+        if (ok) {
+            print_estimate(stock->ticker, acc);
+        }
+        
+        ok = ok && write_block(new_state, &info, sizeof(info)) && write_accumulator(new_state, acc);
+        if (ok) {
+            write_accumulator_report(output, stock, info.forecast_mean, info.forecast_std, acc, config);
+        }
+        accumulator_free(acc);
+    }
+    
+    if (old_state) {
+        fclose(old_state);
+    }
+    ok = fflush(new_state) == 0 && fsync(fileno(new_state)) == 0 && ok;
+    ok = (fclose(new_state) == 0) && ok;
+    ok = ok && rename(temp_file, config->state_file) == 0;
+    if (!ok) {
+        fprintf(stderr, "Error: Failed saving run state to %s\n", config->state_file);
+        unlink(temp_file);
+    }
+    fclose(output);
+    free(acc);
+    free(offsets);
+    return ok;
+}
+
+static double wall_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+/*
+ * Relative standard errors of the budget target metrics. Quantile errors
+ * use sqrt(p(1-p)/n) / f(q) with the density read off the sketch; values
+ * within one percentage point of zero are scaled by 1 to avoid blow-ups.
+ * Paths that all end at the same value are exact, so every error is 0.
+ */
+double budget_relative_error(const PathAccumulator *acc, double *rel_mean, double *rel_var95, double *rel_var99) {
+    uint64_t n = acc->moments.count;
+    const double levels[2] = { 0.05, 0.01 };
+    double rel_quantile[2];
+    
+    if (acc->moments.max <= acc->moments.min) {
+        *rel_mean = *rel_var95 = *rel_var99 = 0.0;
+        return 0.0;
+    }
+    double scale = fabs(acc->moments.mean) > 1.0 ? fabs(acc->moments.mean) : 1.0;
+    *rel_mean = moments_std_dev(&acc->moments) / sqrt((double)n) / scale;
+    
+    for (int i = 0; i < 2; i++) {
+        double p = levels[i], delta = p / 2;
+        double q = accumulator_value_at_rank(acc, (uint64_t)(p * n));
+        double lo = accumulator_value_at_rank(acc, (uint64_t)((p - delta) * n));
+        double hi = accumulator_value_at_rank(acc, (uint64_t)((p + delta) * n));
+        double density = hi > lo ? 2 * delta / (hi - lo) : 1e-12;
+        double q_scale = fabs(q) > 1.0 ? fabs(q) : 1.0;
+        rel_quantile[i] = sqrt(p * (1 - p) / n) / density / q_scale;
+    }
+    *rel_var95 = rel_quantile[0];
+    *rel_var99 = rel_quantile[1];
+    
+    double worst = *rel_mean;
+    if (*rel_var95 > worst) worst = *rel_var95;
+    if (*rel_var99 > worst) worst = *rel_var99;
+    return worst;
+}
+
+typedef struct {
+    double deadline;
+    int stopped;
+} BudgetState;
+
+static int budget_round(void *context, uint64_t next_path, const PathAccumulator *total) {
+    BudgetState *budget = context;
+    (void)next_path;
+    (void)total;
+    if (wall_seconds() >= budget->deadline) {
+        budget->stopped = 1;
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Time-budgeted run. After a pilot of BUDGET_PILOT_PATHS per ticker, each
+ * pass measures per-path cost t_i and error constants c_i (worst relative
+ * error times sqrt(n_i)) and allocates the remaining time so that every
+ * ticker reaches the same relative error: n_i = c_i^2 / eps^2 with
+ * eps^2 = sum(t_i c_i^2) / budget. Each pass plans with only part of the
+ * remaining time and serves the least precise tickers first, so running out
+ * of budget mid-pass never starves a ticker.
+ */
+int run_time_budgeted(const StockData *stocks, int num_stocks, const SimulationConfig *config) {
+    double start = wall_seconds();
+    int with_years = (config->metrics & METRIC_YEARS) != 0;
+    int with_fan = (config->metrics & METRIC_FAN) != 0;
+    BudgetState budget = { start + config->time_budget, 0 };
+    
+    PathAccumulator *accs = calloc(num_stocks, sizeof(PathAccumulator));
+    PathModel *models = calloc(num_stocks, sizeof(PathModel));
+    double *forecast_means = calloc(num_stocks, sizeof(double));
+    double *forecast_stds = calloc(num_stocks, sizeof(double));
+    double *seconds_spent = calloc(num_stocks, sizeof(double));
+    double *targets = calloc(num_stocks, sizeof(double));
+    double *errors = calloc(num_stocks, sizeof(double));
+    int *order = calloc(num_stocks, sizeof(int));
+    int ok = accs && models && forecast_means && forecast_stds && seconds_spent && targets && errors && order;
+    
+    for (int i = 0; ok && i < num_stocks; i++) {
+        forecast_stds[i] = compute_forecast_std(&stocks[i], config->volatility_factor, &forecast_means[i]);
+        path_model_init(&models[i], &stocks[i], forecast_stds[i], config);
+        ok = accumulator_init(&accs[i], stocks[i].num_years, with_years, path_barriers(config), with_fan);
+    }
+    
+    // Pilot batch; always completed so every ticker has an estimate
+    for (int i = 0; ok && i < num_stocks; i++) {
+        double t0 = wall_seconds();
+        ok = simulate_range(&models[i], 0, BUDGET_PILOT_PATHS, &accs[i], config, NULL, NULL);
+        seconds_spent[i] += wall_seconds() - t0;
+    }
+    
+    int passes = 0;
+    while (ok && !budget.stopped) {
+        double remaining = (budget.deadline - wall_seconds()) * BUDGET_SAFETY_FRACTION;
+        if (remaining < BUDGET_MIN_PASS_SECONDS) {
+            break;
+        }
+        double pass_budget = remaining > 2 * BUDGET_MIN_PASS_SECONDS ? remaining * BUDGET_PASS_FRACTION : remaining;
+        
+        double weighted = 0.0;
+        for (int i = 0; i < num_stocks; i++) {
+            double rm, r95, r99;
+            double n = (double)accs[i].moments.count;
+            errors[i] = budget_relative_error(&accs[i], &rm, &r95, &r99);
+            double c = errors[i] * sqrt(n);
+            double cost = seconds_spent[i] / n;
+            // A ticker with no dispersion (or no finite error) is already exact
+            targets[i] = isfinite(c) ? c * c : 0.0;
+            weighted += cost * targets[i];
+            order[i] = i;
+        }
+        if (!(weighted > 0.0)) {
+            break;
+        }
+        
+        // Least precise tickers first
+        for (int i = 1; i < num_stocks; i++) {
+            int current = order[i], j = i;
+            while (j > 0 && errors[order[j - 1]] < errors[current]) {
+                order[j] = order[j - 1];
+                j--;
+            }
+            order[j] = current;
+        }
+        
+        // Time already spent counts toward the allocation
+        double spent = 0.0;
+        for (int i = 0; i < num_stocks; i++) {
+            spent += seconds_spent[i];
+        }
+        double eps2 = weighted / (pass_budget + spent);
+        
+        int progressed = 0;
+        for (int k = 0; k < num_stocks && !budget.stopped; k++) {
+            int i = order[k];
+            uint64_t have = accs[i].moments.count;
+            if (targets[i] <= 0.0) {
+                continue;
+            }
+            double want = targets[i] / eps2;
+            if (want > (double)INT32_MAX) want = (double)INT32_MAX;
+            if (want < have + STREAM_CHUNK_PATHS) {
+                continue;
+            }
+            
+            double t0 = wall_seconds();
+            int finished = simulate_range(&models[i], have, (uint64_t)want, &accs[i], config, budget_round, &budget);
+            seconds_spent[i] += wall_seconds() - t0;
+            if (!finished && !budget.stopped) {
+                ok = 0;
+            }
+            progressed = 1;
+        }
+        passes++;
+        if (!progressed) {
+            break;
+        }
+    }
+    
+    FILE *output = ok ? fopen(config->output_file, "w") : NULL;
+    if (ok && !output) {
+        fprintf(stderr, "Error: Could not create output file %s\n", config->output_file);
+        ok = 0;
+    }
+    
+    if (ok) {
+        uint64_t total_paths = 0;
+        for (int i = 0; i < num_stocks; i++) {
+            total_paths += accs[i].moments.count;
+        }
+        char description[MAX_LINE_LENGTH + 64];
+        snprintf(description, sizeof(description), "%s (time budget %.1fs)", config->input_file, config->time_budget);
+        write_run_header(output, description, total_paths / num_stocks, config->volatility_factor, config->seed);
+        
+        for (int i = 0; i < num_stocks; i++) {
+            write_accumulator_report(output, &stocks[i], forecast_means[i], forecast_stds[i], &accs[i], config);
+        }
+        
+        fprintf(output, "TIME-BUDGET PRECISION REPORT:\n");
+        fprintf(output, "=============================\n");
+        fprintf(output, "Budget: %.1fs | Used: %.1fs | Allocation passes: %d | %s\n", config->time_budget,
+                wall_seconds() - start, passes, budget.stopped ? "stopped on budget" : "allocation complete");
+        fprintf(output, "%-*s %12s %10s %10s %10s %10s\n", MAX_TICKER_LENGTH, "Ticker", "Paths", "us/path",
+                "RelSE Mean", "RelSE V95", "RelSE V99");
+        for (int i = 0; i < num_stocks; i++) {
+            double rm, r95, r99;
+            budget_relative_error(&accs[i], &rm, &r95, &r99);
+            fprintf(output, "%-*s %12llu %10.3f %9.3f%% %9.3f%% %9.3f%%\n", MAX_TICKER_LENGTH, stocks[i].ticker,
+                    (unsigned long long)accs[i].moments.count, seconds_spent[i] * 1e6 / accs[i].moments.count,
+                    rm * 100, r95 * 100, r99 * 100);
+        }
+        fprintf(output, "\n");
+        fclose(output);
+    }
+    
+    for (int i = 0; accs && i < num_stocks; i++) {
+        accumulator_free(&accs[i]);
+    }
+    free(accs);
+    free(models);
+    free(forecast_means);
+    free(forecast_stds);
+    free(seconds_spent);
+    free(targets);
+    free(errors);
+    free(order);
+    return ok;
+}
+
+/*
+ * Equal-weight portfolio of all tickers under --factors or --t-copula.
+ * Member paths are the same paths the per-ticker reports used, so the
+ * portfolio is consistent with them; every path draws the shared factors
+ * once.
+ */
+int run_factor_portfolio(const StockData *stocks, int num_stocks, FILE *output, const SimulationConfig *config) {
+    for (int i = 1; i < num_stocks; i++) {
+        if (stocks[i].num_years != stocks[0].num_years || stocks[i].years[0] != stocks[0].years[0]) {
+            fprintf(stderr, "Warning: Tickers cover different forecast periods; skipping the portfolio\n");
+            return 1;
+        }
+    }
+    
+    PathModel *members = calloc(num_stocks, sizeof(PathModel));
+    if (!members) {
+        fprintf(stderr, "Error: Memory allocation failed for portfolio members\n");
+        return 0;
+    }
+    
+    StockData portfolio = stocks[0];
+    snprintf(portfolio.ticker, MAX_TICKER_LENGTH, "PORTFOLIO");
+    memset(portfolio.growth_rates, 0, sizeof(portfolio.growth_rates));
+    double forecast_mean = 0.0, forecast_std = 0.0;
+    
+    const FactorLoadings *factors = config->factors;
+    int num_factors = factors ? factors->num_factors : 0;
+    fprintf(output, "\n====================================================================================\n");
+    fprintf(output, "DEPENDENCE MODEL (%d factor%s", num_factors, num_factors == 1 ? "" : "s");
+    if (config->copula) {
+        fprintf(output, ", t-copula with %g degrees of freedom", config->copula_dof);
+    }
+    if (config->regimes) {
+        fprintf(output, ", %d shared regimes", config->regimes->num_regimes);
+    }
+    fprintf(output, "; equal-weight portfolio of %d tickers)\n", num_stocks);
+    fprintf(output, "====================================================================================\n");
+    fprintf(output, "%-12s", "Ticker");
+    for (int k = 0; k < num_factors; k++) {
+        fprintf(output, " %10s", factors->names[k]);
+    }
+    fprintf(output, " %14s\n", "Idiosyncratic");
+    
+    for (int i = 0; i < num_stocks; i++) {
+        double mean;
+        double std = compute_forecast_std(&stocks[i], config->volatility_factor, &mean);
+        path_model_init(&members[i], &stocks[i], std, config);
+        forecast_mean += mean / num_stocks;
+        forecast_std += std / num_stocks;
+        for (int year = 0; year < portfolio.num_years; year++) {
+            portfolio.growth_rates[year] += stocks[i].growth_rates[year] / num_stocks;
+        }
+        
+        fprintf(output, "%-12s", stocks[i].ticker);
+        for (int k = 0; k < num_factors; k++) {
+            fprintf(output, " %10.3f", members[i].loadings[k]);
+        }
+        fprintf(output, " %14.3f\n", members[i].idiosyncratic);
+    }
+    
+    PathModel model;
+    portfolio_model_init(&model, &portfolio, members, num_stocks);
+    
+    PathAccumulator acc;
+    int ok = accumulator_init(&acc, portfolio.num_years, (config->metrics & METRIC_YEARS) != 0, path_barriers(config),
+                              (config->metrics & METRIC_FAN) != 0);
+    if (ok) {
+        printf("Running Monte Carlo simulation for the equal-weight portfolio...\n");
+        ok = simulate_range(&model, 0, config->num_simulations, &acc, config, NULL, NULL);
+    }
+    if (ok) {
+        write_accumulator_report(output, &portfolio, forecast_mean, forecast_std, &acc, config);
+    }
+    
+    accumulator_free(&acc);
+    free(members);
+    return ok;
+}
+
+/*
+ * --analytic: report every ticker from the closed-form approximation.
+ * Tickers whose estimated error exceeds --analytic-tolerance, or whose
+ * growth factors can go negative (outside the lognormal's support), are
+ * simulated with the exact engine instead.
+ */
+int run_analytic(StockData *stocks, int num_stocks, const SimulationConfig *config) {
+    FILE *output = fopen(config->output_file, "w");
+    if (!output) {
+        fprintf(stderr, "Error: Could not create output file %s\n", config->output_file);
+        return 0;
+    }
+    
+    write_run_header(output, config->input_file, config->num_simulations, config->volatility_factor, config->seed);
+    
+    int simulated = 0;
+    for (int i = 0; i < num_stocks; i++) {
+        double start = wall_seconds();
+        double forecast_mean;
+        double forecast_std = compute_forecast_std(&stocks[i], config->volatility_factor, &forecast_mean);
+        if (!stock_is_gaussian(config, &stocks[i])) {
+            printf("Analytic estimate for %s needs independent Gaussian years; simulating...\n", stocks[i].ticker);
+            run_monte_carlo(&stocks[i], output, config, NULL);
+            simulated++;
             continue;
         }
         
-        // Parse year and growth rate
-        if (in_forecast && strlen(line) > 0) {
-            int year;
-            double growth;
-            if ((sscanf(line, "%d: %lf%%", &year, &growth) == 2 || 
-                 sscanf(line, "%d %lf%%", &year, &growth) == 2) && 
-                stocks[stock_count].num_years < MAX_YEARS) {
-                int idx = stocks[stock_count].num_years;
-                stocks[stock_count].years[idx] = year;
-                stocks[stock_count].growth_rates[idx] = growth;
-                stocks[stock_count].num_years++;
+        AnalyticModel model;
+        analytic_model_init(&model, &stocks[i], forecast_std);
+        
+        if (model.error > config->analytic_tolerance || model.negative_factor > ANALYTIC_MAX_NEGATIVE_PROB) {
+            printf("Analytic estimate for %s is outside tolerance (error %.2f pp, P(factor<=0) %.2g); simulating...\n",
+                   stocks[i].ticker, model.error, model.negative_factor);
+            run_monte_carlo(&stocks[i], output, config, NULL);
+            simulated++;
+            continue;
+        }
+        
+        write_analytic_report(output, &stocks[i], forecast_mean, forecast_std, &model, config);
+        if (config->verbose) {
+            printf("Analytic estimate for %s: %.1f us, error +/-%.2f pp\n",
+                   stocks[i].ticker, (wall_seconds() - start) * 1e6, model.error);
+        }
+    }
+    
+    fclose(output);
+    printf("%d of %d ticker(s) answered analytically\n", num_stocks - simulated, num_stocks);
+    return 1;
+}
+
+/*
+ * Simulate one ticker's baseline and stressed variants on common random
+ * numbers. Every variant has its own PathModel, so its adjusted standard
+ * deviation follows its stressed rates exactly as a rerun on the edited
+ * forecasts would; all variants draw the same path indices from the
+ * counter-based streams. models[0] is the baseline; chunk accumulators
+ * are merged in chunk order as in simulate_range.
+ */
+int simulate_stress(const PathModel *models, int num_variants, PathAccumulator *totals,
+                    const SimulationConfig *config) {
+    const StockData *stock = models[0].stock;
+    int num_threads = config->num_threads > 0 ? config->num_threads : 1;
+    PathAccumulator *chunks = calloc((size_t)num_threads * num_variants, sizeof(PathAccumulator));
+    if (!chunks) {
+        fprintf(stderr, "Error: Memory allocation failed for stress accumulators\n");
+        return 0;
+    }
+    
+    int ok = 1;
+    for (int i = 0; i < num_threads * num_variants && ok; i++) {
+        ok = accumulator_init(&chunks[i], stock->num_years, 0, NULL, 0);
+    }
+    
+    uint64_t end = (uint64_t)config->num_simulations;
+    uint64_t num_chunks = (end + STREAM_CHUNK_PATHS - 1) / STREAM_CHUNK_PATHS;
+    for (uint64_t round = 0; ok && round < num_chunks; round += num_threads) {
+        int in_round = (int)(num_chunks - round < (uint64_t)num_threads ? num_chunks - round : (uint64_t)num_threads);
+        
+        #pragma omp parallel for num_threads(num_threads) schedule(static, 1) if(num_threads > 1)
+        for (int c = 0; c < in_round; c++) {
+            PathAccumulator *acc = &chunks[(size_t)c * num_variants];
+            uint64_t lo = (round + c) * STREAM_CHUNK_PATHS;
+            uint64_t hi = lo + STREAM_CHUNK_PATHS < end ? lo + STREAM_CHUNK_PATHS : end;
+            double annual[MAX_YEARS];
+            
+            for (int v = 0; v < num_variants; v++) {
+                accumulator_reset(&acc[v]);
+            }
+            for (uint64_t path = lo; path < hi; path++) {
+                for (int v = 0; v < num_variants; v++) {
+                    accumulator_add_path(&acc[v], simulate_path(&models[v], path, annual), annual);
+                }
+            }
+        }
+        
+        for (int c = 0; c < in_round; c++) {
+            for (int v = 0; v < num_variants; v++) {
+                accumulator_merge(&totals[v], &chunks[(size_t)c * num_variants + v]);
             }
         }
     }
     
-    // Check if we ended on an active forecast section
-    if (in_forecast && stocks[stock_count].num_years > 0) {
-        stock_count++;
+    for (int i = 0; i < num_threads * num_variants; i++) {
+        accumulator_free(&chunks[i]);
+    }
+    free(chunks);
+    return ok;
+}
+
+/*
+ * --stress: one table of every ticker under the baseline and each
+ * scenario that touches it, all on common random numbers. Each scenario
+ * row matches a rerun on forecasts edited by its rules, including the
+ * adjusted standard deviation those edited rates imply.
+ */
+int run_stress(const StockData *stocks, int num_stocks, const SimulationConfig *config) {
+    const StressFile *stress = config->stress;
+    StockData *variants = malloc((MAX_STRESS_SCENARIOS + 1) * sizeof(StockData));
+    PathModel *models = malloc((MAX_STRESS_SCENARIOS + 1) * sizeof(PathModel));
+    PathAccumulator *totals = malloc((MAX_STRESS_SCENARIOS + 1) * sizeof(PathAccumulator));
+    if (!variants || !models || !totals) {
+        fprintf(stderr, "Error: Memory allocation failed for stress scenarios\n");
+        free(variants);
+        free(models);
+        free(totals);
+        return 0;
+    }
+    FILE *output = fopen(config->output_file, "w");
+    if (!output) {
+        fprintf(stderr, "Error: Could not create output file %s\n", config->output_file);
+        free(variants);
+        free(models);
+        free(totals);
+        return 0;
     }
     
-    fclose(file);
-    *stocks_ptr = stocks;
-    return stock_count;
+    write_run_header(output, config->input_file, config->num_simulations, config->volatility_factor, config->seed);
+    fprintf(output, "STRESS SCENARIOS (%d scenario(s), on common random numbers):\n", stress->num_scenarios);
+    fprintf(output, "====================================================================================\n");
+    fprintf(output, "%-10s%-20s%9s %9s %9s %9s %9s %9s %9s %9s\n", "Ticker", "Scenario", "Mean", "vs Base",
+            "Std Dev", "Median", "VaR 95", "VaR 99", "P(Loss)", "P(<-10%)");
+    
+    int ok = 1;
+    for (int i = 0; ok && i < num_stocks; i++) {
+        const StockData *stock = &stocks[i];
+        const char *names[MAX_STRESS_SCENARIOS + 1] = { "baseline" };
+        int num_variants = 1;
+        variants[0] = *stock;
+        for (int k = 0; ok && k < stress->num_scenarios; k++) {
+            variants[num_variants] = *stock;
+            int matched = apply_stress(stress, k, &variants[num_variants]);
+            ok = matched >= 0;
+            if (matched > 0) {
+                names[num_variants++] = stress->names[k];
+            }
+        }
+        if (!ok) {
+            break;
+        }
+        printf("Stressing %s under %d scenario(s)...\n", stock->ticker, num_variants - 1);
+        
+        for (int v = 0; v < num_variants; v++) {
+            double forecast_mean;
+            double forecast_std = compute_forecast_std(&variants[v], config->volatility_factor, &forecast_mean);
+            path_model_init(&models[v], &variants[v], forecast_std, config);
+        }
+        
+        int initialised = 0;
+        while (ok && initialised < num_variants) {
+            ok = accumulator_init(&totals[initialised++], stock->num_years, 0, NULL, 0);
+        }
+        ok = ok && simulate_stress(models, num_variants, totals, config);
+        
+        double base_mean = totals[0].moments.mean;
+        for (int v = 0; ok && v < num_variants; v++) {
+            Statistics stats = accumulator_statistics(&totals[v]);
+            double n = (double)totals[v].moments.count;
+            fprintf(output, "%-10s%-20s%8.2f%% ", v == 0 ? stock->ticker : "", names[v], stats.mean);
+            if (v == 0) {
+                fprintf(output, "%9s ", "");
+            } else {
+                fprintf(output, "%+7.2fpp ", stats.mean - base_mean);
+            }
+            fprintf(output, "%8.2f%% %8.2f%% %8.2f%% %8.2f%% %8.2f%% %8.2f%%\n", stats.std_dev, stats.percentile_50,
+                    stats.var_95, stats.var_99, (n - totals[v].prob_positive) * 100.0 / n,
+                    totals[v].prob_below_neg10 * 100.0 / n);
+        }
+        for (int v = 0; v < initialised; v++) {
+            accumulator_free(&totals[v]);
+        }
+    }
+    
+    fclose(output);
+    free(variants);
+    free(models);
+    free(totals);
+    return ok;
+}
+
+// Cached paths of one ticker for the reverse stress solver
+typedef struct {
+    const double *annual;      // num_paths x num_years baseline returns, path-major
+    double *finals;            // scratch for one evaluation
+    int num_paths;
+    int num_years;
+    int num_threads;
+    int evaluations;
+} ReversePaths;
+
+/*
+ * Reverse stress objective after lowering year y's growth by
+ * shift * weights[y] on every cached path: VaR in percent loss, or the
+ * probability in percent of losing more than the loss level.
+ */
+static double reverse_objective(ReversePaths *paths, const ReverseStress *reverse, const double *weights, double shift) {
+    int n = paths->num_paths, num_years = paths->num_years;
+    double *finals = paths->finals;
+    paths->evaluations++;
+    
+    #pragma omp parallel for num_threads(paths->num_threads) if(paths->num_threads > 1)
+    for (int i = 0; i < n; i++) {
+        const double *annual = paths->annual + (size_t)i * num_years;
+        double cumulative_growth = 1.0;
+        for (int year = 0; year < num_years; year++) {
+            cumulative_growth *= 1.0 + (annual[year] - shift * weights[year]) / 100.0;
+        }
+        finals[i] = (cumulative_growth - 1.0) * 100.0;
+    }
+    
+    if (reverse->kind == REVERSE_LOSS_PROBABILITY) {
+        int losses = 0;
+        for (int i = 0; i < n; i++) {
+            losses += finals[i] < -reverse->loss_level;
+        }
+        return losses * 100.0 / n;
+    }
+    size_t k = (size_t)((reverse->kind == REVERSE_VAR_99 ? 0.01 : 0.05) * n);
+    select_kth(finals, n, k);
+    return -finals[k];
+}
+
+/*
+ * Smallest downgrade d >= 0 (growth points per weighted year) at which the
+ * objective reaches the limit. The draws are fixed, so every path's final
+ * value falls monotonically in d and VaR and the loss probability rise
+ * with it: bracket by doubling, then Illinois false-position steps. Returns NAN
+ * when even REVERSE_MAX_SHIFT does not reach the limit.
+ */
+double reverse_solve(ReversePaths *paths, const ReverseStress *reverse, const double *weights) {
+    double lo = 0.0, f_lo = reverse_objective(paths, reverse, weights, 0.0) - reverse->limit;
+    if (f_lo >= 0) {
+        return 0.0;
+    }
+    double hi = REVERSE_INITIAL_SHIFT, f_hi;
+    while ((f_hi = reverse_objective(paths, reverse, weights, hi) - reverse->limit) < 0) {
+        if (hi >= REVERSE_MAX_SHIFT) {
+            return NAN;
+        }
+        lo = hi;
+        f_lo = f_hi;
+        hi = hi * 2 < REVERSE_MAX_SHIFT ? hi * 2 : REVERSE_MAX_SHIFT;
+    }
+    
+    int side = 0;
+    for (int iteration = 0; iteration < REVERSE_MAX_ITERATIONS && hi - lo > REVERSE_TOLERANCE; iteration++) {
+        double shift = (lo * f_hi - hi * f_lo) / (f_hi - f_lo);
+        if (!(shift > lo && shift < hi)) {
+            shift = 0.5 * (lo + hi);
+        }
+        double f = reverse_objective(paths, reverse, weights, shift) - reverse->limit;
+        if (f >= 0) {
+            hi = shift;
+            f_hi = f;
+            if (side == 1) f_lo *= 0.5;   // Illinois: the stale end is pulled in
+            side = 1;
+        } else {
+            lo = shift;
+            f_lo = f;
+            if (side == -1) f_hi *= 0.5;
+            side = -1;
+        }
+    }
+    return hi;
+}
+
+/*
+ * --reverse-stress: per ticker, the smallest uniform growth downgrade and
+ * the smallest downgrade of each single year that make the limit bind.
+ * Paths are simulated once and cached; every solver step only recompounds
+ * them, so all the solves share the same random numbers.
+ */
+int run_reverse_stress(const StockData *stocks, int num_stocks, const SimulationConfig *config) {
+    const ReverseStress *reverse = &config->reverse;
+    int n = config->num_simulations;
+    FILE *output = fopen(config->output_file, "w");
+    if (!output) {
+        fprintf(stderr, "Error: Could not create output file %s\n", config->output_file);
+        return 0;
+    }
+    
+    char limit[MAX_LINE_LENGTH];
+    if (reverse->kind == REVERSE_LOSS_PROBABILITY) {
+        snprintf(limit, sizeof(limit), "P(loss > %.2f%%) >= %.2f%%", reverse->loss_level, reverse->limit);
+    } else {
+        snprintf(limit, sizeof(limit), "VaR %d >= %.2f%%", reverse->kind == REVERSE_VAR_99 ? 99 : 95, reverse->limit);
+    }
+    write_run_header(output, config->input_file, config->num_simulations, config->volatility_factor, config->seed);
+    fprintf(output, "REVERSE STRESS (smallest growth downgrade, in points per year, until %s):\n", limit);
+    fprintf(output, "====================================================================================\n");
+    fprintf(output, "%-10s%10s %10s   %s\n", "Ticker", "Baseline", "Uniform", "Single-year downgrades");
+    
+    int ok = 1;
+    for (int i = 0; ok && i < num_stocks; i++) {
+        const StockData *stock = &stocks[i];
+        int num_years = stock->num_years;
+        double start = wall_seconds();
+        printf("Solving reverse stress for %s...\n", stock->ticker);
+        
+        double *annual = malloc((size_t)n * num_years * sizeof(double));
+        double *finals = malloc((size_t)n * sizeof(double));
+        if (!annual || !finals) {
+            fprintf(stderr, "Error: Memory allocation failed for reverse stress paths\n");
+            free(annual);
+            free(finals);
+            ok = 0;
+            break;
+        }
+        
+        double forecast_mean;
+        double forecast_std = compute_forecast_std(stock, config->volatility_factor, &forecast_mean);
+        PathModel model;
+        path_model_init(&model, stock, forecast_std, config);
+        #pragma omp parallel for num_threads(config->num_threads) if(config->num_threads > 1)
+        for (int sim = 0; sim < n; sim++) {
+            simulate_path(&model, sim, annual + (size_t)sim * num_years);
+        }
+        
+        ReversePaths paths = { annual, finals, n, num_years, config->num_threads, 0 };
+        double weights[MAX_YEARS];
+        for (int year = 0; year < num_years; year++) {
+            weights[year] = 1.0;
+        }
+        double baseline = reverse_objective(&paths, reverse, weights, 0.0);
+        double uniform = reverse_solve(&paths, reverse, weights);
+        
+        fprintf(output, "%-10s%9.2f%% ", stock->ticker, baseline);
+        if (isnan(uniform)) {
+            fprintf(output, "%10s  ", "none");
+        } else {
+            fprintf(output, "%8.2fpp  ", uniform);
+        }
+        for (int year = 0; year < num_years; year++) {
+            for (int other = 0; other < num_years; other++) {
+                weights[other] = other == year;
+            }
+            double single = reverse_solve(&paths, reverse, weights);
+            if (isnan(single)) {
+                fprintf(output, " %d: none", stock->years[year]);
+            } else {
+                fprintf(output, " %d: %.2fpp", stock->years[year], single);
+            }
+        }
+        fprintf(output, "\n");
+        
+        if (config->verbose) {
+            printf("  %d evaluations in %.1f ms\n", paths.evaluations, (wall_seconds() - start) * 1e3);
+        }
+        free(annual);
+        free(finals);
+    }
+    
+    fclose(output);
+    return ok;
 }
 
-void run_monte_carlo(StockData *stock, FILE *output, const SimulationConfig *config) {
-    if (!stock || !output) {
-        fprintf(stderr, "Error: Invalid stock data or output file\n");
-        return;
-    }
+/*
+ * Importance-sampled tail report. Shocks are tilted so the sum of the
+ * yearly shocks is centred on the --importance tail level; weighted
+ * estimators then give VaR and loss probabilities deep in the tail. VaR
+ * intervals invert the 95% interval of the weighted CDF at each level.
+ */
+void run_importance_sampling(StockData *stock, FILE *output, const SimulationConfig *config) {
+    static const double var_levels[] = { 0.05, 0.01, 0.005, 0.001, 0.0001 };
+    static const double loss_thresholds[] = { -10.0, -25.0, -50.0, -75.0 };
+    int num_levels = sizeof(var_levels) / sizeof(var_levels[0]);
+    int num_losses = sizeof(loss_thresholds) / sizeof(loss_thresholds[0]);
     
-    double *final_values = malloc(config->num_simulations * sizeof(double));
-    if (!final_values) {
-        fprintf(stderr, "Error: Memory allocation failed for simulation results\n");
+    // The likelihood ratio below is that of shifted independent Gaussian years
+    if (!stock_is_gaussian(config, stock)) {
+        printf("Importance sampling for %s needs independent Gaussian years; simulating...\n", stock->ticker);
+        run_monte_carlo(stock, output, config, NULL);
         return;
     }
     
-    double *annual_returns = malloc(config->num_simulations * stock->num_years * sizeof(double));
-    if (!annual_returns) {
-        fprintf(stderr, "Error: Memory allocation failed for annual returns\n");
-        free(final_values);
+    int n = config->num_simulations;
+    WeightedValue *items = malloc((size_t)n * sizeof(WeightedValue));
+    if (!items) {
+        fprintf(stderr, "Error: Memory allocation failed for weighted paths\n");
         return;
     }
     
-    fprintf(output, "\n====================================================================================\n");
-    fprintf(output, "MONTE CARLO SIMULATION RESULTS FOR %s\n", stock->ticker);
-    fprintf(output, "====================================================================================\n");
-    fprintf(output, "Number of Simulations: %d\n", config->num_simulations);
-    fprintf(output, "Forecast Period: %d-%d (%d years)\n", 
-            stock->years[0], stock->years[stock->num_years-1], stock->num_years);
+    double forecast_mean;
+    double forecast_std = compute_forecast_std(stock, config->volatility_factor, &forecast_mean);
+    PathModel model;
+    path_model_init(&model, stock, forecast_std, config);
+    double tilt = -normal_quantile(config->importance_level) / sqrt((double)stock->num_years);
     
-    // Calculate base statistics from forecasted growth rates
-    double forecast_mean = 0.0;
-    for (int i = 0; i < stock->num_years; i++) {
-        forecast_mean += stock->growth_rates[i];
+    #pragma omp parallel for num_threads(config->num_threads) if(config->num_threads > 1)
+    for (int sim = 0; sim < n; sim++) {
+        items[sim].value = simulate_tilted_path(&model, sim, tilt, &items[sim].weight);
     }
-    forecast_mean /= stock->num_years;
     
-    double forecast_std = 0.0;
-    for (int i = 0; i < stock->num_years; i++) {
-        double diff = stock->growth_rates[i] - forecast_mean;
-        forecast_std += diff * diff;
+    double sum_w = 0.0, sum_w2 = 0.0;
+    for (int sim = 0; sim < n; sim++) {
+        sum_w += items[sim].weight;
+        sum_w2 += items[sim].weight * items[sim].weight;
     }
-    forecast_std = sqrt(forecast_std / stock->num_years);
-    
-    // Add volatility adjustment
-    forecast_std *= config->volatility_factor;
     
-    fprintf(output, "Base Forecast Mean Growth: %.2f%%\n", forecast_mean);
-    fprintf(output, "Adjusted Standard Deviation: %.2f%%\n", forecast_std);
-    fprintf(output, "Volatility Factor Applied: %.1fx\n\n", config->volatility_factor);
+    write_ticker_header(output, stock, n, forecast_mean, forecast_std, config);
+    fprintf(output, "IMPORTANCE-SAMPLED TAIL RISK:\n");
+    fprintf(output, "-----------------------------\n");
+    fprintf(output, "Tilt: %.3f std devs per year toward the %g tail | Effective sample size: %.0f\n\n",
+            tilt, config->importance_level, sum_w * sum_w / sum_w2);
     
-    // Run simulations - use OpenMP if available
-    #pragma omp parallel for num_threads(config->num_threads) if(config->num_threads > 1)
-    for (int sim = 0; sim < config->num_simulations; sim++) {
-        double cumulative_growth = 1.0;
-        
-        for (int year = 0; year < stock->num_years; year++) {
-            // Use forecasted growth as mean with added uncertainty
-            double expected_growth = stock->growth_rates[year];
-            double simulated_growth = generate_normal(expected_growth, forecast_std);
-            
-            annual_returns[sim * stock->num_years + year] = simulated_growth;
-            cumulative_growth *= (1.0 + simulated_growth / 100.0);
+    fprintf(output, "Confidence      VaR      95%% interval\n");
+    for (int l = 0; l < num_levels; l++) {
+        double p = var_levels[l];
+        if (p < config->importance_level / 2) {
+            continue;
         }
+        double q = select_weighted(items, n, p * n);
         
-        // Final value as percentage change from initial
-        final_values[sim] = (cumulative_growth - 1.0) * 100.0;
-        
-        // Display progress in verbose mode
-        if (config->verbose && sim % (config->num_simulations / 10) == 0) {
-            #pragma omp critical
-            {
-                printf("\rRunning simulations for %s: %d%%", stock->ticker, (sim * 100) / config->num_simulations);
-                fflush(stdout);
+        // Standard error of the weighted CDF at the quantile
+        double tail_w2 = 0.0;
+        for (int sim = 0; sim < n; sim++) {
+            if (items[sim].value <= q) {
+                tail_w2 += items[sim].weight * items[sim].weight;
             }
         }
+        double se = sqrt(fmax(tail_w2 / n - p * p, 0.0) / n);
+        double upper = -select_weighted(items, n, fmax(p - 1.96 * se, 0.0) * n);
+        double lower = -select_weighted(items, n, (p + 1.96 * se) * n);
+        fprintf(output, "  %7.2f%%  %8.2f%%  [%7.2f%%, %7.2f%%]\n", (1.0 - p) * 100.0, -q, lower, upper);
     }
     
-    if (config->verbose) {
-        printf("\rRunning simulations for %s: 100%%\n", stock->ticker);
+    fprintf(output, "\nLoss threshold   Probability   Std error   Variance reduction\n");
+    for (int t = 0; t < num_losses; t++) {
+        double x = loss_thresholds[t];
+        double hit_w = 0.0, hit_w2 = 0.0;
+        for (int sim = 0; sim < n; sim++) {
+            if (items[sim].value < x) {
+                hit_w += items[sim].weight;
+                hit_w2 += items[sim].weight * items[sim].weight;
+            }
+        }
+        double prob = hit_w / n;
+        double variance = fmax(hit_w2 / n - prob * prob, 0.0) / n;
+        if (prob > 0 && variance > 0) {
+            fprintf(output, "  < %6.1f%%     %10.4e  %10.2e   %9.1fx\n", x, prob, sqrt(variance),
+                    prob * (1.0 - prob) / n / variance);
+        } else {
+            fprintf(output, "  < %6.1f%%     %10.4e  %10s   %10s\n", x, prob, "-", "-");
+        }
     }
     
-    // Calculate statistics
-    Statistics stats = calculate_statistics(final_values, config->num_simulations);
-    
-    // Output detailed results
-    fprintf(output, "SIMULATION SUMMARY STATISTICS:\n");
-    fprintf(output, "------------------------------\n");
-    fprintf(output, "Mean Cumulative Growth:     %8.2f%%\n", stats.mean);
-    fprintf(output, "Standard Deviation:         %8.2f%%\n", stats.std_dev);
-    fprintf(output, "Minimum Growth:             %8.2f%%\n", stats.min);
-    fprintf(output, "Maximum Growth:             %8.2f%%\n", stats.max);
-    fprintf(output, "\nPERCENTILE ANALYSIS:\n");
-    fprintf(output, "--------------------\n");
-    fprintf(output, "5th Percentile (Worst 5%%):  %8.2f%%\n", stats.percentile_5);
-    fprintf(output, "25th Percentile:            %8.2f%%\n", stats.percentile_25);
-    fprintf(output, "50th Percentile (Median):   %8.2f%%\n", stats.percentile_50);
-    fprintf(output, "75th Percentile:            %8.2f%%\n", stats.percentile_75);
-    fprintf(output, "95th Percentile (Best 5%%):  %8.2f%%\n", stats.percentile_95);
-    
-    fprintf(output, "\nRISK METRICS:\n");
-    fprintf(output, "-------------\n");
-    fprintf(output, "Value at Risk (95%% confidence): %8.2f%%\n", stats.var_95);
-    fprintf(output, "Value at Risk (99%% confidence): %8.2f%%\n", stats.var_99);
+    write_ticker_footer(output, stock);
+    free(items);
+}
+
+typedef struct {
+    PartialTickerHeader info;
+    PathAccumulator acc;
+    uint64_t (*ranges)[2];
+    int num_ranges;
+} MergedTicker;
+
+static int compare_ranges(const void *a, const void *b) {
+    const uint64_t *ra = a, *rb = b;
+    return (ra[0] > rb[0]) - (ra[0] < rb[0]);
+}
+
+void parse_args(int argc, char **argv, SimulationConfig *config);
+
+// `merge` subcommand: combine partial-result files into the final report
+int merge_main(int argc, char **argv) {
+    SimulationConfig config;
+    parse_args(argc, argv, &config);
     
-    // Probability analysis
-    int prob_positive = 0, prob_above_10 = 0, prob_above_20 = 0, prob_below_neg10 = 0;
-    for (int i = 0; i < config->num_simulations; i++) {
-        if (final_values[i] > 0) prob_positive++;
-        if (final_values[i] > 10) prob_above_10++;
-        if (final_values[i] > 20) prob_above_20++;
-        if (final_values[i] < -10) prob_below_neg10++;
+    int num_files = argc - optind;
+    if (num_files < 1) {
+        fprintf(stderr, "Error: merge needs at least one partial-result file\n");
+        return 1;
     }
     
-    fprintf(output, "\nPROBABILITY ANALYSIS:\n");
-    fprintf(output, "---------------------\n");
-    fprintf(output, "Probability of Positive Growth:  %6.2f%%\n", (prob_positive * 100.0) / config->num_simulations);
-    fprintf(output, "Probability of >10%% Growth:      %6.2f%%\n", (prob_above_10 * 100.0) / config->num_simulations);
-    fprintf(output, "Probability of >20%% Growth:      %6.2f%%\n", (prob_above_20 * 100.0) / config->num_simulations);
-    fprintf(output, "Probability of <-10%% Loss:       %6.2f%%\n", (prob_below_neg10 * 100.0) / config->num_simulations);
-    
-    // Create histogram
-    create_histogram(final_values, config->num_simulations, output, config->graph_width, config->graph_height);
-    
-    // Export CSV if requested
-    if (config->export_csv) {
-        export_csv(stock->ticker, final_values, config->num_simulations, config);
-    }
+    PartialFileHeader first = {0};
+    MergedTicker *tickers = NULL;
+    int num_tickers = 0;
+    int ok = 1;
     
-    // Year-by-year analysis
-    fprintf(output, "YEAR-BY-YEAR ANALYSIS:\n");
-    fprintf(output, "======================\n");
-    for (int year = 0; year < stock->num_years; year++) {
-        double *year_returns = malloc(config->num_simulations * sizeof(double));
-        if (!year_returns) {
-            fprintf(stderr, "Error: Memory allocation failed for year-by-year analysis\n");
-            continue;
+    for (int f = 0; ok && f < num_files; f++) {
+        const char *filename = argv[optind + f];
+        FILE *partial = fopen(filename, "rb");
+        if (!partial) {
+            fprintf(stderr, "Error: Could not open partial-result file %s\n", filename);
+            ok = 0;
+            break;
         }
         
-        for (int sim = 0; sim < config->num_simulations; sim++) {
-            year_returns[sim] = annual_returns[sim * stock->num_years + year];
+        PartialFileHeader header;
+        if (!read_block(partial, &header, sizeof(header)) || memcmp(header.magic, PARTIAL_MAGIC, 8) != 0 ||
+            header.version != PARTIAL_VERSION) {
+            fprintf(stderr, "Error: %s is not a partial-result file\n", filename);
+            fclose(partial);
+            ok = 0;
+            break;
+        }
+        if (f == 0) {
+            first = header;
+        } else if (header.seed != first.seed || header.total_simulations != first.total_simulations ||
+                   header.volatility_factor != first.volatility_factor ||
+                   header.model_fingerprint != first.model_fingerprint ||
+                   (header.with_path_risk && first.with_path_risk && !barriers_equal(&header.barriers, &first.barriers))) {
+            fprintf(stderr, "Error: %s was produced by a different run (seed, simulations, volatility, model or "
+                    "barriers differ)\n", filename);
+            fclose(partial);
+            ok = 0;
+            break;
         }
         
-        Statistics year_stats = calculate_statistics(year_returns, config->num_simulations);
-        
-        fprintf(output, "Year %d (Forecast: %.2f%%):\n", stock->years[year], stock->growth_rates[year]);
-        fprintf(output, "  Simulated Mean: %7.2f%% | Std Dev: %6.2f%%\n", year_stats.mean, year_stats.std_dev);
-        fprintf(output, "  Range: %7.2f%% to %7.2f%% | Median: %7.2f%%\n", 
-                year_stats.min, year_stats.max, year_stats.percentile_50);
+        int reported = 0;
+        for (uint32_t t = 0; ok && t < header.num_tickers; t++) {
+            PartialTickerHeader info;
+            ok = read_block(partial, &info, sizeof(info)) && info.stock.num_years > 0 && info.stock.num_years <= MAX_YEARS;
+            if (!ok) break;
+            
+            int index = 0;
+            while (index < num_tickers && strcmp(tickers[index].info.stock.ticker, info.stock.ticker) != 0) {
+                index++;
+            }
+            if (index == num_tickers) {
+                MergedTicker *grown = realloc(tickers, (size_t)(num_tickers + 1) * sizeof(MergedTicker));
+                if (!grown) {
+                    ok = 0;
+                    break;
+                }
+                tickers = grown;
+                memset(&tickers[index], 0, sizeof(MergedTicker));
+                tickers[index].info = info;
+                ok = accumulator_init(&tickers[index].acc, info.stock.num_years, first.with_years && header.with_years,
+                                      first.with_path_risk && header.with_path_risk ? &first.barriers : NULL,
+                                      first.with_fan && header.with_fan);
+                num_tickers++;
+            } else {
+                if (stock_fingerprint(&info.stock) != stock_fingerprint(&tickers[index].info.stock) ||
+                    info.forecast_std != tickers[index].info.forecast_std) {
+                    fprintf(stderr, "Error: %s has different forecasts for %s than the earlier shards\n",
+                            filename, info.stock.ticker);
+                    ok = 0;
+                    reported = 1;
+                    break;
+                }
+                // A shard without per-year sketches, path metrics or fan sketches drops them from the merge
+                if (!header.with_years) {
+                    free(tickers[index].acc.year_sketches);
+                    tickers[index].acc.year_sketches = NULL;
+                }
+                if (!header.with_path_risk) {
+                    free(tickers[index].acc.path_risk);
+                    tickers[index].acc.path_risk = NULL;
+                }
+                if (!header.with_fan) {
+                    free(tickers[index].acc.fan_sketches);
+                    tickers[index].acc.fan_sketches = NULL;
+                }
+            }
+            
+            PathAccumulator *part = malloc(sizeof(PathAccumulator));
+            ok = ok && part && accumulator_init(part, info.stock.num_years, header.with_years,
+                                                header.with_path_risk ? &header.barriers : NULL, header.with_fan);
+            ok = ok && read_accumulator(partial, part);
+            if (ok) {
+                accumulator_merge(&tickers[index].acc, part);
+                uint64_t (*ranges)[2] = realloc(tickers[index].ranges,
+                                                (size_t)(tickers[index].num_ranges + 1) * sizeof(*ranges));
+                if (ranges) {
+                    ranges[tickers[index].num_ranges][0] = info.path_begin;
+                    ranges[tickers[index].num_ranges][1] = info.path_end;
+                    tickers[index].ranges = ranges;
+                    tickers[index].num_ranges++;
+                } else {
+                    fprintf(stderr, "Error: Memory allocation failed for shard ranges\n");
+                    ok = 0;
+                    reported = 1;
+                }
+            }
+            if (part) {
+                accumulator_free(part);
+                free(part);
+            }
+        }
         
-        free(year_returns);
+        if (!ok && !reported) {
+            fprintf(stderr, "Error: %s is truncated or corrupt\n", filename);
+        }
+        fclose(partial);
     }
     
-    fprintf(output, "\n====================================================================================\n");
-    fprintf(output, "END OF ANALYSIS FOR %s\n", stock->ticker);
-    fprintf(output, "====================================================================================\n\n\n");
+    // Shards must tile [0, total) exactly, or the merged report would misstate its path count
+    for (int t = 0; ok && t < num_tickers; t++) {
+        MergedTicker *merged = &tickers[t];
+        qsort(merged->ranges, merged->num_ranges, sizeof(*merged->ranges), compare_ranges);
+        uint64_t expected = 0;
+        for (int r = 0; ok && r < merged->num_ranges; r++) {
+            if (merged->ranges[r][0] != expected) {
+                fprintf(stderr, "Error: %s shards %s at path %llu\n", merged->info.stock.ticker,
+                        merged->ranges[r][0] > expected ? "leave a gap" : "overlap", (unsigned long long)expected);
+                ok = 0;
+            }
+            expected = merged->ranges[r][1];
+        }
+        if (ok && expected != first.total_simulations) {
+            fprintf(stderr, "Error: %s shards cover paths up to %llu of %llu\n", merged->info.stock.ticker,
+                    (unsigned long long)expected, (unsigned long long)first.total_simulations);
+            ok = 0;
+        }
+    }
+    
+    if (ok) {
+        FILE *output = fopen(config.output_file, "w");
+        if (!output) {
+            fprintf(stderr, "Error: Could not create output file %s\n", config.output_file);
+            ok = 0;
+        } else {
+            char description[MAX_LINE_LENGTH];
+            snprintf(description, sizeof(description), "%d partial-result file(s)", num_files);
+            config.volatility_factor = first.volatility_factor;
+            write_run_header(output, description, first.total_simulations, first.volatility_factor, first.seed);
+            
+            for (int t = 0; t < num_tickers; t++) {
+                MergedTicker *merged = &tickers[t];
+                write_accumulator_report(output, &merged->info.stock, merged->info.forecast_mean,
+                                         merged->info.forecast_std, &merged->acc, &config);
+            }
+            fclose(output);
+            printf("Merged %d partial-result file(s) for %d stock(s) into %s\n", num_files, num_tickers, config.output_file);
+        }
+    }
     
-    free(final_values);
-    free(annual_returns);
+    for (int t = 0; t < num_tickers; t++) {
+        accumulator_free(&tickers[t].acc);
+        free(tickers[t].ranges);
+    }
+    free(tickers);
+    return ok ? 0 : 1;
 }
 
+// Options without a short form
+enum {
+    OPT_SORT = 256,
+    OPT_METRICS,
+    OPT_SEED,
+    OPT_SHARD,
+    OPT_PARTIAL,
+    OPT_CHECKPOINT,
+    OPT_CHECKPOINT_INTERVAL,
+    OPT_RESUME,
+    OPT_STATE,
+    OPT_EXTEND_TO,
+    OPT_TIME_BUDGET,
+    OPT_ANALYTIC,
+    OPT_ANALYTIC_TOLERANCE,
+    OPT_IMPORTANCE,
+    OPT_SENSITIVITIES,
+    OPT_FACTORS,
+    OPT_T_COPULA,
+    OPT_DISTRIBUTION,
+    OPT_MODEL_FILE,
+    OPT_GARCH,
+    OPT_REGIMES,
+    OPT_REGIME_START,
+    OPT_JUMPS,
+    OPT_AR,
+    OPT_HISTORY,
+    OPT_BLOCK_LENGTH,
+    OPT_BARRIERS,
+    OPT_STRESS,
+    OPT_REVERSE_STRESS,
+    OPT_STD_ERRORS,
+    OPT_FAN_SVG
+};
+
 void parse_args(int argc, char **argv, SimulationConfig *config) {
     static struct option long_options[] = {
         {"input",       required_argument, 0, 'i'},
@@ -473,6 +6984,38 @@ void parse_args(int argc, char **argv, SimulationConfig *config) {
         {"csv",         no_argument,       0, 'c'},
         {"threads",     required_argument, 0, 't'},
         {"verbose",     no_argument,       0, 'V'},
+        {"scratch",     required_argument, 0, 'S'},
+        {"sort",        required_argument, 0, OPT_SORT},
+        {"metrics",     required_argument, 0, OPT_METRICS},
+        {"seed",        required_argument, 0, OPT_SEED},
+        {"shard",       required_argument, 0, OPT_SHARD},
+        {"partial",     required_argument, 0, OPT_PARTIAL},
+        {"checkpoint",  required_argument, 0, OPT_CHECKPOINT},
+        {"checkpoint-interval", required_argument, 0, OPT_CHECKPOINT_INTERVAL},
+        {"resume",      no_argument,       0, OPT_RESUME},
+        {"state",       required_argument, 0, OPT_STATE},
+        {"extend-to",   required_argument, 0, OPT_EXTEND_TO},
+        {"time-budget", required_argument, 0, OPT_TIME_BUDGET},
+        {"analytic",    no_argument,       0, OPT_ANALYTIC},
+        {"analytic-tolerance", required_argument, 0, OPT_ANALYTIC_TOLERANCE},
+        {"importance",  optional_argument, 0, OPT_IMPORTANCE},
+        {"sensitivities", no_argument,     0, OPT_SENSITIVITIES},
+        {"factors",     required_argument, 0, OPT_FACTORS},
+        {"t-copula",    required_argument, 0, OPT_T_COPULA},
+        {"distribution", required_argument, 0, OPT_DISTRIBUTION},
+        {"model-file",  required_argument, 0, OPT_MODEL_FILE},
+        {"garch",       required_argument, 0, OPT_GARCH},
+        {"regimes",     required_argument, 0, OPT_REGIMES},
+        {"regime-start", required_argument, 0, OPT_REGIME_START},
+        {"jumps",       required_argument, 0, OPT_JUMPS},
+        {"ar",          required_argument, 0, OPT_AR},
+        {"history",     required_argument, 0, OPT_HISTORY},
+        {"block-length", required_argument, 0, OPT_BLOCK_LENGTH},
+        {"barriers",    required_argument, 0, OPT_BARRIERS},
+        {"stress",      required_argument, 0, OPT_STRESS},
+        {"reverse-stress", required_argument, 0, OPT_REVERSE_STRESS},
+        {"std-errors",  optional_argument, 0, OPT_STD_ERRORS},
+        {"fan-svg",     no_argument,       0, OPT_FAN_SVG},
         {"help",        no_argument,       0, '?'},
         {0, 0, 0, 0}
     };
@@ -486,6 +7029,50 @@ void parse_args(int argc, char **argv, SimulationConfig *config) {
     config->graph_height = DEFAULT_GRAPH_HEIGHT;
     config->export_csv = 0;
     config->verbose = 0;
+    config->scratch_file[0] = '\0';
+    config->out_of_core = 0;
+    config->sort_algorithm = SORT_AUTO;
+    config->metrics = METRIC_ALL;
+    config->seed = ((uint64_t)time(NULL) << 20) ^ (uint64_t)getpid();
+    config->seed_set = 0;
+    config->shard_index = 0;
+    config->shard_count = 0;
+    config->partial_file[0] = '\0';
+    config->checkpoint_file[0] = '\0';
+    config->checkpoint_interval = DEFAULT_CHECKPOINT_INTERVAL;
+    config->resume = 0;
+    config->state_file[0] = '\0';
+    config->extend_to = 0;
+    config->time_budget = 0.0;
+    config->analytic = 0;
+    config->analytic_tolerance = DEFAULT_ANALYTIC_TOLERANCE;
+    config->importance_level = 0.0;
+    config->sensitivities = 0;
+    config->error_batches = 0;
+    config->fan_svg = 0;
+    config->factor_file[0] = '\0';
+    config->factors = NULL;
+    config->copula_dof = 0.0;
+    config->copula = NULL;
+    config->distribution.kind = DIST_NORMAL;
+    config->distribution.shape = 0.0;
+    config->distribution.skew = 0.0;
+    config->garch.alpha = 0.0;
+    config->garch.beta = 0.0;
+    memset(&config->jumps, 0, sizeof(config->jumps));
+    config->persistence = 0.0;
+    parse_barriers(DEFAULT_BARRIERS, &config->barriers);
+    config->stress_file[0] = '\0';
+    config->stress = NULL;
+    config->reverse.kind = REVERSE_NONE;
+    config->regime_file[0] = '\0';
+    config->regime_start[0] = '\0';
+    config->regimes = NULL;
+    config->history_file[0] = '\0';
+    config->block_length = DEFAULT_BLOCK_LENGTH;
+    config->history = NULL;
+    config->model_file[0] = '\0';
+    config->models = NULL;
     
     // Set number of threads to available cores or 1 if OpenMP not available
     #ifdef _OPENMP
@@ -497,7 +7084,7 @@ void parse_args(int argc, char **argv, SimulationConfig *config) {
     int opt;
     int option_index = 0;
     
-    while ((opt = getopt_long(argc, argv, "i:o:s:v:w:h:ct:V?", long_options, &option_index)) != -1) {
+    while ((opt = getopt_long(argc, argv, "i:o:s:v:w:h:ct:VS:?", long_options, &option_index)) != -1) {
         switch (opt) {
             case 'i':
                 strncpy(config->input_file, optarg, MAX_LINE_LENGTH - 1);
@@ -551,6 +7138,184 @@ void parse_args(int argc, char **argv, SimulationConfig *config) {
             case 'V':
                 config->verbose = 1;
                 break;
+            case 'S':
+                strncpy(config->scratch_file, optarg, MAX_LINE_LENGTH - 1);
+                config->scratch_file[MAX_LINE_LENGTH - 1] = '\0';
+                config->out_of_core = 1;
+                break;
+            case OPT_SORT:
+                if (strcmp(optarg, "radix") == 0) {
+                    config->sort_algorithm = SORT_RADIX;
+                } else if (strcmp(optarg, "sample") == 0) {
+                    config->sort_algorithm = SORT_SAMPLE;
+                } else if (strcmp(optarg, "qsort") == 0) {
+                    config->sort_algorithm = SORT_QSORT;
+                } else {
+                    if (strcmp(optarg, "auto") != 0) {
+                        fprintf(stderr, "Invalid sort algorithm '%s'. Using default: auto\n", optarg);
+                    }
+                    config->sort_algorithm = SORT_AUTO;
+                }
+                break;
+            case OPT_METRICS:
+                config->metrics = parse_metric_list(optarg);
+                if (config->metrics == 0) {
+                    fprintf(stderr, "No valid metrics in '%s'. Computing all metrics\n", optarg);
+                    config->metrics = METRIC_ALL;
+                }
+                break;
+            case OPT_SEED:
+                config->seed = strtoull(optarg, NULL, 10);
+                config->seed_set = 1;
+                break;
+            case OPT_SHARD:
+                if (sscanf(optarg, "%d/%d", &config->shard_index, &config->shard_count) != 2 ||
+                    config->shard_count <= 0 || config->shard_index < 0 || config->shard_index >= config->shard_count) {
+                    fprintf(stderr, "Invalid shard '%s'. Expected I/N with 0 <= I < N\n", optarg);
+                    exit(1);
+                }
+                break;
+            case OPT_PARTIAL:
+                strncpy(config->partial_file, optarg, MAX_LINE_LENGTH - 1);
+                config->partial_file[MAX_LINE_LENGTH - 1] = '\0';
+                break;
+            case OPT_CHECKPOINT:
+                strncpy(config->checkpoint_file, optarg, MAX_LINE_LENGTH - 1);
+                config->checkpoint_file[MAX_LINE_LENGTH - 1] = '\0';
+                break;
+            case OPT_CHECKPOINT_INTERVAL:
+                config->checkpoint_interval = atoi(optarg);
+                if (config->checkpoint_interval < 0) {
+                    fprintf(stderr, "Invalid checkpoint interval. Using default: %d\n", DEFAULT_CHECKPOINT_INTERVAL);
+                    config->checkpoint_interval = DEFAULT_CHECKPOINT_INTERVAL;
+                }
+                break;
+            case OPT_RESUME:
+                config->resume = 1;
+                break;
+            case OPT_STATE:
+                strncpy(config->state_file, optarg, MAX_LINE_LENGTH - 1);
+                config->state_file[MAX_LINE_LENGTH - 1] = '\0';
+                break;
+            case OPT_EXTEND_TO:
+                config->extend_to = atoi(optarg);
+                if (config->extend_to <= 0) {
+                    fprintf(stderr, "Invalid --extend-to path count: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case OPT_TIME_BUDGET:
+                config->time_budget = atof(optarg);
+                if (config->time_budget <= 0) {
+                    fprintf(stderr, "Invalid time budget: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case OPT_ANALYTIC:
+                config->analytic = 1;
+                break;
+            case OPT_ANALYTIC_TOLERANCE:
+                config->analytic_tolerance = atof(optarg);
+                if (config->analytic_tolerance < 0) {
+                    fprintf(stderr, "Invalid analytic tolerance. Using default: %.2f\n", DEFAULT_ANALYTIC_TOLERANCE);
+                    config->analytic_tolerance = DEFAULT_ANALYTIC_TOLERANCE;
+                }
+                break;
+            case OPT_IMPORTANCE:
+                config->importance_level = optarg ? atof(optarg) : DEFAULT_IMPORTANCE_LEVEL;
+                if (config->importance_level <= 0 || config->importance_level >= 0.5) {
+                    fprintf(stderr, "Invalid importance-sampling tail level: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case OPT_SENSITIVITIES:
+                config->sensitivities = 1;
+                break;
+            case OPT_STD_ERRORS:
+                config->error_batches = optarg ? atoi(optarg) : DEFAULT_ERROR_BATCHES;
+                if (config->error_batches < 2) {
+                    fprintf(stderr, "Invalid batch count: %s (need at least 2)\n", optarg);
+                    exit(1);
+                }
+                break;
+            case OPT_FAN_SVG:
+                config->fan_svg = 1;
+                break;
+            case OPT_FACTORS:
+                strncpy(config->factor_file, optarg, MAX_LINE_LENGTH - 1);
+                config->factor_file[MAX_LINE_LENGTH - 1] = '\0';
+                break;
+            case OPT_T_COPULA:
+                config->copula_dof = atof(optarg);
+                if (config->copula_dof <= 0) {
+                    fprintf(stderr, "Invalid t-copula degrees of freedom: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case OPT_DISTRIBUTION:
+                if (!parse_distribution(optarg, &config->distribution)) {
+                    fprintf(stderr, "Invalid distribution: %s (use normal, t:DF, skew-normal:ALPHA or nig:ALPHA,BETA)\n", optarg);
+                    exit(1);
+                }
+                break;
+            case OPT_MODEL_FILE:
+                strncpy(config->model_file, optarg, MAX_LINE_LENGTH - 1);
+                config->model_file[MAX_LINE_LENGTH - 1] = '\0';
+                break;
+            case OPT_GARCH:
+                if (!parse_garch(optarg, &config->garch)) {
+                    fprintf(stderr, "Invalid GARCH parameters: %s (use ALPHA,BETA with alpha + beta < 1)\n", optarg);
+                    exit(1);
+                }
+                break;
+            case OPT_REGIMES:
+                strncpy(config->regime_file, optarg, MAX_LINE_LENGTH - 1);
+                config->regime_file[MAX_LINE_LENGTH - 1] = '\0';
+                break;
+            case OPT_REGIME_START:
+                snprintf(config->regime_start, MAX_TICKER_LENGTH, "%s", optarg);
+                break;
+            case OPT_HISTORY:
+                strncpy(config->history_file, optarg, MAX_LINE_LENGTH - 1);
+                config->history_file[MAX_LINE_LENGTH - 1] = '\0';
+                break;
+            case OPT_BLOCK_LENGTH:
+                config->block_length = atof(optarg);
+                if (config->block_length < 1.0) {
+                    fprintf(stderr, "Invalid block length: %s (must be at least 1)\n", optarg);
+                    exit(1);
+                }
+                break;
+            case OPT_AR:
+                if (!parse_persistence(optarg, &config->persistence)) {
+                    fprintf(stderr, "Invalid AR(1) coefficient: %s (use -1 < phi < 1)\n", optarg);
+                    exit(1);
+                }
+                break;
+            case OPT_JUMPS:
+                if (!parse_jumps(optarg, &config->jumps)) {
+                    fprintf(stderr, "Invalid jump parameters: %s (use LAMBDA,MEAN,STD with 0 <= lambda <= %g)\n",
+                            optarg, JUMP_MAX_INTENSITY);
+                    exit(1);
+                }
+                break;
+            case OPT_STRESS:
+                strncpy(config->stress_file, optarg, MAX_LINE_LENGTH - 1);
+                config->stress_file[MAX_LINE_LENGTH - 1] = '\0';
+                break;
+            case OPT_REVERSE_STRESS:
+                if (!parse_reverse_stress(optarg, &config->reverse)) {
+                    fprintf(stderr, "Invalid reverse stress limit: %s (use var95:LIMIT, var99:LIMIT or loss:X,P)\n", optarg);
+                    exit(1);
+                }
+                break;
+            case OPT_BARRIERS:
+                if (!parse_barriers(optarg, &config->barriers)) {
+                    fprintf(stderr, "Invalid barriers: %s (use up to %d levels in (-100, 0], e.g. %s)\n",
+                            optarg, MAX_BARRIERS, DEFAULT_BARRIERS);
+                    exit(1);
+                }
+                break;
             case '?':
                 print_usage(argv[0]);
                 exit(0);
@@ -558,13 +7323,106 @@ void parse_args(int argc, char **argv, SimulationConfig *config) {
                 break;
         }
     }
+    
+    // The SVG is drawn from the fan chart's sketches, whatever --metrics selected
+    if (config->fan_svg) {
+        config->metrics |= METRIC_FAN;
+    }
+    
+    if (config->shard_count > 0 && config->partial_file[0] == '\0') {
+        snprintf(config->partial_file, MAX_LINE_LENGTH, "shard_%d_of_%d.part", config->shard_index, config->shard_count);
+    }
+}
+
+/*
+ * Each run mode has its own driver in main, so at most one can be chosen.
+ * Options that only the plain exact engine reads, or that only appear in
+ * the standard report, are flagged when the chosen mode would drop them.
+ */
+int check_run_modes(const SimulationConfig *config) {
+    const char *modes[] = {
+        config->shard_count > 0 ? "--shard" : NULL,
+        config->stress_file[0] != '\0' ? "--stress" : NULL,
+        config->reverse.kind != REVERSE_NONE ? "--reverse-stress" : NULL,
+        config->time_budget > 0 ? "--time-budget" : NULL,
+        config->importance_level > 0 ? "--importance" : NULL,
+        config->analytic ? "--analytic" : NULL,
+        config->state_file[0] != '\0' ? "--state" : NULL,
+        config->checkpoint_file[0] != '\0' ? "--checkpoint" : NULL,
+    };
+    const char *mode = NULL;
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        if (!modes[i]) {
+            continue;
+        }
+        if (mode) {
+            fprintf(stderr, "Error: %s cannot be combined with %s\n", mode, modes[i]);
+            return 0;
+        }
+        mode = modes[i];
+    }
+    if (!mode) {
+        return 1;
+    }
+    
+    // --analytic simulates the tickers it cannot answer with the exact engine, but without scratch
+    int own_report = config->stress_file[0] != '\0' || config->reverse.kind != REVERSE_NONE ||
+                     config->importance_level > 0;
+    struct { int set; const char *name; int ignored; } options[] = {
+        { config->export_csv,         "--csv",           !config->analytic },
+        { config->sensitivities,      "--sensitivities", !config->analytic },
+        { config->out_of_core,        "--scratch",       1 },
+        { config->error_batches > 0,  "--std-errors",    own_report },
+        { config->fan_svg,            "--fan-svg",       own_report },
+    };
+    for (size_t i = 0; i < sizeof(options) / sizeof(options[0]); i++) {
+        if (options[i].set && options[i].ignored) {
+            fprintf(stderr, "Warning: %s is ignored with %s\n", options[i].name, mode);
+        }
+    }
+    
+    // Streamed engines batch by their chunks rather than into B batches
+    int streamed = config->shard_count > 0 || config->time_budget > 0 ||
+                   config->state_file[0] != '\0' || config->checkpoint_file[0] != '\0';
+    if (streamed && config->error_batches > 0) {
+        if (config->error_batches != DEFAULT_ERROR_BATCHES) {
+            fprintf(stderr, "Warning: --std-errors=%d is ignored with %s, which batches by %d-path chunks\n",
+                    config->error_batches, mode, STREAM_CHUNK_PATHS);
+        }
+        if (config->time_budget <= 0 && config->num_simulations < 2 * STREAM_CHUNK_PATHS) {
+            fprintf(stderr, "Warning: --std-errors needs at least %d paths with %s; fewer than 2 full chunks give no SE\n",
+                    2 * STREAM_CHUNK_PATHS, mode);
+        }
+    }
+    return 1;
 }
 
 int main(int argc, char *argv[]) {
+    if (argc > 1 && strcmp(argv[1], "merge") == 0) {
+        return merge_main(argc - 1, argv + 1);
+    }
+    
     SimulationConfig config;
     parse_args(argc, argv, &config);
     
-    srand(time(NULL));
+    // Both estimators weight paths by the density of independent Gaussian years
+    if (config.copula_dof > 0 && (config.importance_level > 0 || config.sensitivities)) {
+        fprintf(stderr, "Error: --importance and --sensitivities cannot be combined with --t-copula\n");
+        return 1;
+    }
+    // Bootstrapped residuals carry no normal score to correlate
+    if (config.history_file[0] != '\0' && (config.factor_file[0] != '\0' || config.copula_dof > 0)) {
+        fprintf(stderr, "Error: --history cannot be combined with --factors or --t-copula\n");
+        return 1;
+    }
+    
+    if (config.shard_count > 0 && !config.seed_set) {
+        fprintf(stderr, "Error: --shard needs an explicit --seed so all shards draw from the same stream\n");
+        return 1;
+    }
+    if (!check_run_modes(&config)) {
+        return 1;
+    }
     
     printf("Monte Carlo Stock Metrics Simulation\n");
     printf("====================================\n");
@@ -578,10 +7436,61 @@ int main(int argc, char *argv[]) {
         printf("  Graph dimensions: %dx%d\n", config.graph_width, config.graph_height);
         printf("  Export CSV: %s\n", config.export_csv ? "Yes" : "No");
         printf("  Threads: %d\n", config.num_threads);
+        printf("  Out-of-core scratch: %s\n", config.out_of_core ? config.scratch_file : "No");
+        printf("  Seed: %llu\n", (unsigned long long)config.seed);
+        if (config.shard_count > 0) {
+            printf("  Shard: %d/%d -> %s\n", config.shard_index, config.shard_count, config.partial_file);
+        }
+    }
+    
+    FactorLoadings factors;
+    if (config.factor_file[0] != '\0') {
+        if (!load_factor_loadings(config.factor_file, &factors)) {
+            return 1;
+        }
+        config.factors = &factors;
+    }
+    
+    ModelFile models;
+    if (config.model_file[0] != '\0') {
+        if (!load_model_file(config.model_file, &models)) {
+            return 1;
+        }
+        config.models = &models;
+    }
+    
+    HistoryFile history;
+    if (config.history_file[0] != '\0') {
+        if (!load_history(config.history_file, &history)) {
+            return 1;
+        }
+        config.history = &history;
+    }
+    
+    static RegimeModel regimes;
+    if (config.regime_file[0] != '\0') {
+        if (!load_regimes(config.regime_file, config.regime_start, &regimes)) {
+            return 1;
+        }
+        config.regimes = &regimes;
+    }
+    
+    static StressFile stress;
+    if (config.stress_file[0] != '\0') {
+        if (!load_stress_file(config.stress_file, &stress)) {
+            return 1;
+        }
+        config.stress = &stress;
+    }
+    
+    static CopulaTable copula;
+    if (config.copula_dof > 0) {
+        copula_table_init(&copula, config.copula_dof);
+        config.copula = &copula;
     }
     
     StockData *stocks = NULL;
-    int num_stocks = parse_stock_data(config.input_file, &stocks, 50);
+    int num_stocks = parse_stock_data(config.input_file, &stocks, 0);
     
     if (num_stocks == 0 || !stocks) {
         fprintf(stderr, "No valid stock data found in %s\n", config.input_file);
@@ -592,7 +7501,102 @@ int main(int argc, char *argv[]) {
     
     printf("Found %d stock(s) for analysis:\n", num_stocks);
     for (int i = 0; i < num_stocks; i++) {
-        printf("- %s (%d years of forecasts)\n", stocks[i].ticker, stocks[i].num_years);
+        if (stocks[i].num_scenarios > 0) {
+            printf("- %s (%d years of forecasts, %d scenarios)\n", stocks[i].ticker, stocks[i].num_years,
+                   stocks[i].num_scenarios);
+        } else {
+            printf("- %s (%d years of forecasts)\n", stocks[i].ticker, stocks[i].num_years);
+        }
+    }
+    
+    if (config.shard_count > 0) {
+        int ok = run_shard(stocks, num_stocks, &config);
+        free(stocks);
+        return ok ? 0 : 1;
+    }
+    
+    if (config.resume && config.checkpoint_file[0] == '\0') {
+        fprintf(stderr, "Error: --resume needs the --checkpoint file of the interrupted run\n");
+        free(stocks);
+        return 1;
+    }
+    
+    if (config.stress) {
+        int ok = run_stress(stocks, num_stocks, &config);
+        free(stocks);
+        if (ok) {
+            printf("\nStress results written to %s\n", config.output_file);
+        }
+        return ok ? 0 : 1;
+    }
+    
+    if (config.reverse.kind != REVERSE_NONE) {
+        int ok = run_reverse_stress(stocks, num_stocks, &config);
+        free(stocks);
+        if (ok) {
+            printf("\nReverse stress results written to %s\n", config.output_file);
+        }
+        return ok ? 0 : 1;
+    }
+    
+    if (config.time_budget > 0) {
+        int ok = run_time_budgeted(stocks, num_stocks, &config);
+        free(stocks);
+        if (ok) {
+            printf("\nAnalysis complete! Results written to %s\n", config.output_file);
+        }
+        return ok ? 0 : 1;
+    }
+    
+    if (config.importance_level > 0) {
+        FILE *output = fopen(config.output_file, "w");
+        if (!output) {
+            fprintf(stderr, "Error: Could not create output file %s\n", config.output_file);
+            free(stocks);
+            return 1;
+        }
+        write_run_header(output, config.input_file, config.num_simulations, config.volatility_factor, config.seed);
+        for (int i = 0; i < num_stocks; i++) {
+            printf("Running importance-sampled simulation for %s...\n", stocks[i].ticker);
+            run_importance_sampling(&stocks[i], output, &config);
+        }
+        fclose(output);
+        free(stocks);
+        printf("\nAnalysis complete! Results written to %s\n", config.output_file);
+        return 0;
+    }
+    
+    if (config.analytic) {
+        int ok = run_analytic(stocks, num_stocks, &config);
+        free(stocks);
+        if (ok) {
+            printf("\nAnalysis complete! Results written to %s\n", config.output_file);
+        }
+        return ok ? 0 : 1;
+    }
+    
+    if (config.extend_to > 0 && config.state_file[0] == '\0') {
+        fprintf(stderr, "Error: --extend-to needs the --state file of the run to extend\n");
+        free(stocks);
+        return 1;
+    }
+    
+    if (config.state_file[0] != '\0') {
+        int ok = run_progressive(stocks, num_stocks, &config);
+        free(stocks);
+        if (ok) {
+            printf("\nAnalysis complete! Results written to %s (state saved to %s)\n", config.output_file, config.state_file);
+        }
+        return ok ? 0 : 1;
+    }
+    
+    if (config.checkpoint_file[0] != '\0') {
+        int ok = run_checkpointed(stocks, num_stocks, &config);
+        free(stocks);
+        if (ok) {
+            printf("\nAnalysis complete! Results written to %s\n", config.output_file);
+        }
+        return ok ? 0 : 1;
     }
     
     FILE *output = fopen(config.output_file, "w");
@@ -603,22 +7607,41 @@ int main(int argc, char *argv[]) {
     }
     
     // Write header
-    time_t now = time(NULL);
-    fprintf(output, "MONTE CARLO SIMULATION ANALYSIS REPORT\n");
-    fprintf(output, "Generated: %s", ctime(&now));
-    fprintf(output, "Input File: %s\n", config.input_file);
-    fprintf(output, "Simulations per Stock: %d\n", config.num_simulations);
-    fprintf(output, "Volatility Factor: %.2f\n", config.volatility_factor);
-    fprintf(output, "\n");
+    write_run_header(output, config.input_file, config.num_simulations, config.volatility_factor, config.seed);
+    
+    ScratchFile scratch = { .fd = -1 };
+    if (config.out_of_core && !scratch_open(&scratch, config.scratch_file)) {
+        fclose(output);
+        free(stocks);
+        return 1;
+    }
     
     // Run simulations for each stock
     for (int i = 0; i < num_stocks; i++) {
         printf("Running Monte Carlo simulation for %s...\n", stocks[i].ticker);
-        run_monte_carlo(&stocks[i], output, &config);
+        if (config.verbose && stock_is_gaussian(&config, &stocks[i])) {
+            double forecast_mean;
+            AnalyticModel preview;
+            analytic_model_init(&preview, &stocks[i],
+                                compute_forecast_std(&stocks[i], config.volatility_factor, &forecast_mean));
+            Statistics stats = analytic_statistics(&preview, config.num_simulations);
+            printf("  Analytic preview: mean %.2f%%, median %.2f%%, VaR95 %.2f%%, VaR99 %.2f%% (+/-%.2f pp)\n",
+                   stats.mean, stats.percentile_50, stats.var_95, stats.var_99, preview.error);
+        }
+        run_monte_carlo(&stocks[i], output, &config, config.out_of_core ? &scratch : NULL);
+    }
+    
+    if ((config.factors || config.copula || config.regimes) && num_stocks > 1) {
+        run_factor_portfolio(stocks, num_stocks, output, &config);
     }
     
     fclose(output);
     
+    if (config.out_of_core) {
+        scratch_close(&scratch);
+        printf("Simulated paths for %u stock(s) kept in %s\n", scratch.num_blocks, config.scratch_file);
+    }
+    
     printf("\nAnalysis complete! Results written to %s\n", config.output_file);
     printf("Check the output file for detailed statistics, graphs, and risk metrics.\n");
     